@@ -0,0 +1,145 @@
+#include "admission.h"
+#include <algorithm>
+#include "logger.h"
+
+namespace {
+
+int64_t steady_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* storage_state_name(AdmissionController::StorageState state) {
+    switch (state) {
+        case AdmissionController::StorageState::Normal: return "normal";
+        case AdmissionController::StorageState::Delayed: return "delayed";
+        case AdmissionController::StorageState::Stalled: return "stalled";
+    }
+    return "unknown";
+}
+
+}
+
+AdmissionOptions AdmissionOptions::from_config(const ConfigReader& config, size_t server_threads) {
+    AdmissionOptions options;
+    server_threads = std::max<size_t>(server_threads, 1);
+    options.max_ingest_requests = config.getInt64("admission", "max_ingest_requests", 0);
+    if (options.max_ingest_requests == 0) {
+        options.max_ingest_requests = std::max<size_t>(1, server_threads * 3 / 4);
+    }
+    options.max_query_requests = config.getInt64("admission", "max_query_requests", 0);
+    if (options.max_query_requests == 0) {
+        options.max_query_requests = std::max<size_t>(1, server_threads / 2);
+    }
+    options.max_pending_compaction_bytes = config.getInt64("admission", "max_pending_compaction_bytes",
+                                                           options.max_pending_compaction_bytes);
+    options.max_queued_logs = config.getInt64("admission", "max_queued_logs", 0);
+    if (options.max_queued_logs == 0) {
+        options.max_queued_logs = config.getInt64("async_queue_max_logs", 100000) * 3 / 4;
+    }
+    options.delayed_ingest_percent = std::min<int64_t>(100, std::max<int64_t>(0,
+        config.getInt64("admission", "delayed_ingest_percent", options.delayed_ingest_percent)));
+    options.check_interval = std::chrono::milliseconds(
+        config.getInt64("admission", "check_interval_ms", options.check_interval.count()));
+    options.retry_after = std::chrono::seconds(std::max<int64_t>(1,
+        config.getInt64("admission", "retry_after_seconds", options.retry_after.count())));
+    return options;
+}
+
+AdmissionController::Ticket& AdmissionController::Ticket::operator=(Ticket&& other) noexcept {
+    if (this != &other) {
+        release();
+        slot = other.slot;
+        other.slot = nullptr;
+    }
+    return *this;
+}
+
+void AdmissionController::Ticket::release() {
+    if (slot) {
+        slot->fetch_sub(1, std::memory_order_relaxed);
+        slot = nullptr;
+    }
+}
+
+AdmissionController::AdmissionController(const AdmissionOptions& options, std::shared_ptr<DBWrapper> db)
+    : options(options),
+      db(std::move(db)),
+      state(static_cast<int>(StorageState::Normal)),
+      checked_at_us(INT64_MIN / 2) {
+    classes[index(TrafficClass::Ingest)].budget = options.max_ingest_requests;
+    classes[index(TrafficClass::Query)].budget = options.max_query_requests;
+}
+
+AdmissionController::Verdict AdmissionController::admit(TrafficClass traffic, Ticket& ticket) {
+    Class& admitted = classes[index(traffic)];
+    size_t budget = admitted.budget;
+    if (traffic == TrafficClass::Ingest) {
+        StorageState storage = storage_state();
+        if (storage == StorageState::Stalled) {
+            admitted.rejected.fetch_add(1, std::memory_order_relaxed);
+            return Verdict::Stalled;
+        }
+        if (storage == StorageState::Delayed) {
+            budget = std::max<size_t>(1, budget * options.delayed_ingest_percent / 100);
+        }
+    }
+
+    size_t current = admitted.in_flight.load(std::memory_order_relaxed);
+    do {
+        if (current >= budget) {
+            admitted.rejected.fetch_add(1, std::memory_order_relaxed);
+            return Verdict::Busy;
+        }
+    } while (!admitted.in_flight.compare_exchange_weak(current, current + 1, std::memory_order_relaxed));
+    ticket = Ticket();
+    ticket.slot = &admitted.in_flight;
+    return Verdict::Admitted;
+}
+
+AdmissionController::StorageState AdmissionController::storage_state() {
+    int64_t now = steady_now_us();
+    auto interval = std::chrono::duration_cast<std::chrono::microseconds>(options.check_interval).count();
+    if (now - checked_at_us.load(std::memory_order_acquire) < interval) {
+        return static_cast<StorageState>(state.load(std::memory_order_relaxed));
+    }
+    // Others go on with the last state while one thread reads the new one
+    std::unique_lock<std::mutex> lock(check_mutex, std::try_to_lock);
+    if (!lock || now - checked_at_us.load(std::memory_order_acquire) < interval) {
+        return static_cast<StorageState>(state.load(std::memory_order_relaxed));
+    }
+
+    StorageState previous = static_cast<StorageState>(state.load(std::memory_order_relaxed));
+    StorageState current = previous;
+    try {
+        current = read_storage_state();
+    } catch (const std::exception& e) {
+        LOG_ERROR("Error reading storage state: " << e.what());
+    }
+    state.store(static_cast<int>(current), std::memory_order_relaxed);
+    checked_at_us.store(now, std::memory_order_release);
+    if (current != previous) {
+        if (current == StorageState::Normal) {
+            LOG_INFO("Storage caught up; admitting ingest again");
+        } else {
+            LOG_WARN("Storage " << storage_state_name(current) << " (was " << storage_state_name(previous) << ")"
+                     << (current == StorageState::Stalled ? "; turning ingest away" : "; reducing ingest budget"));
+        }
+    }
+    return current;
+}
+
+AdmissionController::StorageState AdmissionController::read_storage_state() {
+    bool stopped = db->property_max("rocksdb.is-write-stopped") > 0;
+    uint64_t pending_compaction = db->property_max("rocksdb.estimate-pending-compaction-bytes");
+    size_t queued = db->ingest_queue_logs();
+    if (stopped || (options.max_pending_compaction_bytes > 0 && pending_compaction >= options.max_pending_compaction_bytes) ||
+        (options.max_queued_logs > 0 && queued >= options.max_queued_logs)) {
+        return StorageState::Stalled;
+    }
+    // Non-zero only while writes are being slowed down
+    if (db->property_max("rocksdb.actual-delayed-write-rate") > 0) {
+        return StorageState::Delayed;
+    }
+    return StorageState::Normal;
+}
@@ -0,0 +1,97 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "config_reader.h"
+#include "db_wrapper.h"
+
+// Inserts and loads, or queries and lookups
+enum class TrafficClass { Ingest = 0, Query = 1 };
+
+struct AdmissionOptions {
+    // Requests handled at once per class. Each is kept below the server
+    // threads so that one class cannot occupy all of them.
+    size_t max_ingest_requests = 0;  // 0 = three quarters of the server threads
+    size_t max_query_requests = 0;   // 0 = half of them
+    // Storage counts as stalled, and ingest is turned away, while RocksDB has
+    // stopped writes or while either of these is exceeded (0 = no limit)
+    uint64_t max_pending_compaction_bytes = 32ULL * 1024 * 1024 * 1024;
+    size_t max_queued_logs = 0;      // async logs waiting; 0 = three quarters of async_queue_max_logs
+    // Share of the ingest budget left while RocksDB is slowing writes down
+    size_t delayed_ingest_percent = 50;
+    std::chrono::milliseconds check_interval{200};
+    std::chrono::seconds retry_after{1};
+
+    static AdmissionOptions from_config(const ConfigReader& config, size_t server_threads);
+};
+
+// Decides whether new work is taken on, before it can pile up behind a
+// storage that is not keeping up. Ingest and query traffic have separate
+// budgets of requests in flight; over budget a request is turned away as
+// Busy. Ingest is also turned away as Stalled while RocksDB has stopped
+// writes or is too far behind, and gets a smaller budget while RocksDB is
+// delaying writes. The storage state is read from RocksDB properties at most
+// once per check_interval, by whichever request comes along.
+class AdmissionController {
+public:
+    enum class Verdict { Admitted, Busy, Stalled };
+    enum class StorageState { Normal = 0, Delayed = 1, Stalled = 2 };
+
+    // Holds a slot of a class's budget until destroyed. Empty tickets hold
+    // nothing.
+    class Ticket {
+    public:
+        Ticket() = default;
+        Ticket(Ticket&& other) noexcept : slot(other.slot) { other.slot = nullptr; }
+        Ticket& operator=(Ticket&& other) noexcept;
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+        ~Ticket() { release(); }
+
+        void release();
+
+    private:
+        friend class AdmissionController;
+        std::atomic<size_t>* slot = nullptr;
+    };
+
+    AdmissionController(const AdmissionOptions& options, std::shared_ptr<DBWrapper> db);
+
+    // Fills in the ticket when admitted
+    Verdict admit(TrafficClass traffic, Ticket& ticket);
+
+    // For the binary ingest protocol, which stops reading frames while this
+    // holds instead of rejecting them
+    bool ingest_stalled() { return storage_state() == StorageState::Stalled; }
+
+    StorageState storage_state();
+    size_t in_flight(TrafficClass traffic) const { return classes[index(traffic)].in_flight.load(); }
+    uint64_t rejected(TrafficClass traffic) const { return classes[index(traffic)].rejected.load(); }
+    std::chrono::seconds retry_after() const { return options.retry_after; }
+    std::chrono::milliseconds check_interval() const { return options.check_interval; }
+
+private:
+    struct Class {
+        size_t budget = 0;
+        std::atomic<size_t> in_flight{0};
+        std::atomic<uint64_t> rejected{0};
+    };
+
+    static size_t index(TrafficClass traffic) { return static_cast<size_t>(traffic); }
+    StorageState read_storage_state();
+
+    AdmissionOptions options;
+    std::shared_ptr<DBWrapper> db;
+    std::array<Class, 2> classes;
+
+    std::atomic<int> state;
+    std::atomic<int64_t> checked_at_us;
+    std::mutex check_mutex;  // one thread reads the properties at a time
+};
+
+#endif // ADMISSION_H
@@ -0,0 +1,281 @@
+#include "aggregate.h"
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "key_encoding.h"
+#include "logger.h"
+#include "prefix_cursor.h"
+
+namespace {
+
+const size_t MULTIGET_BATCH_SIZE = 256;
+
+std::string_view to_string_view(const rocksdb::Slice& slice) {
+    return std::string_view(slice.data(), slice.size());
+}
+
+class RangeAggregator {
+public:
+    RangeAggregator(rocksdb::DB* db, const rocksdb::Snapshot* snapshot, rocksdb::ColumnFamilyHandle* partition,
+                    const std::set<std::string>& indexed_fields, const AggregateQuery& query,
+                    int64_t start_timestamp, int64_t end_timestamp)
+        : db(db), snapshot(snapshot), partition(partition), query(query),
+          start_timestamp(start_timestamp), end_timestamp(end_timestamp) {
+        for (const auto& filter : query.query.filters) {
+            if (indexed_fields.count(filter.first)) {
+                index_filters.push_back(filter);
+            } else {
+                residual_filters.push_back(filter);
+            }
+        }
+        group_indexed = !query.group_by.empty() && indexed_fields.count(query.group_by);
+    }
+
+    AggregateResult run() {
+        if (group_indexed && query.query.filters.empty()) {
+            count_by_field_index();
+        } else if (residual_filters.empty() && query.group_by.empty()) {
+            count_keys();
+        } else {
+            count_records();
+        }
+        return std::move(result);
+    }
+
+private:
+    int64_t bucket_of(int64_t timestamp) const {
+        if (query.bucket_ms <= 0) {
+            return 0;
+        }
+        int64_t bucket = timestamp / query.bucket_ms;
+        if (timestamp % query.bucket_ms < 0) {
+            --bucket;
+        }
+        return bucket * query.bucket_ms;
+    }
+
+    std::unique_ptr<PrefixCursor> record_cursor() {
+        std::unique_ptr<PrefixCursor> cursor(new PrefixCursor(db, snapshot, partition,
+            std::string(1, RECORD_KEY_TAG), start_timestamp, end_timestamp));
+        cursor->start("");
+        return cursor;
+    }
+
+    std::unique_ptr<Intersection> index_intersection() {
+        std::vector<std::unique_ptr<PrefixCursor>> cursors;
+        for (const auto& filter : index_filters) {
+            cursors.emplace_back(new PrefixCursor(db, snapshot, partition,
+                encode_metadata_index_prefix(filter.first, filter.second), start_timestamp, end_timestamp));
+            cursors.back()->start("");
+        }
+        return std::unique_ptr<Intersection>(new Intersection(std::move(cursors)));
+    }
+
+    // Counts without reading any record value
+    void count_keys() {
+        if (index_filters.empty()) {
+            std::unique_ptr<PrefixCursor> cursor = record_cursor();
+            for (; cursor->valid(); cursor->next()) {
+                result.add(bucket_of(time_key_timestamp(cursor->suffix())), "");
+            }
+            check_status(*cursor);
+            return;
+        }
+        std::unique_ptr<Intersection> candidates = index_intersection();
+        std::string suffix;
+        while (candidates->next(suffix)) {
+            result.add(bucket_of(time_key_timestamp(suffix)), "");
+        }
+    }
+
+    // Walks <field><value><time key> entries one value at a time, seeking
+    // straight to the time range of each value. Logs missing from the index
+    // are the difference to the per-bucket totals taken from the record keys.
+    void count_by_field_index() {
+        count_keys();
+        AggregateResult totals = std::move(result);
+        result = AggregateResult();
+
+        std::string field_prefix = encode_metadata_field_prefix(query.group_by);
+        std::string field_limit = prefix_successor(field_prefix);
+        rocksdb::Slice upper_bound(field_limit);
+        rocksdb::ReadOptions read_options;
+        read_options.snapshot = snapshot;
+        read_options.iterate_upper_bound = &upper_bound;
+        std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(read_options, partition));
+
+        for (it->Seek(field_prefix); it->Valid();) {
+            rocksdb::Slice key = it->key();
+            const char* p = key.data() + field_prefix.size();
+            const char* limit = key.data() + key.size();
+            uint64_t value_size;
+            if (!get_varint64(p, limit, value_size) || static_cast<uint64_t>(limit - p) < value_size) {
+                throw std::runtime_error("Corrupt metadata index key");
+            }
+            std::string value(p, value_size);
+            std::string value_prefix(key.data(), p + value_size - key.data());
+
+            for (it->Seek(value_prefix + encode_time_key(start_timestamp, "")); it->Valid(); it->Next()) {
+                rocksdb::Slice entry = it->key();
+                if (!entry.starts_with(value_prefix)) {
+                    break;
+                }
+                int64_t timestamp = time_key_timestamp(rocksdb::Slice(entry.data() + value_prefix.size(), 8));
+                if (timestamp > end_timestamp) {
+                    break;
+                }
+                result.add(bucket_of(timestamp), value);
+            }
+            if (!it->status().ok()) {
+                throw std::runtime_error("Error iterating over index: " + it->status().ToString());
+            }
+            it->Seek(prefix_successor(value_prefix));
+        }
+        if (!it->status().ok()) {
+            throw std::runtime_error("Error iterating over index: " + it->status().ToString());
+        }
+
+        for (const auto& bucket : totals.counts) {
+            uint64_t total = bucket.second.at("");
+            uint64_t grouped = 0;
+            auto found = result.counts.find(bucket.first);
+            if (found != result.counts.end()) {
+                for (const auto& group : found->second) {
+                    grouped += group.second;
+                }
+            }
+            if (total > grouped) {
+                result.add_missing(bucket.first, total - grouped);
+            }
+        }
+    }
+
+    void count_records() {
+        if (index_filters.empty()) {
+            std::unique_ptr<PrefixCursor> cursor = record_cursor();
+            for (; cursor->valid(); cursor->next()) {
+                add_record(to_string_view(cursor->value()));
+            }
+            check_status(*cursor);
+            return;
+        }
+
+        std::unique_ptr<Intersection> candidates = index_intersection();
+        rocksdb::ReadOptions read_options;
+        read_options.snapshot = snapshot;
+        std::vector<std::string> record_keys;
+        std::string suffix;
+        bool more = true;
+        while (more) {
+            record_keys.clear();
+            while (record_keys.size() < MULTIGET_BATCH_SIZE && (more = candidates->next(suffix))) {
+                record_keys.push_back(RECORD_KEY_TAG + suffix);
+            }
+            if (record_keys.empty()) {
+                break;
+            }
+            std::vector<rocksdb::Slice> keys(record_keys.begin(), record_keys.end());
+            std::vector<rocksdb::PinnableSlice> values(keys.size());
+            std::vector<rocksdb::Status> statuses(keys.size());
+            db->MultiGet(read_options, partition, keys.size(), keys.data(), values.data(), statuses.data());
+            for (size_t i = 0; i < values.size(); ++i) {
+                if (statuses[i].ok()) {
+                    add_record(to_string_view(values[i]));
+                }
+            }
+        }
+    }
+
+    void add_record(std::string_view value) {
+        try {
+            Log log = Log::deserialize(value);
+            const nlohmann::json& metadata = log.metadata();
+            std::string text;
+            for (const auto& filter : residual_filters) {
+                auto field = metadata.find(filter.first);
+                if (field == metadata.end() || !metadata_value_text(*field, text) || text != filter.second) {
+                    return;
+                }
+            }
+            if (query.group_by.empty()) {
+                text.clear();
+            } else {
+                auto field = metadata.find(query.group_by);
+                if (field == metadata.end() || !metadata_value_text(*field, text)) {
+                    result.add_missing(bucket_of(log.timestamp()));
+                    return;
+                }
+            }
+            result.add(bucket_of(log.timestamp()), text);
+        } catch (const std::exception& e) {
+            LOG_ERROR("Error deserializing log: " << e.what());
+        }
+    }
+
+    void check_status(const PrefixCursor& cursor) const {
+        if (!cursor.status().ok()) {
+            throw std::runtime_error("Error iterating over logs: " + cursor.status().ToString());
+        }
+    }
+
+    rocksdb::DB* db;
+    const rocksdb::Snapshot* snapshot;
+    rocksdb::ColumnFamilyHandle* partition;
+    const AggregateQuery& query;
+    int64_t start_timestamp;
+    int64_t end_timestamp;
+    std::vector<std::pair<std::string, std::string>> index_filters;
+    std::vector<std::pair<std::string, std::string>> residual_filters;
+    bool group_indexed;
+    AggregateResult result;
+};
+
+}
+
+void AggregateResult::add(int64_t bucket, const std::string& group, uint64_t n) {
+    counts[bucket][group] += n;
+    count += n;
+}
+
+void AggregateResult::add_missing(int64_t bucket, uint64_t n) {
+    counts[bucket];
+    missing[bucket] += n;
+    count += n;
+}
+
+uint64_t AggregateResult::bucket_count(int64_t bucket) const {
+    uint64_t total = missing_count(bucket);
+    auto found = counts.find(bucket);
+    if (found != counts.end()) {
+        for (const auto& group : found->second) {
+            total += group.second;
+        }
+    }
+    return total;
+}
+
+uint64_t AggregateResult::missing_count(int64_t bucket) const {
+    auto found = missing.find(bucket);
+    return found == missing.end() ? 0 : found->second;
+}
+
+void AggregateResult::merge(const AggregateResult& other) {
+    for (const auto& bucket : other.counts) {
+        auto& groups = counts[bucket.first];
+        for (const auto& group : bucket.second) {
+            groups[group.first] += group.second;
+        }
+    }
+    for (const auto& bucket : other.missing) {
+        missing[bucket.first] += bucket.second;
+    }
+    count += other.count;
+}
+
+AggregateResult aggregate_range(rocksdb::DB* db, const rocksdb::Snapshot* snapshot,
+                                rocksdb::ColumnFamilyHandle* partition,
+                                const std::set<std::string>& indexed_fields,
+                                const AggregateQuery& query,
+                                int64_t start_timestamp, int64_t end_timestamp) {
+    return RangeAggregator(db, snapshot, partition, indexed_fields, query, start_timestamp, end_timestamp).run();
+}
@@ -0,0 +1,47 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <rocksdb/db.h>
+#include "log_scanner.h"
+
+// Counts the logs matching a query, optionally per value of a metadata
+// field and/or per fixed-width time bucket
+struct AggregateQuery {
+    LogQuery query;
+    std::string group_by;   // metadata field; empty for no grouping
+    int64_t bucket_ms = 0;  // bucket width; 0 for no time buckets
+};
+
+// Without buckets everything is counted in bucket 0, without grouping under
+// the group "". Logs that lack the group field, or hold a value there that
+// cannot be indexed, are counted in missing rather than under any group, so
+// they cannot be mixed up with a real value. Every bucket with a missing
+// count also has an entry in counts.
+struct AggregateResult {
+    uint64_t count = 0;
+    std::map<int64_t, std::map<std::string, uint64_t>> counts;
+    std::map<int64_t, uint64_t> missing;
+
+    void add(int64_t bucket, const std::string& group, uint64_t n = 1);
+    void add_missing(int64_t bucket, uint64_t n = 1);
+    // Logs in the bucket, with or without the group field
+    uint64_t bucket_count(int64_t bucket) const;
+    uint64_t missing_count(int64_t bucket) const;
+    void merge(const AggregateResult& other);
+};
+
+// Aggregates the logs of one partition inside [start_timestamp, end_timestamp].
+// Record values are only read when a filter or the grouping needs them:
+// plain counts come from record or index keys alone, and grouping on an
+// indexed field without filters walks that field's index.
+AggregateResult aggregate_range(rocksdb::DB* db, const rocksdb::Snapshot* snapshot,
+                                rocksdb::ColumnFamilyHandle* partition,
+                                const std::set<std::string>& indexed_fields,
+                                const AggregateQuery& query,
+                                int64_t start_timestamp, int64_t end_timestamp);
+
+#endif // AGGREGATE_H
@@ -1,78 +1,273 @@
+#include "benchmark.h"
 #include "log.h"
 #include "db_wrapper.h"
+#include "metrics.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
-#include <random>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
 #include <vector>
 
-class LogGenerator {
-private:
-    std::mt19937 gen;
-    std::uniform_int_distribution<> event_dist;
-    int id_counter;
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum Operation { PUT, GET, SCAN, BATCH, OPERATION_COUNT };
+const char* const OPERATION_NAMES[] = { "put", "get", "scan", "batch_insert" };
 
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+class LogGenerator {
 public:
-    LogGenerator() : 
-        gen(std::chrono::system_clock::now().time_since_epoch().count()),
-        event_dist(0, 4),
-        id_counter(0) {}
+    LogGenerator(uint64_t seed, const BenchmarkOptions& options, int64_t end_time)
+        : gen(seed), event_dist(0, 4), char_dist(0, 61), options(options), end_time(end_time) {}
 
-    Log generate() {
-        std::string reference = "REF" + std::to_string(++id_counter);
+    // Random payload, so that compression sees realistic data
+    Log generate(const std::string& reference, int64_t timestamp) {
+        std::string payload(options.value_size, ' ');
+        for (auto& c : payload) {
+            static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+            c = alphabet[char_dist(gen)];
+        }
         nlohmann::json metadata;
         metadata["event"] = "Event" + std::to_string(event_dist(gen));
-        metadata["details"] = "This is log entry " + std::to_string(id_counter);
-        
-        return Log(reference, metadata);
+        metadata["user_id"] = std::to_string(gen() % 10000);
+        metadata["payload"] = payload;
+        return Log(reference, metadata, timestamp);
     }
+
+    // Timestamp inside the loaded span
+    int64_t random_timestamp() {
+        uint64_t span = static_cast<uint64_t>(std::max<int64_t>(options.time_span_ms, 1));
+        return end_time - static_cast<int64_t>(gen() % span);
+    }
+
+    std::mt19937_64& engine() { return gen; }
+
+private:
+    std::mt19937_64 gen;
+    std::uniform_int_distribution<> event_dist;
+    std::uniform_int_distribution<> char_dist;
+    const BenchmarkOptions& options;
+    int64_t end_time;
+};
+
+struct OperationStats {
+    Histogram latency;
+    Counter logs;    // logs written or read
+    Counter errors;
+};
+
+struct Phase {
+    std::string name;
+    double seconds = 0;
+    std::array<OperationStats, OPERATION_COUNT> operations;
 };
 
+// Runs body(thread_index) on every thread and records the wall time
 template<typename Func>
-double benchmark(Func f, int iterations) {
-    auto start = std::chrono::high_resolution_clock::now();
-    for (int i = 0; i < iterations; ++i) {
-        f();
+void run_threads(Phase& phase, size_t threads, Func body) {
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back(body, t);
+    }
+    for (auto& worker : workers) {
+        worker.join();
     }
-    auto end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> diff = end - start;
-    return diff.count() / iterations;
+    phase.seconds = std::chrono::duration<double>(Clock::now() - start).count();
 }
 
-void run_benchmarks() {
+template<typename Func>
+void timed(OperationStats& stats, Func f) {
+    auto start = Clock::now();
     try {
-        DBWrapper db("./benchmark_db");
-        LogGenerator gen;
-
-        // Benchmark for single insert
-        double single_insert_time = benchmark([&]() {
-            db.insert_log(gen.generate());
-        }, 1000);
-        std::cout << "Average time for single insert: " << single_insert_time << " seconds\n";
-
-        // Benchmark for multiple inserts
-        double multiple_insert_time = benchmark([&]() {
-            for (int i = 0; i < 100; ++i) {
-                db.insert_log(gen.generate());
+        stats.logs.add(f());
+    } catch (const std::exception&) {
+        stats.errors.add();
+    }
+    stats.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+}
+
+std::string load_reference(const std::string& run_id, size_t i) {
+    return "load-" + run_id + "-" + std::to_string(i);
+}
+
+void load_phase(DBWrapper& db, const BenchmarkOptions& options, const std::string& run_id, int64_t end_time, Phase& phase) {
+    std::atomic<size_t> next_batch(0);
+    size_t batch_count = (options.dataset_size + options.batch_size - 1) / options.batch_size;
+    run_threads(phase, options.threads, [&](size_t thread_index) {
+        LogGenerator gen(thread_index + 1, options, end_time);
+        for (size_t b = next_batch++; b < batch_count; b = next_batch++) {
+            std::vector<Log> logs;
+            for (size_t i = b * options.batch_size; i < std::min((b + 1) * options.batch_size, options.dataset_size); ++i) {
+                logs.push_back(gen.generate(load_reference(run_id, i), gen.random_timestamp()));
             }
-        }, 10);
-        std::cout << "Average time for inserting 100 logs: " << multiple_insert_time << " seconds\n";
-
-        // Benchmark for retrieval
-        double retrieval_time = benchmark([&]() {
-            db.get_log("REF1");
-        }, 1000);
-        std::cout << "Average time for single retrieval: " << retrieval_time << " seconds\n";
-
-        // Benchmark for range query
-        int64_t end_time = std::chrono::system_clock::now().time_since_epoch().count();
-        int64_t start_time = end_time - 86400000; // Last 24 hours in milliseconds
-        double range_query_time = benchmark([&]() {
-            db.get_logs_by_time_range(start_time, end_time);
-        }, 100);
-        std::cout << "Average time for fetching all logs added in the last 24hrs: " << range_query_time << " seconds\n";
+            timed(phase.operations[BATCH], [&]() {
+                std::vector<InsertStatus> statuses = db.batch_insert_logs(logs);
+                return std::count(statuses.begin(), statuses.end(), InsertStatus::Inserted);
+            });
+        }
+    });
+}
+
+void mixed_phase(DBWrapper& db, const BenchmarkOptions& options, const std::string& run_id, int64_t end_time, Phase& phase) {
+    std::atomic<bool> stop(false);
+    std::thread timer([&]() {
+        std::this_thread::sleep_for(std::chrono::duration<double>(options.duration_s));
+        stop = true;
+    });
 
+    run_threads(phase, options.threads, [&](size_t thread_index) {
+        LogGenerator gen(1000 + thread_index, options, end_time);
+        std::discrete_distribution<int> pick({
+            static_cast<double>(options.put_weight), static_cast<double>(options.get_weight),
+            static_cast<double>(options.scan_weight), static_cast<double>(options.batch_weight)});
+        std::uniform_int_distribution<size_t> loaded(0, options.dataset_size > 0 ? options.dataset_size - 1 : 0);
+        std::string prefix = "run-" + run_id + "-" + std::to_string(thread_index) + "-";
+        size_t next_id = 0;
+        std::vector<Log> results;
+
+        while (!stop) {
+            switch (pick(gen.engine())) {
+                case PUT: {
+                    Log log = gen.generate(prefix + std::to_string(next_id++), now_ms());
+                    timed(phase.operations[PUT], [&]() { return db.insert_log(log) == InsertStatus::Inserted ? 1 : 0; });
+                    break;
+                }
+                case GET: {
+                    std::string reference = load_reference(run_id, loaded(gen.engine()));
+                    timed(phase.operations[GET], [&]() { db.get_log(reference); return 1; });
+                    break;
+                }
+                case SCAN: {
+                    int64_t start = gen.random_timestamp();
+                    timed(phase.operations[SCAN], [&]() {
+                        results.clear();
+                        db.scan_time_range(start, start + options.scan_window_ms)->next(results, options.scan_limit);
+                        return results.size();
+                    });
+                    break;
+                }
+                case BATCH: {
+                    std::vector<Log> logs;
+                    for (size_t i = 0; i < options.batch_size; ++i) {
+                        logs.push_back(gen.generate(prefix + std::to_string(next_id++), now_ms()));
+                    }
+                    timed(phase.operations[BATCH], [&]() {
+                        std::vector<InsertStatus> statuses = db.batch_insert_logs(logs);
+                        return std::count(statuses.begin(), statuses.end(), InsertStatus::Inserted);
+                    });
+                    break;
+                }
+            }
+        }
+    });
+    timer.join();
+}
+
+nlohmann::json phase_to_json(const Phase& phase) {
+    nlohmann::json operations = nlohmann::json::object();
+    for (size_t op = 0; op < OPERATION_COUNT; ++op) {
+        const OperationStats& stats = phase.operations[op];
+        Histogram::Snapshot latency = stats.latency.snapshot();
+        if (latency.count == 0) {
+            continue;
+        }
+        operations[OPERATION_NAMES[op]] = {
+            {"ops", latency.count},
+            {"errors", stats.errors.value()},
+            {"ops_per_sec", latency.count / phase.seconds},
+            {"logs_per_sec", stats.logs.value() / phase.seconds},
+            {"mean_us", static_cast<double>(latency.sum) / latency.count},
+            {"p50_us", latency.quantile(0.5)},
+            {"p99_us", latency.quantile(0.99)},
+            {"p999_us", latency.quantile(0.999)}
+        };
+    }
+    return {{"name", phase.name}, {"seconds", phase.seconds}, {"operations", operations}};
+}
+
+void print_phase(const nlohmann::json& phase) {
+    std::cout << "\n== " << phase["name"].get<std::string>() << " (" << std::fixed << std::setprecision(2)
+              << phase["seconds"].get<double>() << " s) ==\n";
+    std::cout << std::left << std::setw(14) << "operation" << std::right
+              << std::setw(12) << "ops/s" << std::setw(12) << "logs/s"
+              << std::setw(10) << "p50 us" << std::setw(10) << "p99 us" << std::setw(10) << "p999 us"
+              << std::setw(8) << "errors" << "\n";
+    for (const auto& op : phase["operations"].items()) {
+        const auto& stats = op.value();
+        std::cout << std::left << std::setw(14) << op.key() << std::right << std::setprecision(0)
+                  << std::setw(12) << stats["ops_per_sec"].get<double>()
+                  << std::setw(12) << stats["logs_per_sec"].get<double>()
+                  << std::setw(10) << stats["p50_us"].get<double>()
+                  << std::setw(10) << stats["p99_us"].get<double>()
+                  << std::setw(10) << stats["p999_us"].get<double>()
+                  << std::setw(8) << stats["errors"].get<uint64_t>() << "\n";
+    }
+}
+
+}
+
+int run_benchmarks(const BenchmarkOptions& options) {
+    try {
+        DBWrapper db(options.db_path, options.config_path);
+
+        // References are unique per run, so runs can share a database
+        int64_t end_time = now_ms();
+        std::string run_id = std::to_string(end_time);
+
+        Phase load;
+        load.name = "load";
+        std::cout << "Loading " << options.dataset_size << " logs with " << options.threads << " threads..." << std::endl;
+        load_phase(db, options, run_id, end_time, load);
+
+        Phase mixed;
+        mixed.name = "mixed";
+        std::cout << "Running mixed workload for " << options.duration_s << " s..." << std::endl;
+        mixed_phase(db, options, run_id, end_time, mixed);
+
+        nlohmann::json results = {
+            {"options", {
+                {"threads", options.threads},
+                {"value_size", options.value_size},
+                {"dataset_size", options.dataset_size},
+                {"batch_size", options.batch_size},
+                {"time_span_ms", options.time_span_ms},
+                {"scan_window_ms", options.scan_window_ms},
+                {"scan_limit", options.scan_limit},
+                {"duration_s", options.duration_s},
+                {"mix", {{"put", options.put_weight}, {"get", options.get_weight},
+                         {"scan", options.scan_weight}, {"batch_insert", options.batch_weight}}}
+            }},
+            {"phases", {phase_to_json(load), phase_to_json(mixed)}}
+        };
+
+        for (const auto& phase : results["phases"]) {
+            print_phase(phase);
+        }
+
+        if (options.json_path == "-") {
+            std::cout << results.dump(2) << std::endl;
+        } else if (!options.json_path.empty()) {
+            std::ofstream out(options.json_path);
+            if (!out) {
+                throw std::runtime_error("Cannot write " + options.json_path);
+            }
+            out << results.dump(2) << std::endl;
+        }
     } catch (const std::exception& e) {
         std::cerr << "Error in benchmarking: " << e.what() << std::endl;
+        return 1;
     }
+    return 0;
 }
-
@@ -0,0 +1,33 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <string>
+
+struct BenchmarkOptions {
+    std::string db_path = "./benchmark_db";
+    std::string config_path = "../config/db_config.yaml";
+    size_t threads = 4;
+    size_t value_size = 256;        // bytes of payload in each log's metadata
+    size_t dataset_size = 100000;   // logs loaded before the mixed phase
+    size_t batch_size = 100;
+    int64_t time_span_ms = 24LL * 60 * 60 * 1000;  // loaded timestamps spread over the span ending now
+    int64_t scan_window_ms = 60 * 1000;
+    size_t scan_limit = 100;        // logs read per time range scan
+    double duration_s = 10;         // length of the mixed phase
+
+    // Relative weights of the operations in the mixed phase
+    unsigned put_weight = 20;
+    unsigned get_weight = 60;
+    unsigned scan_weight = 10;
+    unsigned batch_weight = 10;
+
+    std::string json_path;          // results as JSON; "-" for stdout
+};
+
+// Loads the dataset with batch inserts, then runs the read/write mix from
+// several threads and reports throughput and latency percentiles per
+// operation. Returns the process exit code.
+int run_benchmarks(const BenchmarkOptions& options);
+
+#endif // BENCHMARK_H
@@ -1,10 +1,89 @@
 #include <iostream>
+#include <sstream>
+#include <string>
+#include "benchmark.h"
 
-void run_benchmarks();
+namespace {
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --db PATH             database directory (default ./benchmark_db)\n"
+              << "  --config PATH         config file (default ../config/db_config.yaml)\n"
+              << "  --threads N           worker threads (default 4)\n"
+              << "  --value-size BYTES    payload bytes per log (default 256)\n"
+              << "  --dataset N           logs loaded before the mixed phase (default 100000)\n"
+              << "  --batch-size N        logs per batch insert (default 100)\n"
+              << "  --time-span-ms MS     spread of loaded timestamps (default one day)\n"
+              << "  --scan-window-ms MS   time range per scan (default 60000)\n"
+              << "  --scan-limit N        logs read per scan (default 100)\n"
+              << "  --duration S          seconds of mixed workload (default 10)\n"
+              << "  --mix put=20,get=60,scan=10,batch=10\n"
+              << "                        operation weights of the mixed phase\n"
+              << "  --json PATH           write results as JSON (- for stdout)\n";
+}
+
+void parse_mix(const std::string& text, BenchmarkOptions& options) {
+    options.put_weight = options.get_weight = options.scan_weight = options.batch_weight = 0;
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            throw std::runtime_error("Invalid mix entry: " + item);
+        }
+        std::string name = item.substr(0, eq);
+        unsigned weight = std::stoul(item.substr(eq + 1));
+        if (name == "put") options.put_weight = weight;
+        else if (name == "get") options.get_weight = weight;
+        else if (name == "scan") options.scan_weight = weight;
+        else if (name == "batch") options.batch_weight = weight;
+        else throw std::runtime_error("Unknown operation in mix: " + name);
+    }
+    if (options.put_weight + options.get_weight + options.scan_weight + options.batch_weight == 0) {
+        throw std::runtime_error("Mix has no operations");
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                print_usage(argv[0]);
+                return 0;
+            }
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for " + arg);
+            }
+            std::string value = argv[++i];
+            if (arg == "--db") options.db_path = value;
+            else if (arg == "--config") options.config_path = value;
+            else if (arg == "--threads") options.threads = std::stoul(value);
+            else if (arg == "--value-size") options.value_size = std::stoul(value);
+            else if (arg == "--dataset") options.dataset_size = std::stoul(value);
+            else if (arg == "--batch-size") options.batch_size = std::stoul(value);
+            else if (arg == "--time-span-ms") options.time_span_ms = std::stoll(value);
+            else if (arg == "--scan-window-ms") options.scan_window_ms = std::stoll(value);
+            else if (arg == "--scan-limit") options.scan_limit = std::stoul(value);
+            else if (arg == "--duration") options.duration_s = std::stod(value);
+            else if (arg == "--mix") parse_mix(value, options);
+            else if (arg == "--json") options.json_path = value;
+            else throw std::runtime_error("Unknown option: " + arg);
+        }
+        if (options.threads == 0 || options.batch_size == 0) {
+            throw std::runtime_error("--threads and --batch-size must be positive");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        print_usage(argv[0]);
+        return 1;
+    }
 
-int main() {
     std::cout << "Running benchmarks...\n";
-    run_benchmarks();
+    int result = run_benchmarks(options);
     std::cout << "Benchmarks complete.\n";
-    return 0;
-}
\ No newline at end of file
+    return result;
+}
@@ -0,0 +1,72 @@
+#include "compression.h"
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+struct CompressionName {
+    const char* name;
+    rocksdb::CompressionType type;
+};
+
+const CompressionName COMPRESSION_NAMES[] = {
+    {"none", rocksdb::kNoCompression},
+    {"snappy", rocksdb::kSnappyCompression},
+    {"lz4", rocksdb::kLZ4Compression},
+    {"lz4hc", rocksdb::kLZ4HCCompression},
+    {"zstd", rocksdb::kZSTD},
+};
+
+rocksdb::CompressionType compression_setting(const std::string& name, const std::string& key) {
+    rocksdb::CompressionType type;
+    if (!parse_compression(name, type)) {
+        throw std::runtime_error("Unknown compression '" + name + "' for rocksdb." + key);
+    }
+    return type;
+}
+
+}
+
+bool parse_compression(const std::string& name, rocksdb::CompressionType& type) {
+    for (const auto& entry : COMPRESSION_NAMES) {
+        if (name == entry.name) {
+            type = entry.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string compression_name(rocksdb::CompressionType type) {
+    for (const auto& entry : COMPRESSION_NAMES) {
+        if (type == entry.type) {
+            return entry.name;
+        }
+    }
+    return "type " + std::to_string(static_cast<int>(type));
+}
+
+void apply_compression_config(const ConfigReader& config, rocksdb::Options& options) {
+    options.compression = compression_setting(config.getString("compression", "lz4"), "compression");
+    options.compression_opts.level = config.getInt("compression_level", 4);
+
+    // Small, repetitive records compress far better against a dictionary
+    // shared by a whole file than block by block
+    options.compression_opts.max_dict_bytes = config.getInt64("max_dict_bytes", 0);
+    options.compression_opts.zstd_max_train_bytes = config.getInt64("zstd_max_train_bytes", 0);
+
+    std::vector<std::string> per_level = config.getStringList("rocksdb", "compression_per_level");
+    options.compression_per_level.clear();
+    for (const auto& name : per_level) {
+        options.compression_per_level.push_back(compression_setting(name, "compression_per_level"));
+    }
+
+    std::string bottommost = config.getString("bottommost_compression", "");
+    if (!bottommost.empty()) {
+        options.bottommost_compression = compression_setting(bottommost, "bottommost_compression");
+        options.bottommost_compression_opts = options.compression_opts;
+        options.bottommost_compression_opts.level =
+            config.getInt("bottommost_compression_level", options.compression_opts.level);
+        options.bottommost_compression_opts.enabled = true;
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string>
+#include <rocksdb/options.h>
+#include "config_reader.h"
+
+// Compression names used in the config: none, snappy, lz4, lz4hc, zstd.
+// Returns false for anything else.
+bool parse_compression(const std::string& name, rocksdb::CompressionType& type);
+std::string compression_name(rocksdb::CompressionType type);
+
+// Applies the compression keys of the "rocksdb" section:
+//   compression, compression_level        every level, unless overridden
+//   compression_per_level                 list, one name per LSM level
+//   bottommost_compression(_level)        the last level holding data
+//   max_dict_bytes, zstd_max_train_bytes  zstd dictionary per SST file,
+//                                         trained on samples of its blocks
+// Throws std::runtime_error on an unknown compression name.
+void apply_compression_config(const ConfigReader& config, rocksdb::Options& options);
+
+#endif // COMPRESSION_H
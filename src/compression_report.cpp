@@ -0,0 +1,261 @@
+// Compression report: writes a sample of the stored logs into SST files with
+// each candidate compression setting, then reports the ratio each achieves
+// and what writing and reading the file back costs. Meant for choosing
+// rocksdb.compression, compression_per_level, bottommost_compression and
+// the zstd dictionary sizes for a given workload.
+//
+// The database must not be in use by a running server.
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <rocksdb/env.h>
+#include <rocksdb/sst_file_reader.h>
+#include <rocksdb/sst_file_writer.h>
+#include <rocksdb/table.h>
+#include "compression.h"
+#include "config_reader.h"
+#include "db_wrapper.h"
+#include "key_encoding.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Reading is timed this many times and the fastest run kept
+const int READ_RUNS = 3;
+const size_t SAMPLE_BATCH_SIZE = 1000;
+// zstd trains its dictionary on up to this many times its size in samples,
+// the ratio RocksDB recommends
+const uint32_t TRAIN_BYTES_PER_DICT_BYTE = 100;
+
+struct ReportOptions {
+    std::string db_path;
+    std::string config_path = "../config/db_config.yaml";
+    size_t sample = 100000;
+    size_t block_size = 4096;
+    std::string work_dir;  // default: <db_path>/compression_report
+};
+
+struct Setting {
+    std::string name;
+    rocksdb::CompressionType type;
+    int level;
+    uint32_t dict_bytes;
+};
+
+std::vector<Setting> candidate_settings(const ConfigReader& config) {
+    std::vector<Setting> settings = {
+        {"none", rocksdb::kNoCompression, 0, 0},
+        {"snappy", rocksdb::kSnappyCompression, 0, 0},
+        {"lz4", rocksdb::kLZ4Compression, 0, 0},
+        {"lz4hc", rocksdb::kLZ4HCCompression, 9, 0},
+        {"zstd:1", rocksdb::kZSTD, 1, 0},
+        {"zstd:3", rocksdb::kZSTD, 3, 0},
+        {"zstd:9", rocksdb::kZSTD, 9, 0},
+        {"zstd:3 dict 16K", rocksdb::kZSTD, 3, 16 * 1024},
+        {"zstd:3 dict 64K", rocksdb::kZSTD, 3, 64 * 1024},
+        {"zstd:9 dict 64K", rocksdb::kZSTD, 9, 64 * 1024},
+    };
+
+    // What the config asks for, as it applies to the bottom level
+    rocksdb::Options configured;
+    apply_compression_config(config, configured);
+    rocksdb::CompressionType type = configured.compression;
+    rocksdb::CompressionOptions opts = configured.compression_opts;
+    if (configured.bottommost_compression != rocksdb::kDisableCompressionOption) {
+        type = configured.bottommost_compression;
+        opts = configured.bottommost_compression_opts;
+    }
+    std::string name = "configured (" + compression_name(type) + ":" + std::to_string(opts.level);
+    if (opts.max_dict_bytes > 0) {
+        name += " dict " + std::to_string(opts.max_dict_bytes / 1024) + "K";
+    }
+    settings.push_back({name + ")", type, opts.level, opts.max_dict_bytes});
+    return settings;
+}
+
+rocksdb::Options options_for(const Setting& setting, size_t block_size) {
+    rocksdb::Options options;
+    options.compression = setting.type;
+    options.compression_opts.level = setting.level;
+    options.compression_opts.max_dict_bytes = setting.dict_bytes;
+    options.compression_opts.zstd_max_train_bytes = setting.dict_bytes * TRAIN_BYTES_PER_DICT_BYTE;
+
+    // Every read has to decompress, as a cold read would
+    rocksdb::BlockBasedTableOptions table_options;
+    table_options.block_size = block_size;
+    table_options.no_block_cache = true;
+    options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
+    return options;
+}
+
+// Record keys and stored records of up to `sample` logs, sorted by key
+std::vector<std::pair<std::string, std::string>> read_sample(DBWrapper& db, size_t sample) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    // Unordered, so the sample comes from several time ranges at once
+    std::unique_ptr<LogScanner> scanner = db.scan_query_parallel(LogQuery(), "", false);
+    std::vector<Log> logs;
+    bool more = true;
+    while (more && entries.size() < sample) {
+        logs.clear();
+        more = scanner->next(logs, std::min(SAMPLE_BATCH_SIZE, sample - entries.size()));
+        for (const auto& log : logs) {
+            entries.emplace_back(encode_record_key(log.timestamp(), log.reference()), log.serialize());
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+    return entries;
+}
+
+struct Result {
+    uint64_t file_bytes = 0;
+    double write_seconds = 0;
+    double read_seconds = 0;
+    std::string error;
+};
+
+Result measure(const Setting& setting, const ReportOptions& report,
+               const std::vector<std::pair<std::string, std::string>>& entries, const std::string& path) {
+    Result result;
+    rocksdb::Options options = options_for(setting, report.block_size);
+
+    auto start = Clock::now();
+    rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), options);
+    rocksdb::Status status = writer.Open(path);
+    for (size_t i = 0; status.ok() && i < entries.size(); ++i) {
+        status = writer.Put(entries[i].first, entries[i].second);
+    }
+    if (status.ok()) {
+        status = writer.Finish();
+    }
+    if (!status.ok()) {
+        result.error = status.ToString();
+        return result;
+    }
+    result.write_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.file_bytes = writer.FileSize();
+
+    for (int run = 0; run < READ_RUNS; ++run) {
+        start = Clock::now();
+        rocksdb::SstFileReader reader(options);
+        status = reader.Open(path);
+        if (!status.ok()) {
+            result.error = status.ToString();
+            return result;
+        }
+        rocksdb::ReadOptions read_options;
+        read_options.fill_cache = false;
+        std::unique_ptr<rocksdb::Iterator> it(reader.NewIterator(read_options));
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+        }
+        if (!it->status().ok()) {
+            result.error = it->status().ToString();
+            return result;
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (run == 0 || seconds < result.read_seconds) {
+            result.read_seconds = seconds;
+        }
+    }
+    return result;
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " <db_path> [options]\n"
+              << "  --config PATH       config file (default ../config/db_config.yaml)\n"
+              << "  --sample N          logs to sample (default 100000)\n"
+              << "  --block-size BYTES  SST block size (default 4096)\n"
+              << "  --work-dir PATH     where the trial files go (default <db_path>/compression_report)\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    ReportOptions report;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                print_usage(argv[0]);
+                return 0;
+            }
+            if (arg.compare(0, 2, "--") != 0) {
+                report.db_path = arg;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for " + arg);
+            }
+            std::string value = argv[++i];
+            if (arg == "--config") report.config_path = value;
+            else if (arg == "--sample") report.sample = std::stoul(value);
+            else if (arg == "--block-size") report.block_size = std::stoul(value);
+            else if (arg == "--work-dir") report.work_dir = value;
+            else throw std::runtime_error("Unknown option: " + arg);
+        }
+        if (report.db_path.empty()) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (report.work_dir.empty()) {
+            report.work_dir = report.db_path + "/compression_report";
+        }
+
+        ConfigReader config(report.config_path);
+        std::vector<Setting> settings = candidate_settings(config);
+        std::vector<std::pair<std::string, std::string>> entries;
+        {
+            DBWrapper db(report.db_path, report.config_path);
+            entries = read_sample(db, report.sample);
+        }
+        if (entries.empty()) {
+            std::cerr << "The database has no logs to sample" << std::endl;
+            return 1;
+        }
+        uint64_t raw_bytes = 0;
+        for (const auto& entry : entries) {
+            raw_bytes += entry.first.size() + entry.second.size();
+        }
+        boost::filesystem::create_directories(report.work_dir);
+
+        std::cout << "Sampled " << entries.size() << " logs, " << raw_bytes << " bytes of keys and records, "
+                  << report.block_size << " byte blocks\n\n";
+        std::cout << std::left << std::setw(34) << "setting" << std::right
+                  << std::setw(12) << "file bytes" << std::setw(8) << "ratio"
+                  << std::setw(12) << "write MB/s" << std::setw(12) << "read MB/s"
+                  << std::setw(14) << "read ns/log" << "\n";
+        for (size_t i = 0; i < settings.size(); ++i) {
+            std::string path = report.work_dir + "/" + std::to_string(i) + ".sst";
+            Result result = measure(settings[i], report, entries, path);
+            boost::system::error_code ignored;
+            boost::filesystem::remove(path, ignored);
+
+            std::cout << std::left << std::setw(34) << settings[i].name << std::right;
+            if (!result.error.empty()) {
+                std::cout << "  unavailable: " << result.error << "\n";
+                continue;
+            }
+            double mb = raw_bytes / 1e6;
+            std::cout << std::fixed << std::setprecision(2)
+                      << std::setw(12) << result.file_bytes
+                      << std::setw(8) << static_cast<double>(raw_bytes) / result.file_bytes
+                      << std::setw(12) << mb / result.write_seconds
+                      << std::setw(12) << mb / result.read_seconds
+                      << std::setw(14) << std::setprecision(0) << result.read_seconds * 1e9 / entries.size()
+                      << "\n";
+        }
+        boost::system::error_code ignored;
+        boost::filesystem::remove(report.work_dir, ignored);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -5,25 +5,53 @@ ConfigReader::ConfigReader(const std::string& config_path) {
 }
 
 int64_t ConfigReader::getInt64(const std::string& key, int64_t default_value) const {
+    return getInt64("rocksdb", key, default_value);
+}
+
+int ConfigReader::getInt(const std::string& key, int default_value) const {
+    return getInt("rocksdb", key, default_value);
+}
+
+std::string ConfigReader::getString(const std::string& key, const std::string& default_value) const {
+    return getString("rocksdb", key, default_value);
+}
+
+int64_t ConfigReader::getInt64(const std::string& section, const std::string& key, int64_t default_value) const {
     try {
-        return config["rocksdb"][key].as<int64_t>();
+        return config[section][key].as<int64_t>();
     } catch (...) {
         return default_value;
     }
 }
 
-int ConfigReader::getInt(const std::string& key, int default_value) const {
+int ConfigReader::getInt(const std::string& section, const std::string& key, int default_value) const {
     try {
-        return config["rocksdb"][key].as<int>();
+        return config[section][key].as<int>();
     } catch (...) {
         return default_value;
     }
 }
 
-std::string ConfigReader::getString(const std::string& key, const std::string& default_value) const {
+std::string ConfigReader::getString(const std::string& section, const std::string& key, const std::string& default_value) const {
     try {
-        return config["rocksdb"][key].as<std::string>();
+        return config[section][key].as<std::string>();
     } catch (...) {
         return default_value;
     }
-}
\ No newline at end of file
+}
+
+std::vector<std::string> ConfigReader::getStringList(const std::string& section, const std::string& key) const {
+    try {
+        return config[section][key].as<std::vector<std::string>>();
+    } catch (...) {
+        return {};
+    }
+}
+std::vector<std::map<std::string, std::string>> ConfigReader::getMapList(const std::string& section,
+                                                                          const std::string& key) const {
+    try {
+        return config[section][key].as<std::vector<std::map<std::string, std::string>>>();
+    } catch (...) {
+        return {};
+    }
+}
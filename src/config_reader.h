@@ -1,16 +1,29 @@
 #pragma once
 
+#include <map>
 #include <string>
+#include <vector>
 #include <yaml-cpp/yaml.h>
 
 class ConfigReader {
 public:
     ConfigReader(const std::string& config_path);
 
+    // Keys in the "rocksdb" section
     int64_t getInt64(const std::string& key, int64_t default_value) const;
     int getInt(const std::string& key, int default_value) const;
     std::string getString(const std::string& key, const std::string& default_value) const;
 
+    // Keys in any other top-level section, e.g. "server"
+    int64_t getInt64(const std::string& section, const std::string& key, int64_t default_value) const;
+    int getInt(const std::string& section, const std::string& key, int default_value) const;
+    std::string getString(const std::string& section, const std::string& key, const std::string& default_value) const;
+    // Returns an empty list when the key is missing or not a sequence
+    std::vector<std::string> getStringList(const std::string& section, const std::string& key) const;
+    // A sequence of maps with scalar values, e.g. sketch definitions. Empty
+    // when the key is missing or holds anything else.
+    std::vector<std::map<std::string, std::string>> getMapList(const std::string& section, const std::string& key) const;
+
 private:
     YAML::Node config;
 };
\ No newline at end of file
@@ -1,16 +1,273 @@
 #include <stdexcept>
-#include <iostream>
 #include "db_wrapper.h"
+#include "compression.h"
 #include "config_reader.h"
 #include "log.h"
 #include <rocksdb/table.h>
 #include <rocksdb/filter_policy.h>
 #include <rocksdb/write_batch.h>
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <map>
+#include <unordered_set>
+#include <boost/filesystem.hpp>
+#include "json_writer.h"
+#include "key_encoding.h"
+#include "logger.h"
+#include "merging_scanner.h"
+#include "parallel_scanner.h"
+#include "sst_builder.h"
 
-DBWrapper::DBWrapper(const std::string& db_path, const std::string& config_path) {
+namespace {
+
+const std::string META_CF = "meta";
+const std::string SKETCH_CF = "sketches";
+
+// Column families of the unpartitioned layout, migrated away from on open
+const std::string LEGACY_TIME_INDEX_CF = "time_index";
+const std::string LEGACY_METADATA_INDEX_CF = "metadata_index";
+
+// Meta key holding the JSON list of fields the metadata index covers
+const std::string INDEXED_FIELDS_KEY = "indexed_fields";
+// Meta key holding the JSON object of sketch name -> definition signature
+const std::string SKETCH_DEFINITIONS_KEY = "sketch_definitions";
+// Meta key holding {"shard", "shards"}: which shard of how many the
+// database is
+const std::string SHARD_LAYOUT_KEY = "shard_layout";
+// Meta key set once every log is in a time partition. Databases without it
+// may hold records in the default column family, as the first layout did.
+const std::string PARTITIONED_KEY = "partitioned";
+
+const size_t MULTIGET_BATCH_SIZE = 256;
+const size_t BACKFILL_BATCH_SIZE = 10000;
+const size_t CONVERT_BATCH_SIZE = 1000;
+
+// Logs sorted and ingested together by bulk_load; bounds its memory use
+const size_t BULK_LOAD_CHUNK_LOGS = 1000000;
+
+// Aggregation ranges are not split below this width
+const int64_t MIN_AGGREGATE_SPLIT_MS = 60 * 1000;
+
+// Parallel scans use a few ranges per thread, so that a range that turns out
+// larger than estimated does not hold up the whole scan
+const size_t SCAN_RANGES_PER_THREAD = 4;
+
+std::string_view to_string_view(const rocksdb::Slice& slice) {
+    return std::string_view(slice.data(), slice.size());
+}
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Records start with '{' (legacy JSON) or the format version byte. A
+// locator of a timestamp within PartitionSet's range starts with 0x7f or
+// 0x80 once the sign bit is flipped, so it never starts with either.
+bool is_locator(const rocksdb::Slice& value) {
+    return value.size() == 8 && value[0] != '{' && static_cast<uint8_t>(value[0]) != Log::FORMAT_VERSION;
+}
+
+// Drops the locators of expired logs as the default column family gets
+// compacted; their records went away with the dropped partitions
+class ExpiredLocatorFilter : public rocksdb::CompactionFilter {
+public:
+    explicit ExpiredLocatorFilter(const std::atomic<int64_t>& cutoff) : cutoff(cutoff) {}
+
+    bool Filter(int, const rocksdb::Slice&, const rocksdb::Slice& value, std::string*, bool*) const override {
+        return is_locator(value) && decode_timestamp(value.data()) < cutoff.load(std::memory_order_relaxed);
+    }
+
+    const char* Name() const override { return "ExpiredLocatorFilter"; }
+
+private:
+    const std::atomic<int64_t>& cutoff;
+};
+
+// Appends field -> value text for each of the fields the log has a value
+// for that can be indexed
+void collect_field_values(const std::set<std::string>& fields, const Log& log,
+                          std::vector<std::pair<std::string, std::string>>& values) {
+    const nlohmann::json& metadata = log.metadata();
+    if (fields.empty() || !metadata.is_object()) {
+        return;
+    }
+    std::string text;
+    for (const auto& field : fields) {
+        auto value = metadata.find(field);
+        if (value != metadata.end() && metadata_value_text(*value, text)) {
+            values.emplace_back(field, text);
+        }
+    }
+}
+
+// Later duplicates of a key win, as when the map is parsed
+void set_field_value(std::vector<std::pair<std::string, std::string>>& values, const std::string& field,
+                     const std::string& text) {
+    for (auto& entry : values) {
+        if (entry.first == field) {
+            entry.second = text;
+            return;
+        }
+    }
+    values.emplace_back(field, text);
+}
+
+// Calls add(key) for each metadata index entry of one log for the given fields
+template<typename Add>
+void for_each_metadata_index_key(const std::set<std::string>& fields, const Log& log, Add add) {
+    if (fields.empty()) {
+        return;
+    }
+    const nlohmann::json& metadata = log.metadata();
+    if (!metadata.is_object()) {
+        return;
+    }
+    std::string suffix = encode_time_key(log.timestamp(), log.reference());
+    std::string text;
+    for (const auto& field : fields) {
+        auto value = metadata.find(field);
+        if (value != metadata.end() && metadata_value_text(*value, text)) {
+            add(encode_metadata_index_prefix(field, text) + suffix);
+        }
+    }
+}
+
+// Adds the metadata index entries of one log for the given fields
+void put_metadata_index_entries(rocksdb::WriteBatch& batch, rocksdb::ColumnFamilyHandle* partition,
+                                const std::set<std::string>& fields, const Log& log) {
+    for_each_metadata_index_key(fields, log, [&](const std::string& key) {
+        batch.Put(partition, key, rocksdb::Slice());
+    });
+}
+
+// Shard directories from the "shards" section: the listed paths, relative
+// ones being taken from the database path, or <db path>/shard-<i> for a count
+// alone. Empty for an unsharded database.
+std::vector<std::string> shard_paths_from_config(const ConfigReader& config, const std::string& db_path) {
+    std::vector<std::string> paths = config.getStringList("shards", "paths");
+    int count = config.getInt("shards", "count", 0);
+    if (count < 0) {
+        throw std::runtime_error("shards.count must not be negative");
+    }
+    if (paths.empty()) {
+        for (int i = 0; count > 1 && i < count; ++i) {
+            paths.push_back((boost::filesystem::path(db_path) / ("shard-" + std::to_string(i))).string());
+        }
+        return paths;
+    }
+    if (count != 0 && static_cast<size_t>(count) != paths.size()) {
+        throw std::runtime_error("shards.count is " + std::to_string(count) + " but shards.paths lists " +
+                                 std::to_string(paths.size()) + " directories");
+    }
+    if (paths.size() < 2) {
+        throw std::runtime_error("shards.paths needs at least two directories");
+    }
+    std::set<std::string> seen;
+    for (auto& path : paths) {
+        boost::filesystem::path full(path);
+        if (full.is_relative()) {
+            full = boost::filesystem::path(db_path) / full;
+        }
+        path = full.lexically_normal().string();
+        if (!seen.insert(path).second) {
+            throw std::runtime_error("Shard directory " + path + " is listed twice");
+        }
+    }
+    return paths;
+}
+
+void write_batch(rocksdb::DB* db, rocksdb::WriteBatch& batch, const std::string& what) {
+    rocksdb::Status status = db->Write(rocksdb::WriteOptions(), &batch);
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to write " + what + ": " + status.ToString());
+    }
+    batch.Clear();
+}
+
+}
+
+DBWrapper::DBWrapper(const std::string& db_path, const std::string& config_path)
+    : db(nullptr), db_path(db_path), retention_cutoff(INT64_MIN), stopping(false) {
     ConfigReader config(config_path);
 
-    rocksdb::Options options;
+    // Shared by the shards when sharded
+    block_cache = rocksdb::NewLRUCache(config.getInt64("block_cache_size", 256 * 1024 * 1024));
+    if (config.getString("statistics", "true") == "true") {
+        statistics = rocksdb::CreateDBStatistics();
+    }
+
+    query_parallelism = config.getInt("query", "parallelism", 0);
+    if (query_parallelism == 0) {
+        query_parallelism = std::max(1u, std::thread::hardware_concurrency());
+    }
+    own_scan_pool.reset(new ScanPool(query_parallelism));
+    scan_pool = own_scan_pool.get();
+
+    tail = std::make_shared<LogTail>(config.getInt("tail", "buffer_groups", 4096),
+                                     config.getInt("tail", "max_subscribers", 64));
+
+    std::vector<std::string> fields = config.getStringList("indexes", "fields");
+    indexed_fields.insert(fields.begin(), fields.end());
+    sketch_definitions = sketch_definitions_from_config(config);
+    for (const auto& definition : sketch_definitions) {
+        sketched_fields.insert(definition.field);
+        if (!definition.group_by.empty()) {
+            sketched_fields.insert(definition.group_by);
+        }
+    }
+
+    std::vector<std::string> shard_paths = shard_paths_from_config(config, db_path);
+    if (shard_paths.empty()) {
+        open(config, 0, 1);
+        return;
+    }
+
+    // Recovery, migrations and backfills run on every shard at once
+    ring.reset(new ShardRing(shard_paths.size()));
+    std::vector<std::future<std::unique_ptr<DBWrapper>>> opened;
+    for (size_t i = 0; i < shard_paths.size(); ++i) {
+        opened.push_back(std::async(std::launch::async, [this, &config, &shard_paths, i]() {
+            return std::unique_ptr<DBWrapper>(new DBWrapper(*this, shard_paths[i], config, i, shard_paths.size()));
+        }));
+    }
+    std::exception_ptr error;
+    for (auto& shard : opened) {
+        try {
+            shards.push_back(shard.get());
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        shards.clear();
+        std::rethrow_exception(error);
+    }
+    LOG_INFO("Opened " << shards.size() << " shards");
+}
+
+DBWrapper::DBWrapper(const DBWrapper& parent, const std::string& db_path, const ConfigReader& config, size_t shard,
+                     size_t shard_count)
+    : db(nullptr),
+      db_path(db_path),
+      block_cache(parent.block_cache),
+      statistics(parent.statistics),
+      indexed_fields(parent.indexed_fields),
+      sketch_definitions(parent.sketch_definitions),
+      sketched_fields(parent.sketched_fields),
+      query_parallelism(parent.query_parallelism),
+      scan_pool(parent.scan_pool),
+      tail(parent.tail),
+      retention_cutoff(INT64_MIN),
+      stopping(false) {
+    boost::filesystem::create_directories(db_path);
+    open(config, shard, shard_count);
+}
+
+void DBWrapper::open(const ConfigReader& config, size_t shard, size_t shard_count) {
     options.create_if_missing = true;
 
     // Read configuration
@@ -18,18 +275,10 @@ DBWrapper::DBWrapper(const std::string& db_path, const std::string& config_path)
     options.max_write_buffer_number = config.getInt("max_write_buffer_number", 3);
     options.min_write_buffer_number_to_merge = config.getInt("min_write_buffer_number_to_merge", 1);
 
-    std::string compression_str = config.getString("compression", "lz4");
-    if (compression_str == "lz4") {
-        options.compression = rocksdb::kLZ4Compression;
-    } else if (compression_str == "snappy") {
-        options.compression = rocksdb::kSnappyCompression;
-    } else {
-        options.compression = rocksdb::kNoCompression;
-    }
-    options.compression_opts.level = config.getInt("compression_level", 4);
+    apply_compression_config(config, options);
 
     rocksdb::BlockBasedTableOptions table_options;
-    table_options.block_cache = rocksdb::NewLRUCache(config.getInt64("block_cache_size", 256 * 1024 * 1024));
+    table_options.block_cache = block_cache;
     table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(config.getInt("bloom_filter_bits_per_key", 10), false));
     options.table_factory.reset(NewBlockBasedTableFactory(table_options));
 
@@ -38,112 +287,1380 @@ DBWrapper::DBWrapper(const std::string& db_path, const std::string& config_path)
     options.compaction_style = rocksdb::kCompactionStyleLevel;
     options.max_background_compactions = config.getInt("max_background_compactions", 4);
     options.max_background_flushes = config.getInt("max_background_flushes", 2);
+    options.create_missing_column_families = true;
+    options.statistics = statistics;
+
+    // The configured size is for the whole database
+    int64_t cache_bytes = config.getInt64("cache", "max_bytes", 64 * 1024 * 1024) / static_cast<int64_t>(shard_count);
+    if (cache_bytes > 0) {
+        reference_cache.reset(new ReferenceCache(cache_bytes, config.getInt("cache", "shards", 16),
+            std::chrono::milliseconds(config.getInt64("cache", "negative_ttl_ms", 1000))));
+    }
+
+    retention_days = config.getInt("retention", "days", 0);
+    retention_check_interval = std::chrono::seconds(config.getInt64("retention", "check_interval_seconds", 3600));
+
+    locator_filter.reset(new ExpiredLocatorFilter(retention_cutoff));
+    rocksdb::ColumnFamilyOptions default_cf_options(options);
+    default_cf_options.compaction_filter = locator_filter.get();
+    rocksdb::ColumnFamilyOptions sketch_cf_options(options);
+    sketch_cf_options.merge_operator = std::make_shared<SketchMergeOperator>();
 
-    rocksdb::Status status = rocksdb::DB::Open(options, db_path, &db);
+    // Every existing column family has to be opened; a new database has none
+    std::vector<std::string> existing;
+    rocksdb::DB::ListColumnFamilies(options, db_path, &existing);
+
+    std::vector<rocksdb::ColumnFamilyDescriptor> column_families = {
+        rocksdb::ColumnFamilyDescriptor(rocksdb::kDefaultColumnFamilyName, default_cf_options),
+        rocksdb::ColumnFamilyDescriptor(META_CF, options),
+        rocksdb::ColumnFamilyDescriptor(SKETCH_CF, sketch_cf_options)
+    };
+    for (const auto& name : existing) {
+        if (name == rocksdb::kDefaultColumnFamilyName || name == META_CF || name == SKETCH_CF) {
+            continue;
+        }
+        int64_t day;
+        if (!PartitionSet::parse_name(name, day) && name != LEGACY_TIME_INDEX_CF && name != LEGACY_METADATA_INDEX_CF) {
+            // Still has to be opened, or RocksDB refuses to open the database
+            LOG_WARN("Ignoring unknown column family " << name);
+        }
+        column_families.emplace_back(name, options);
+    }
+
+    std::vector<rocksdb::ColumnFamilyHandle*> handles;
+    rocksdb::Status status = rocksdb::DB::Open(options, db_path, column_families, &handles, &db);
     if (!status.ok()) {
-        throw std::runtime_error("Failed to open database: " + status.ToString());
+        throw std::runtime_error("Failed to open database " + db_path + ": " + status.ToString());
     }
-}
+    cf_handles = {handles[0], handles[1], handles[2]};
+    meta_cf = handles[1];
+    sketch_cf = handles[2];
 
-DBWrapper::~DBWrapper() {
-    delete db;
-}
+    partitions.reset(new PartitionSet(db, options));
+    std::vector<rocksdb::ColumnFamilyHandle*> legacy_handles;
+    for (size_t i = 3; i < handles.size(); ++i) {
+        const std::string& name = column_families[i].name;
+        int64_t day;
+        if (PartitionSet::parse_name(name, day)) {
+            partitions->adopt(day, handles[i]);
+        } else if (name == LEGACY_TIME_INDEX_CF || name == LEGACY_METADATA_INDEX_CF) {
+            legacy_handles.push_back(handles[i]);
+        } else {
+            cf_handles.push_back(handles[i]);
+        }
+    }
 
-bool DBWrapper::insert_log(const Log& log) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    rocksdb::WriteBatch batch;
-    std::string key = log.reference();
-    std::string value = log.serialize();
+    std::string partitioned;
+    status = db->Get(rocksdb::ReadOptions(), meta_cf, PARTITIONED_KEY, &partitioned);
+    if (!status.ok() && !status.IsNotFound()) {
+        throw std::runtime_error("Failed to read the storage layout: " + status.ToString());
+    }
+    bool has_logs = !partitions->all().empty() || !legacy_handles.empty();
+    if (!has_logs) {
+        std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(rocksdb::ReadOptions()));
+        it->SeekToFirst();
+        has_logs = it->Valid();
+    }
+    check_shard_layout(shard, shard_count, has_logs);
+    if (status.IsNotFound() && has_logs) {
+        migrate_unpartitioned_layout(legacy_handles);
+    } else if (status.IsNotFound()) {
+        status = db->Put(rocksdb::WriteOptions(), meta_cf, PARTITIONED_KEY, "1");
+        if (!status.ok()) {
+            throw std::runtime_error("Failed to write the storage layout: " + status.ToString());
+        }
+    }
+    sync_metadata_index_fields();
+    sync_sketch_definitions();
+    enforce_retention();
 
-    // First, check if the log already exists
-    std::string existing_value;
-    rocksdb::Status status = db->Get(rocksdb::ReadOptions(), key, &existing_value);
+    committer.reset(new GroupCommitter(
+        [this](std::vector<PendingWrite*>& group) { commit_group(group); },
+        std::chrono::microseconds(config.getInt64("group_commit_window_us", 0)),
+        config.getInt64("group_commit_max_logs", 4096),
+        config.getInt64("async_queue_max_logs", 100000)));
+
+    if (retention_days > 0) {
+        retention_thread = std::thread(&DBWrapper::retention_loop, this);
+    }
+}
 
+void DBWrapper::check_shard_layout(size_t shard, size_t shard_count, bool has_logs) {
+    std::string stored;
+    rocksdb::Status status = db->Get(rocksdb::ReadOptions(), meta_cf, SHARD_LAYOUT_KEY, &stored);
+    if (!status.ok() && !status.IsNotFound()) {
+        throw std::runtime_error("Failed to read shard layout: " + status.ToString());
+    }
+    // Databases from before sharding hold a whole unsharded database
+    size_t stored_shard = 0;
+    size_t stored_count = 1;
+    if (status.ok()) {
+        nlohmann::json layout = nlohmann::json::parse(stored);
+        stored_shard = layout.at("shard").get<size_t>();
+        stored_count = layout.at("shards").get<size_t>();
+    } else if (!has_logs) {
+        stored_shard = shard;
+        stored_count = shard_count;
+    }
+    if (stored_shard != shard || stored_count != shard_count) {
+        std::string held = stored_count == 1 ? "an unsharded database"
+                                             : "shard " + std::to_string(stored_shard) + " of " + std::to_string(stored_count);
+        std::string wanted = shard_count == 1 ? "an unsharded database"
+                                              : "shard " + std::to_string(shard) + " of " + std::to_string(shard_count);
+        throw std::runtime_error(db_path + " holds " + held + ", not " + wanted +
+                                 "; moving logs between shards is not supported");
+    }
     if (status.ok()) {
-        // Log with this reference already exists
-        return false;
-    } else if (!status.IsNotFound()) {
-        // An error occurred
-        throw std::runtime_error("Error checking for existing log: " + status.ToString());
+        return;
+    }
+    nlohmann::json layout = {{"shard", shard}, {"shards", shard_count}};
+    status = db->Put(rocksdb::WriteOptions(), meta_cf, SHARD_LAYOUT_KEY, layout.dump());
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to write shard layout: " + status.ToString());
     }
+}
 
-    // If we get here, the log doesn't exist, so we can insert it
-    batch.Put(key, value);
+DBWrapper::~DBWrapper() {
+    if (!shards.empty()) {
+        // Scans still running on the pool read from the shards
+        own_scan_pool.reset();
+        shards.clear();
+        return;
+    }
 
-    status = db->Write(rocksdb::WriteOptions(), &batch);
+    {
+        std::lock_guard<std::mutex> lock(retention_thread_mutex);
+        stopping = true;
+    }
+    retention_thread_cv.notify_all();
+    if (retention_thread.joinable()) {
+        retention_thread.join();
+    }
 
-    if (!status.ok()) {
-        throw std::runtime_error("Failed to insert log: " + status.ToString());
+    // Drain pending writes and scans before the column families go away
+    own_scan_pool.reset();
+    committer.reset();
+    partitions.reset();
+    for (auto* handle : cf_handles) {
+        db->DestroyColumnFamilyHandle(handle);
     }
+    delete db;
+}
 
-    return true;
+InsertStatus DBWrapper::insert_log(const Log& log, Durability durability) {
+    if (!shards.empty()) {
+        return shard_for(log.reference()).insert_log(log, durability);
+    }
+    PendingWrite write;
+    write.records.push_back(make_record(log));
+    write.durability = durability;
+    committer->submit(write);
+    return write.statuses[0];
 }
 
 Log DBWrapper::get_log(const std::string& reference) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    std::string value;
-    rocksdb::Status status = db->Get(rocksdb::ReadOptions(), reference, &value);
+    ReferenceCache::Record record;
+    if (find_log_record(reference, record) == LookupStatus::NotFound) {
+        throw std::runtime_error("Failed to get log: NotFound: " + reference);
+    }
+    return Log::deserialize(*record);
+}
+
+LookupStatus DBWrapper::find_log_record(const std::string& reference, ReferenceCache::Record& record) {
+    if (!shards.empty()) {
+        return shard_for(reference).find_log_record(reference, record);
+    }
+    int64_t timestamp = 0;
+    uint64_t version = 0;
+    if (reference_cache) {
+        switch (reference_cache->lookup(reference, record, timestamp, version)) {
+            case ReferenceCache::Result::Hit:
+                // Cached logs stay until evicted, so they may have expired since
+                return timestamp < retention_cutoff.load() ? LookupStatus::NotFound : LookupStatus::Found;
+            case ReferenceCache::Result::Missing:
+                return LookupStatus::NotFound;
+            case ReferenceCache::Result::Unknown:
+                break;
+        }
+    }
+
+    rocksdb::PinnableSlice value;
+    if (read_log_record(reference, value, timestamp) == LookupStatus::NotFound) {
+        if (reference_cache) {
+            reference_cache->insert_missing(reference, version);
+        }
+        return LookupStatus::NotFound;
+    }
+    record = std::make_shared<const std::string>(value.data(), value.size());
+    if (reference_cache) {
+        reference_cache->insert(reference, timestamp, record);
+    }
+    return LookupStatus::Found;
+}
+
+LookupStatus DBWrapper::read_log_record(const std::string& reference, rocksdb::PinnableSlice& record,
+                                        int64_t& timestamp) {
+    rocksdb::PinnableSlice locator;
+    rocksdb::Status status = db->Get(rocksdb::ReadOptions(), db->DefaultColumnFamily(), reference, &locator);
+    if (status.IsNotFound()) {
+        return LookupStatus::NotFound;
+    }
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to get log: " + status.ToString());
+    }
+    if (!decode_locator(locator, timestamp)) {
+        throw std::runtime_error("Invalid locator for log " + reference);
+    }
+    if (timestamp < retention_cutoff.load()) {
+        return LookupStatus::NotFound;
+    }
+
+    PartitionSet::Handle partition = partitions->get(PartitionSet::day_of(timestamp));
+    if (!partition) {
+        throw std::runtime_error("Failed to get log: partition " + PartitionSet::name_of(PartitionSet::day_of(timestamp)) + " is missing");
+    }
+    status = db->Get(rocksdb::ReadOptions(), partition.get(), encode_record_key(timestamp, reference), &record);
     if (!status.ok()) {
         throw std::runtime_error("Failed to get log: " + status.ToString());
     }
-    return Log::deserialize(value);
+    return LookupStatus::Found;
 }
 
 std::vector<Log> DBWrapper::get_logs_by_time_range(int64_t start_timestamp, int64_t end_timestamp) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    LogQuery query;
+    query.start_timestamp = start_timestamp;
+    query.end_timestamp = end_timestamp;
     std::vector<Log> result;
-    rocksdb::Iterator* it = db->NewIterator(rocksdb::ReadOptions());
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        Log log = Log::deserialize(it->value().ToString());
-        if (log.timestamp() >= start_timestamp && log.timestamp() <= end_timestamp) {
-            result.push_back(log);
+    std::unique_ptr<LogScanner> scanner = scan_query_parallel(query);
+    while (scanner->next(result, MULTIGET_BATCH_SIZE)) {
+    }
+    return result;
+}
+
+std::unique_ptr<LogScanner> DBWrapper::scan_time_range(int64_t start_timestamp, int64_t end_timestamp, const std::string& after_key) {
+    LogQuery query;
+    query.start_timestamp = start_timestamp;
+    query.end_timestamp = end_timestamp;
+    return scan_query(query, after_key);
+}
+
+std::unique_ptr<LogScanner> DBWrapper::scan_query(const LogQuery& query, const std::string& after_key) {
+    if (!shards.empty()) {
+        std::vector<std::unique_ptr<LogScanner>> scanners;
+        for (auto& shard : shards) {
+            scanners.push_back(shard->scan_query(query, after_key));
+        }
+        return make_merging_scanner(std::move(scanners), true);
+    }
+    LogQuery bounded = query;
+    bounded.start_timestamp = std::max(query.start_timestamp, retention_cutoff.load());
+    return make_query_scanner(db, partitions->overlapping(bounded.start_timestamp, bounded.end_timestamp),
+                              indexed_fields, bounded, after_key);
+}
+
+std::unique_ptr<LogScanner> DBWrapper::scan_query_parallel(const LogQuery& query, const std::string& after_key,
+                                                          bool ordered) {
+    if (!shards.empty()) {
+        // The shards' ranges all fill on the scan pool at once
+        std::vector<std::unique_ptr<LogScanner>> scanners;
+        for (auto& shard : shards) {
+            scanners.push_back(shard->scan_query_parallel(query, after_key, ordered));
+        }
+        return make_merging_scanner(std::move(scanners), ordered);
+    }
+    LogQuery bounded = query;
+    bounded.start_timestamp = std::max(query.start_timestamp, retention_cutoff.load());
+    // Ranges wholly before the position have nothing left to return
+    int64_t start_timestamp = bounded.start_timestamp;
+    if (after_key.size() >= 8) {
+        start_timestamp = std::max(start_timestamp, time_key_timestamp(after_key));
+    }
+    std::vector<ScanRange> ranges = split_scan_ranges(
+        db, partitions->overlapping(start_timestamp, bounded.end_timestamp),
+        start_timestamp, bounded.end_timestamp, query_parallelism * SCAN_RANGES_PER_THREAD);
+    return make_parallel_scanner(db, *scan_pool, std::move(ranges), indexed_fields, bounded, after_key, ordered);
+}
+
+std::unique_ptr<LogScanner> DBWrapper::scan_all(const std::string& after_key) {
+    return scan_query(LogQuery(), after_key);
+}
+
+void DBWrapper::aggregate_ranges(const AggregateQuery& query, size_t threads, std::vector<AggregateRange>& ranges) {
+    int64_t start_timestamp = std::max(query.query.start_timestamp, retention_cutoff.load());
+    int64_t end_timestamp = query.query.end_timestamp;
+    std::vector<PartitionSet::Partition> overlapping = partitions->overlapping(start_timestamp, end_timestamp);
+
+    // All ranges read from the same snapshot
+    SharedSnapshot snapshot = make_shared_snapshot(db);
+    size_t pieces_per_partition = overlapping.empty() ? 1 : (threads + overlapping.size() - 1) / overlapping.size();
+    for (const auto& partition : overlapping) {
+        int64_t low = std::max(start_timestamp, partition.first * PartitionSet::DAY_MS);
+        int64_t high = std::min(end_timestamp, partition.first * PartitionSet::DAY_MS + PartitionSet::DAY_MS - 1);
+        int64_t span = high - low + 1;
+        int64_t pieces = std::max<int64_t>(1, std::min<int64_t>(pieces_per_partition, span / MIN_AGGREGATE_SPLIT_MS));
+        for (int64_t i = 0; i < pieces; ++i) {
+            int64_t piece_low = low + i * (span / pieces);
+            int64_t piece_high = i + 1 == pieces ? high : piece_low + span / pieces - 1;
+            ranges.push_back({db, snapshot, &indexed_fields, partition.second, piece_low, piece_high});
+        }
+    }
+}
+
+AggregateResult DBWrapper::aggregate(const AggregateQuery& query) {
+    // One range per partition, split further while there are fewer ranges
+    // than threads; the ranges of all shards share the threads
+    std::vector<AggregateRange> ranges;
+    if (shards.empty()) {
+        aggregate_ranges(query, query_parallelism, ranges);
+    }
+    for (auto& shard : shards) {
+        shard->aggregate_ranges(query, (query_parallelism + shards.size() - 1) / shards.size(), ranges);
+    }
+
+    auto next_range = std::make_shared<std::atomic<size_t>>(0);
+    auto worker = [ranges, next_range, query]() {
+        AggregateResult partial;
+        for (size_t i = (*next_range)++; i < ranges.size(); i = (*next_range)++) {
+            const AggregateRange& range = ranges[i];
+            partial.merge(aggregate_range(range.db, range.snapshot.get(), range.partition.get(), *range.indexed_fields,
+                                          query, range.start_timestamp, range.end_timestamp));
         }
+        return partial;
+    };
+
+    // Helpers run on the scan pool; the calling thread works along with them
+    std::vector<std::future<AggregateResult>> helpers;
+    for (size_t i = 1; i < std::min(query_parallelism, ranges.size()); ++i) {
+        auto promise = std::make_shared<std::promise<AggregateResult>>();
+        helpers.push_back(promise->get_future());
+        scan_pool->submit([worker, promise]() {
+            try {
+                promise->set_value(worker());
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+    }
+    AggregateResult result = worker();
+    for (auto& helper : helpers) {
+        result.merge(helper.get());
     }
-    delete it;
     return result;
 }
 
-bool DBWrapper::batch_insert_logs(const std::vector<Log>& logs) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    std::cout << "Starting batch insert of " << logs.size() << " logs" << std::endl;  // Debug log
-    rocksdb::WriteBatch batch;
+std::vector<InsertStatus> DBWrapper::batch_insert_logs(const std::vector<Log>& logs, Durability durability) {
+    LOG_DEBUG("Starting batch insert of " << logs.size() << " logs");
+    if (!shards.empty()) {
+        // Every shard commits its part at once
+        std::vector<PendingWrite> parts(shards.size());
+        std::vector<std::vector<size_t>> positions(shards.size());
+        for (size_t i = 0; i < logs.size(); ++i) {
+            size_t shard = ring->shard_of(logs[i].reference());
+            parts[shard].records.push_back(make_record(logs[i]));
+            positions[shard].push_back(i);
+        }
+        std::vector<std::future<void>> committed;
+        for (size_t shard = 0; shard < shards.size(); ++shard) {
+            if (!parts[shard].records.empty()) {
+                parts[shard].durability = durability;
+                committed.push_back(shards[shard]->committer->submit_async(parts[shard]));
+            }
+        }
+        // The parts must outlive their commits, failed or not
+        std::exception_ptr error;
+        for (auto& commit : committed) {
+            try {
+                commit.get();
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        std::vector<InsertStatus> statuses(logs.size(), InsertStatus::Duplicate);
+        for (size_t shard = 0; shard < shards.size(); ++shard) {
+            for (size_t i = 0; i < positions[shard].size(); ++i) {
+                statuses[positions[shard][i]] = parts[shard].statuses[i];
+            }
+        }
+        return statuses;
+    }
+    PendingWrite write;
+    write.records.reserve(logs.size());
+    for (const auto& log : logs) {
+        write.records.push_back(make_record(log));
+    }
+    write.durability = durability;
+    committer->submit(write);
+    return write.statuses;
+}
+
+void DBWrapper::batch_insert_logs_async(const std::vector<Log>& logs, Durability durability, InsertCallback done) {
+    std::unique_ptr<PendingWrite> write(new PendingWrite());
+    write->records.reserve(logs.size());
     for (const auto& log : logs) {
-        std::string serialized = log.serialize();
-        batch.Put(log.reference(), serialized);
+        write->records.push_back(make_record(log));
+    }
+    write->durability = durability;
+    write->on_commit = [done = std::move(done)](PendingWrite& write, const std::exception_ptr& error) {
+        done(std::move(write.statuses), error);
+    };
+    std::vector<std::unique_ptr<PendingWrite>> writes;
+    writes.push_back(std::move(write));
+    insert_records_async(std::move(writes));
+}
+
+bool DBWrapper::enqueue_logs(std::vector<Log> logs, Durability durability) {
+    std::unique_ptr<PendingWrite> write(new PendingWrite());
+    write->records.reserve(logs.size());
+    for (const auto& log : logs) {
+        write->records.push_back(make_record(log));
+    }
+    write->durability = durability;
+    if (shards.empty()) {
+        return committer->submit_detached(std::move(write));
+    }
+    std::vector<std::vector<std::unique_ptr<PendingWrite>>> parts(shards.size());
+    split_write(std::move(write), parts);
+    // Either every shard takes its part or none is queued, so a refused
+    // call has written nothing
+    std::vector<size_t> part_logs(shards.size(), 0);
+    for (size_t shard = 0; shard < shards.size(); ++shard) {
+        for (const auto& part : parts[shard]) {
+            part_logs[shard] += part->records.size();
+        }
+        if (part_logs[shard] > 0 && !shards[shard]->committer->reserve_detached(part_logs[shard])) {
+            for (size_t reserved = 0; reserved < shard; ++reserved) {
+                if (part_logs[reserved] > 0) {
+                    shards[reserved]->committer->cancel_reservation(part_logs[reserved]);
+                }
+            }
+            return false;
+        }
+    }
+    for (size_t shard = 0; shard < shards.size(); ++shard) {
+        for (auto& part : parts[shard]) {
+            shards[shard]->committer->submit_reserved(std::move(part));
+        }
     }
+    return true;
+}
 
+void DBWrapper::insert_records_async(std::vector<std::unique_ptr<PendingWrite>> writes) {
+    if (shards.empty()) {
+        committer->submit_detached(std::move(writes));
+        return;
+    }
+    std::vector<std::vector<std::unique_ptr<PendingWrite>>> parts(shards.size());
+    for (auto& write : writes) {
+        split_write(std::move(write), parts);
+    }
+    for (size_t shard = 0; shard < shards.size(); ++shard) {
+        if (!parts[shard].empty()) {
+            shards[shard]->committer->submit_detached(std::move(parts[shard]));
+        }
+    }
+}
+
+void DBWrapper::split_write(std::unique_ptr<PendingWrite> write,
+                            std::vector<std::vector<std::unique_ptr<PendingWrite>>>& parts) {
+    std::vector<size_t> shard_of(write->records.size());
+    bool one_shard = true;
+    for (size_t i = 0; i < write->records.size(); ++i) {
+        shard_of[i] = ring->shard_of(write->records[i].reference);
+        one_shard = one_shard && shard_of[i] == shard_of[0];
+    }
+    // The common case for small writes
+    if (one_shard) {
+        parts[shard_of.empty() ? 0 : shard_of[0]].push_back(std::move(write));
+        return;
+    }
+
+    // Positions of the records of each part in the write
+    std::vector<std::unique_ptr<PendingWrite>> split(shards.size());
+    std::vector<std::vector<size_t>> positions(shards.size());
+    for (size_t i = 0; i < write->records.size(); ++i) {
+        std::unique_ptr<PendingWrite>& part = split[shard_of[i]];
+        if (!part) {
+            part.reset(new PendingWrite());
+            part->durability = write->durability;
+        }
+        part->records.push_back(std::move(write->records[i]));
+        positions[shard_of[i]].push_back(i);
+    }
+
+    if (write->on_commit) {
+        // Parts commit on the writer threads of their shards; the last one
+        // to finish reports for the whole write
+        struct Joined {
+            std::unique_ptr<PendingWrite> write;
+            std::mutex mutex;
+            size_t remaining = 0;
+            std::exception_ptr error;
+        };
+        auto joined = std::make_shared<Joined>();
+        write->statuses.assign(write->records.size(), InsertStatus::Duplicate);
+        joined->write = std::move(write);
+        for (size_t shard = 0; shard < split.size(); ++shard) {
+            if (!split[shard]) {
+                continue;
+            }
+            ++joined->remaining;
+            split[shard]->on_commit = [joined, positions = std::move(positions[shard])](
+                    PendingWrite& part, const std::exception_ptr& error) {
+                std::unique_lock<std::mutex> lock(joined->mutex);
+                if (error && !joined->error) {
+                    joined->error = error;
+                }
+                if (!error) {
+                    for (size_t i = 0; i < positions.size(); ++i) {
+                        joined->write->statuses[positions[i]] = part.statuses[i];
+                    }
+                }
+                if (--joined->remaining > 0) {
+                    return;
+                }
+                lock.unlock();
+                joined->write->on_commit(*joined->write, joined->error);
+            };
+        }
+    }
+    for (size_t shard = 0; shard < split.size(); ++shard) {
+        if (split[shard]) {
+            parts[shard].push_back(std::move(split[shard]));
+        }
+    }
+}
+
+LogRecord DBWrapper::make_record(const Log& log) const {
+    if (!PartitionSet::in_range(log.timestamp())) {
+        throw std::runtime_error("Timestamp " + std::to_string(log.timestamp()) + " is outside the years 0000-9999");
+    }
+    LogRecord record;
+    record.reference = log.reference();
+    record.timestamp = log.timestamp();
+    record.data = log.serialize();
+    collect_field_values(indexed_fields, log, record.index_values);
+    collect_field_values(sketched_fields, log, record.sketch_values);
+    return record;
+}
+
+LogRecord DBWrapper::make_record(std::string reference, int64_t timestamp, std::string_view msgpack_metadata) const {
+    const char* p = msgpack_metadata.data();
+    const char* limit = p + msgpack_metadata.size();
+    bool sorted_keys = skip_msgpack_value(p, limit);
+    if (p != limit) {
+        throw std::runtime_error("Trailing bytes after MessagePack metadata");
+    }
+    // Stored metadata always has its keys the way nlohmann::json writes
+    // them, so reads come out the same whichever path the log came in by
+    std::string normalized;
+    if (!sorted_keys) {
+        nlohmann::json::to_msgpack(nlohmann::json::from_msgpack(msgpack_metadata.begin(), msgpack_metadata.end()),
+                                   normalized);
+        msgpack_metadata = normalized;
+    }
+
+    if (timestamp != 0 && !PartitionSet::in_range(timestamp)) {
+        throw std::runtime_error("Timestamp " + std::to_string(timestamp) + " is outside the years 0000-9999");
+    }
+    LogRecord record;
+    record.timestamp = timestamp != 0 ? timestamp : now_ms();
+    record.data = Log::encode_record(record.timestamp, reference, msgpack_metadata);
+    record.reference = std::move(reference);
+    if (!indexed_fields.empty() || !sketched_fields.empty()) {
+        for_each_msgpack_field_text(msgpack_metadata, [&](std::string_view key, const std::string& text) {
+            std::string field(key);
+            if (indexed_fields.count(field)) {
+                set_field_value(record.index_values, field, text);
+            }
+            if (sketched_fields.count(field)) {
+                set_field_value(record.sketch_values, field, text);
+            }
+        });
+    }
+    return record;
+}
+
+std::unique_ptr<LogTail::Reader> DBWrapper::subscribe() {
+    return tail->subscribe();
+}
+
+size_t DBWrapper::tail_subscribers() const {
+    return tail->reader_count();
+}
+
+DBWrapper::ReferenceCacheStats DBWrapper::reference_cache_stats() const {
+    ReferenceCacheStats stats;
+    for (const auto& shard : shards) {
+        ReferenceCacheStats shard_stats = shard->reference_cache_stats();
+        stats.hits += shard_stats.hits;
+        stats.missing_hits += shard_stats.missing_hits;
+        stats.misses += shard_stats.misses;
+        stats.bytes += shard_stats.bytes;
+    }
+    if (reference_cache) {
+        stats.hits = reference_cache->hits();
+        stats.missing_hits = reference_cache->missing_hits();
+        stats.misses = reference_cache->misses();
+        stats.bytes = reference_cache->bytes();
+    }
+    return stats;
+}
+
+size_t DBWrapper::ingest_queue_logs() const {
+    if (shards.empty()) {
+        return committer->detached_queued_logs();
+    }
+    size_t logs = 0;
+    for (const auto& shard : shards) {
+        logs += shard->ingest_queue_logs();
+    }
+    return logs;
+}
+
+uint64_t DBWrapper::ingest_failed_logs() const {
+    if (shards.empty()) {
+        return committer->detached_failed_logs();
+    }
+    uint64_t logs = 0;
+    for (const auto& shard : shards) {
+        logs += shard->ingest_failed_logs();
+    }
+    return logs;
+}
+
+void DBWrapper::commit_group(std::vector<PendingWrite*>& group) {
+    std::shared_lock<std::shared_mutex> retention_lock(retention_mutex);
+    std::lock_guard<std::mutex> commit_lock(commit_mutex);
+    const int64_t cutoff = retention_cutoff.load();
+
+    // Existence checks for the whole group in one MultiGet. Absent
+    // references are usually rejected by the bloom filter without any I/O.
+    std::vector<rocksdb::Slice> keys;
+    for (auto* write : group) {
+        for (const auto& record : write->records) {
+            keys.emplace_back(record.reference);
+        }
+    }
+    std::vector<rocksdb::ColumnFamilyHandle*> handles(keys.size(), db->DefaultColumnFamily());
+    std::vector<std::string> values;
+    std::vector<rocksdb::Status> statuses = db->MultiGet(rocksdb::ReadOptions(), handles, keys, &values);
+
+    // References written earlier in this group, including earlier entries of
+    // the same batch, count as existing
+    std::unordered_set<std::string_view> written;
+    rocksdb::WriteBatch batch;
+    SketchUpdates sketch_updates(sketch_definitions);
+    size_t key_index = 0;
+    for (auto* write : group) {
+        write->statuses.assign(write->records.size(), InsertStatus::Duplicate);
+        for (size_t i = 0; i < write->records.size(); ++i, ++key_index) {
+            const rocksdb::Status& status = statuses[key_index];
+            if (!status.ok() && !status.IsNotFound()) {
+                throw std::runtime_error("Error checking for existing log: " + status.ToString());
+            }
+            // A locator left behind by an expired log does not count
+            int64_t existing_timestamp;
+            bool exists = status.ok() &&
+                !(decode_locator(values[key_index], existing_timestamp) && existing_timestamp < cutoff);
+            const LogRecord& record = write->records[i];
+            const std::string& reference = record.reference;
+            if (exists || written.count(reference)) {
+                continue;
+            }
+            // Logs already past retention have no partition to go to
+            if (record.timestamp < cutoff) {
+                write->statuses[i] = InsertStatus::Expired;
+                continue;
+            }
+            PartitionSet::Handle partition = partitions->get_or_create(PartitionSet::day_of(record.timestamp));
+            std::string time_key = encode_time_key(record.timestamp, reference);
+            batch.Put(reference, encode_locator(record.timestamp));
+            batch.Put(partition.get(), RECORD_KEY_TAG + time_key, record.data);
+            for (const auto& value : record.index_values) {
+                batch.Put(partition.get(), encode_metadata_index_prefix(value.first, value.second) + time_key,
+                          rocksdb::Slice());
+            }
+            if (!record.sketch_values.empty()) {
+                sketch_updates.add(record.timestamp, record.sketch_values);
+            }
+            written.insert(reference);
+            write->statuses[i] = InsertStatus::Inserted;
+        }
+    }
+
+    if (batch.Count() == 0) {
+        return;
+    }
+    // One merge operand per sketch bucket touched by the whole group
+    sketch_updates.write(batch, sketch_cf);
+
+    // The group gets the strongest durability any of its writes asked for
+    Durability durability = Durability::Memory;
+    for (auto* write : group) {
+        durability = std::max(durability, write->durability);
+    }
     rocksdb::WriteOptions write_options;
+    write_options.disableWAL = durability == Durability::Memory;
+    write_options.sync = durability == Durability::Sync;
     rocksdb::Status status = db->Write(write_options, &batch);
-
-    if (status.ok()) {
-        std::cout << "Batch insert successful" << std::endl;  // Debug log
-    } else {
-        std::cerr << "Batch insert failed: " << status.ToString() << std::endl;  // Debug log
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to insert logs: " + status.ToString());
     }
 
-    return status.ok();
+    // Fresh references are the likeliest to be looked up next; caching them
+    // also replaces any entry remembering them as missing. Live tails get
+    // the same records.
+    bool tailing = tail->has_readers();
+    if (!reference_cache && !tailing) {
+        return;
+    }
+    std::vector<LogTail::Entry> tail_entries;
+    for (auto* write : group) {
+        for (size_t i = 0; i < write->records.size(); ++i) {
+            if (write->statuses[i] != InsertStatus::Inserted) {
+                continue;
+            }
+            LogRecord& record = write->records[i];
+            auto data = std::make_shared<const std::string>(std::move(record.data));
+            if (reference_cache) {
+                reference_cache->insert(record.reference, record.timestamp, data);
+            }
+            if (tailing) {
+                tail_entries.push_back({record.timestamp, record.reference, std::move(data)});
+            }
+        }
+    }
+    if (tailing) {
+        tail->publish(std::move(tail_entries));
+    }
 }
 
 std::vector<Log> DBWrapper::get_all_logs() {
     std::vector<Log> logs;
-    std::lock_guard<std::mutex> lock(db_mutex);
-    
-    rocksdb::ReadOptions read_options;
-    std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(read_options));
+    std::unique_ptr<LogScanner> scanner = scan_query_parallel(LogQuery());
+    while (scanner->next(logs, MULTIGET_BATCH_SIZE)) {
+    }
+    return logs;
+}
+
+size_t DBWrapper::convert_legacy_records() {
+    if (!shards.empty()) {
+        size_t converted = 0;
+        for (auto& shard : shards) {
+            converted += shard->convert_legacy_records();
+        }
+        return converted;
+    }
+    LOG_INFO("Converting legacy JSON records...");
+
+    const std::string record_prefix(1, RECORD_KEY_TAG);
+    const std::string record_limit = prefix_successor(record_prefix);
+    size_t converted = 0;
+    for (const auto& partition : partitions->all()) {
+        std::string resume_key = record_prefix;
+        bool done = false;
+        while (!done) {
+            rocksdb::WriteBatch batch;
+            rocksdb::Slice upper_bound(record_limit);
+            rocksdb::ReadOptions read_options;
+            read_options.iterate_upper_bound = &upper_bound;
+            std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(read_options, partition.second.get()));
+
+            size_t scanned = 0;
+            for (it->Seek(resume_key); it->Valid() && scanned < CONVERT_BATCH_SIZE; it->Next(), ++scanned) {
+                if (!Log::is_legacy_format(to_string_view(it->value()))) {
+                    continue;
+                }
+                try {
+                    batch.Put(partition.second.get(), it->key(), Log::deserialize(to_string_view(it->value())).serialize());
+                } catch (const std::exception& e) {
+                    LOG_ERROR("Error converting log " << it->key().ToString() << ": " << e.what());
+                }
+            }
+
+            if (!it->status().ok()) {
+                throw std::runtime_error("Error iterating over logs: " + it->status().ToString());
+            }
+            done = !it->Valid();
+            if (!done) {
+                resume_key = it->key().ToString();
+            }
+            it.reset();
+
+            converted += batch.Count();
+            write_batch(db, batch, "converted logs");
+        }
+    }
+
+    LOG_INFO("Converted " << converted << " legacy records");
+    return converted;
+}
+
+DBWrapper::BulkLoadResult DBWrapper::bulk_load(const std::string& input_path, size_t threads) {
+    std::ifstream input(input_path);
+    if (!input) {
+        throw std::runtime_error("Cannot read " + input_path);
+    }
+    if (threads == 0) {
+        threads = query_parallelism;
+    }
+    // Loads share the staging directory, so they run one at a time
+    std::lock_guard<std::mutex> lock(bulk_load_mutex);
+    LOG_INFO("Bulk loading " << input_path << " with " << threads << " threads...");
+
+    // SST files are written next to the database, so ingestion can move them
+    // in instead of copying; with shards, next to each shard's
+    std::vector<DBWrapper*> targets;
+    if (shards.empty()) {
+        targets.push_back(this);
+    }
+    for (auto& shard : shards) {
+        targets.push_back(shard.get());
+    }
+    std::vector<std::string> dirs;
+    for (auto* target : targets) {
+        dirs.push_back((boost::filesystem::path(target->db_path) / "bulk_load").string());
+    }
+    BulkLoadResult result;
+    auto load = [&](size_t target, const std::vector<Log>& logs) {
+        targets[target]->bulk_load_chunk(logs, dirs[target], threads, result);
+    };
+    try {
+        std::string line;
+        std::vector<Log> chunk;
+        bool more = true;
+        while (more) {
+            chunk.clear();
+            while (chunk.size() < BULK_LOAD_CHUNK_LOGS && (more = static_cast<bool>(std::getline(input, line)))) {
+                if (line.empty()) {
+                    continue;
+                }
+                ++result.read;
+                try {
+                    nlohmann::json j = nlohmann::json::parse(line);
+                    int64_t timestamp = j.at("timestamp").get<int64_t>();
+                    if (!PartitionSet::in_range(timestamp)) {
+                        throw std::runtime_error("Timestamp " + std::to_string(timestamp) +
+                                                 " is outside the years 0000-9999");
+                    }
+                    chunk.emplace_back(j.at("reference").get<std::string>(), j.at("metadata"), timestamp);
+                } catch (const std::exception& e) {
+                    ++result.invalid;
+                    LOG_WARN("Skipping line " << result.read << ": " << e.what());
+                }
+            }
+            if (input.bad()) {
+                throw std::runtime_error("Failed reading " + input_path);
+            }
+            if (chunk.empty()) {
+                continue;
+            }
+            if (shards.empty()) {
+                load(0, chunk);
+            } else {
+                // The order of the logs is kept within each shard, so the
+                // first occurrence of a reference still wins
+                std::vector<std::vector<Log>> parts(shards.size());
+                for (auto& log : chunk) {
+                    size_t shard = ring->shard_of(log.reference());
+                    parts[shard].push_back(std::move(log));
+                }
+                for (size_t shard = 0; shard < parts.size(); ++shard) {
+                    if (!parts[shard].empty()) {
+                        load(shard, parts[shard]);
+                    }
+                }
+            }
+            LOG_INFO("Bulk loaded " << result.loaded << " of " << result.read << " logs");
+        }
+    } catch (...) {
+        boost::system::error_code ignored;
+        for (const auto& dir : dirs) {
+            boost::filesystem::remove_all(dir, ignored);
+        }
+        throw;
+    }
+    for (const auto& dir : dirs) {
+        boost::filesystem::remove_all(dir);
+    }
+    return result;
+}
+
+void DBWrapper::bulk_load_chunk(const std::vector<Log>& logs, const std::string& dir, size_t threads,
+                                BulkLoadResult& result) {
+    // Partitions must not be dropped while files are ingested into them
+    std::shared_lock<std::shared_mutex> retention_lock(retention_mutex);
+    const int64_t cutoff = retention_cutoff.load();
+
+    // The first occurrence of a reference in the chunk wins
+    std::unordered_set<std::string_view> seen;
+    std::vector<const Log*> candidates;
+    for (const auto& log : logs) {
+        if (log.timestamp() < cutoff) {
+            ++result.expired;
+        } else if (!seen.insert(log.reference()).second) {
+            ++result.duplicates;
+        } else {
+            candidates.push_back(&log);
+        }
+    }
+
+    // Splits logs into those whose reference is not stored yet and counts
+    // the rest as duplicates, checking a MultiGet batch at a time
+    auto unstored = [&](const std::vector<const Log*>& logs) {
+        std::vector<const Log*> fresh;
+        for (size_t begin = 0; begin < logs.size(); begin += MULTIGET_BATCH_SIZE) {
+            size_t n = std::min(MULTIGET_BATCH_SIZE, logs.size() - begin);
+            std::vector<rocksdb::Slice> keys;
+            for (size_t i = 0; i < n; ++i) {
+                keys.emplace_back(logs[begin + i]->reference());
+            }
+            std::vector<rocksdb::PinnableSlice> values(n);
+            std::vector<rocksdb::Status> statuses(n);
+            db->MultiGet(rocksdb::ReadOptions(), db->DefaultColumnFamily(), n, keys.data(), values.data(),
+                         statuses.data());
+            for (size_t i = 0; i < n; ++i) {
+                if (!statuses[i].ok() && !statuses[i].IsNotFound()) {
+                    throw std::runtime_error("Error checking for existing log: " + statuses[i].ToString());
+                }
+                int64_t existing_timestamp;
+                bool exists = statuses[i].ok() &&
+                    !(decode_locator(values[i], existing_timestamp) && existing_timestamp < cutoff);
+                if (exists) {
+                    ++result.duplicates;
+                } else {
+                    fresh.push_back(logs[begin + i]);
+                }
+            }
+        }
+        return fresh;
+    };
 
+    // One set for the locators, and one per partition holding both the
+    // records and their metadata index entries
+    std::vector<PartitionSet::Handle> held;
+    auto write_files = [&](const std::vector<const Log*>& fresh) {
+        boost::filesystem::remove_all(dir);
+        boost::filesystem::create_directories(dir);
+        std::vector<SstFileSet> sets(1);
+        sets[0].cf = db->DefaultColumnFamily();
+        std::map<int64_t, size_t> set_of_day;
+        for (const Log* log : fresh) {
+            int64_t day = PartitionSet::day_of(log->timestamp());
+            auto it = set_of_day.find(day);
+            if (it == set_of_day.end()) {
+                held.push_back(partitions->get_or_create(day));
+                sets.push_back(SstFileSet{held.back().get(), {}, {}});
+                it = set_of_day.emplace(day, sets.size() - 1).first;
+            }
+            sets[0].entries.emplace_back(log->reference(), encode_locator(log->timestamp()));
+            auto& entries = sets[it->second].entries;
+            entries.emplace_back(encode_record_key(log->timestamp(), log->reference()), log->serialize());
+            for_each_metadata_index_key(indexed_fields, *log, [&](const std::string& key) {
+                entries.emplace_back(key, std::string());
+            });
+        }
+        write_sst_files(options, sets, dir, threads);
+        return sets;
+    };
+
+    std::vector<const Log*> fresh = unstored(candidates);
+    if (fresh.empty()) {
+        return;
+    }
+    std::vector<SstFileSet> sets = write_files(fresh);
+
+    // Inserts may have stored some of these references while the files were
+    // written. Checking again and ingesting with the committer held keeps
+    // any more from slipping in; the files are only rewritten when one did.
+    std::lock_guard<std::mutex> commit_lock(commit_mutex);
+    size_t checked = fresh.size();
+    fresh = unstored(fresh);
+    if (fresh.empty()) {
+        return;
+    }
+    if (fresh.size() != checked) {
+        sets = write_files(fresh);
+    }
+
+    // Locators go in last, so no reference ever points at a missing record
+    rocksdb::IngestExternalFileOptions ingest_options;
+    ingest_options.move_files = true;
+    auto ingest = [&](const SstFileSet& set) {
+        rocksdb::Status status = db->IngestExternalFile(set.cf, set.files, ingest_options);
+        if (!status.ok()) {
+            throw std::runtime_error("Failed to ingest bulk loaded files: " + status.ToString());
+        }
+    };
+    for (size_t i = 1; i < sets.size(); ++i) {
+        ingest(sets[i]);
+    }
+    ingest(sets[0]);
+    result.loaded += fresh.size();
+
+    if (!sketch_definitions.empty()) {
+        SketchUpdates sketch_updates(sketch_definitions);
+        std::vector<std::pair<std::string, std::string>> values;
+        for (const Log* log : fresh) {
+            values.clear();
+            collect_field_values(sketched_fields, *log, values);
+            sketch_updates.add(log->timestamp(), values);
+        }
+        rocksdb::WriteBatch batch;
+        sketch_updates.write(batch, sketch_cf);
+        write_batch(db, batch, "sketches");
+    }
+    // The cache may remember some of these references as missing
+    if (reference_cache) {
+        reference_cache->clear();
+    }
+}
+
+size_t DBWrapper::migrate_unpartitioned_layout(const std::vector<rocksdb::ColumnFamilyHandle*>& legacy_handles) {
+    LOG_INFO("Migrating logs into time partitions...");
+
+    // Every step is idempotent and the legacy column families are dropped
+    // last, so an interrupted migration simply runs again on the next open
+    const int64_t cutoff = retention_cutoff_for(now_ms());
+    size_t migrated = 0;
+    rocksdb::WriteBatch batch;
+    std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(rocksdb::ReadOptions()));
     for (it->SeekToFirst(); it->Valid(); it->Next()) {
-        std::string value = it->value().ToString();
+        if (is_locator(it->value())) {
+            continue;
+        }
         try {
-            Log log = Log::deserialize(value);
-            logs.push_back(log);
+            Log log = Log::deserialize(to_string_view(it->value()));
+            if (log.timestamp() < cutoff) {
+                batch.Delete(it->key());
+            } else {
+                PartitionSet::Handle partition = partitions->get_or_create(PartitionSet::day_of(log.timestamp()));
+                batch.Put(partition.get(), encode_record_key(log.timestamp(), log.reference()), log.serialize());
+                put_metadata_index_entries(batch, partition.get(), indexed_fields, log);
+                batch.Put(it->key(), encode_locator(log.timestamp()));
+                ++migrated;
+            }
         } catch (const std::exception& e) {
-            std::cerr << "Error deserializing log: " << e.what() << std::endl;
+            LOG_ERROR("Error deserializing log: " << e.what());
+            continue;
+        }
+
+        if (batch.Count() >= static_cast<int>(BACKFILL_BATCH_SIZE)) {
+            write_batch(db, batch, "partitioned logs");
         }
     }
 
     if (!it->status().ok()) {
-        std::cerr << "Error iterating over logs: " << it->status().ToString() << std::endl;
+        throw std::runtime_error("Error iterating over logs: " + it->status().ToString());
     }
+    it.reset();
 
-    return logs;
-}
\ No newline at end of file
+    nlohmann::json fields(std::vector<std::string>(indexed_fields.begin(), indexed_fields.end()));
+    batch.Put(meta_cf, INDEXED_FIELDS_KEY, fields.dump());
+    batch.Put(meta_cf, PARTITIONED_KEY, "1");
+    write_batch(db, batch, "partitioned logs");
+
+    for (auto* handle : legacy_handles) {
+        rocksdb::Status status = db->DropColumnFamily(handle);
+        if (!status.ok()) {
+            throw std::runtime_error("Failed to drop " + handle->GetName() + ": " + status.ToString());
+        }
+        db->DestroyColumnFamilyHandle(handle);
+    }
+
+    LOG_INFO("Migrated " << migrated << " logs");
+    return migrated;
+}
+
+void DBWrapper::sync_metadata_index_fields() {
+    std::string stored;
+    rocksdb::Status status = db->Get(rocksdb::ReadOptions(), meta_cf, INDEXED_FIELDS_KEY, &stored);
+    if (!status.ok() && !status.IsNotFound()) {
+        throw std::runtime_error("Failed to read metadata index fields: " + status.ToString());
+    }
+    std::set<std::string> previous;
+    if (status.ok()) {
+        std::vector<std::string> stored_fields = nlohmann::json::parse(stored);
+        previous.insert(stored_fields.begin(), stored_fields.end());
+    }
+    if (previous == indexed_fields) {
+        return;
+    }
+
+    // Fields no longer configured are dropped with one range tombstone per
+    // field and partition
+    rocksdb::WriteBatch batch;
+    for (const auto& field : previous) {
+        if (!indexed_fields.count(field)) {
+            LOG_INFO("Dropping metadata index for field " << field);
+            std::string prefix = encode_metadata_field_prefix(field);
+            for (const auto& partition : partitions->all()) {
+                batch.DeleteRange(partition.second.get(), prefix, prefix_successor(prefix));
+            }
+        }
+    }
+    write_batch(db, batch, "metadata index");
+
+    std::set<std::string> added;
+    for (const auto& field : indexed_fields) {
+        if (!previous.count(field)) {
+            added.insert(field);
+        }
+    }
+    backfill_metadata_index(added);
+
+    // Recorded last, so an interrupted backfill is redone on the next open
+    nlohmann::json fields(std::vector<std::string>(indexed_fields.begin(), indexed_fields.end()));
+    status = db->Put(rocksdb::WriteOptions(), meta_cf, INDEXED_FIELDS_KEY, fields.dump());
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to write metadata index fields: " + status.ToString());
+    }
+}
+
+size_t DBWrapper::backfill_metadata_index(const std::set<std::string>& fields) {
+    if (fields.empty()) {
+        return 0;
+    }
+    LOG_INFO("Building metadata index for " << fields.size() << " new field(s)...");
+
+    const std::string record_prefix(1, RECORD_KEY_TAG);
+    const std::string record_limit = prefix_successor(record_prefix);
+    size_t indexed = 0;
+    rocksdb::WriteBatch batch;
+    for (const auto& partition : partitions->all()) {
+        rocksdb::Slice upper_bound(record_limit);
+        rocksdb::ReadOptions read_options;
+        read_options.iterate_upper_bound = &upper_bound;
+        std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(read_options, partition.second.get()));
+        for (it->Seek(record_prefix); it->Valid(); it->Next()) {
+            try {
+                put_metadata_index_entries(batch, partition.second.get(), fields,
+                                           Log::deserialize(to_string_view(it->value())));
+                ++indexed;
+            } catch (const std::exception& e) {
+                LOG_ERROR("Error deserializing log: " << e.what());
+                continue;
+            }
+
+            if (batch.Count() >= static_cast<int>(BACKFILL_BATCH_SIZE)) {
+                write_batch(db, batch, "metadata index");
+            }
+        }
+
+        if (!it->status().ok()) {
+            throw std::runtime_error("Error iterating over logs: " + it->status().ToString());
+        }
+    }
+    write_batch(db, batch, "metadata index");
+
+    LOG_INFO("Metadata index built for " << indexed << " logs");
+    return indexed;
+}
+
+void DBWrapper::sync_sketch_definitions() {
+    std::string stored;
+    rocksdb::Status status = db->Get(rocksdb::ReadOptions(), meta_cf, SKETCH_DEFINITIONS_KEY, &stored);
+    if (!status.ok() && !status.IsNotFound()) {
+        throw std::runtime_error("Failed to read sketch definitions: " + status.ToString());
+    }
+    std::map<std::string, std::string> previous;
+    if (status.ok()) {
+        previous = nlohmann::json::parse(stored).get<std::map<std::string, std::string>>();
+    }
+    std::map<std::string, std::string> current;
+    for (const auto& definition : sketch_definitions) {
+        current[definition.name] = definition.signature();
+    }
+    if (previous == current) {
+        return;
+    }
+
+    // Redefined sketches are cleared by their backfill
+    rocksdb::WriteBatch batch;
+    for (const auto& entry : previous) {
+        if (!current.count(entry.first)) {
+            LOG_INFO("Dropping sketch " << entry.first);
+            std::string prefix = encode_sketch_prefix(entry.first);
+            batch.DeleteRange(sketch_cf, prefix, prefix_successor(prefix));
+        }
+    }
+    write_batch(db, batch, "sketches");
+
+    std::vector<SketchDefinition> added;
+    for (const auto& definition : sketch_definitions) {
+        auto it = previous.find(definition.name);
+        if (it == previous.end() || it->second != current[definition.name]) {
+            added.push_back(definition);
+        }
+    }
+    backfill_sketches(added);
+
+    // Recorded last, so an interrupted backfill is redone on the next open
+    status = db->Put(rocksdb::WriteOptions(), meta_cf, SKETCH_DEFINITIONS_KEY, nlohmann::json(current).dump());
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to write sketch definitions: " + status.ToString());
+    }
+}
+
+size_t DBWrapper::backfill_sketches(const std::vector<SketchDefinition>& definitions) {
+    if (definitions.empty()) {
+        return 0;
+    }
+    LOG_INFO("Building " << definitions.size() << " new sketch(es)...");
+
+    // A redone backfill must not count logs twice
+    rocksdb::WriteBatch batch;
+    for (const auto& definition : definitions) {
+        std::string prefix = encode_sketch_prefix(definition.name);
+        batch.DeleteRange(sketch_cf, prefix, prefix_successor(prefix));
+    }
+    write_batch(db, batch, "sketches");
+
+    std::set<std::string> fields;
+    for (const auto& definition : definitions) {
+        fields.insert(definition.field);
+        if (!definition.group_by.empty()) {
+            fields.insert(definition.group_by);
+        }
+    }
+    const std::string record_prefix(1, RECORD_KEY_TAG);
+    const std::string record_limit = prefix_successor(record_prefix);
+    SketchUpdates sketch_updates(definitions);
+    std::vector<std::pair<std::string, std::string>> values;
+    size_t sketched = 0;
+    for (const auto& partition : partitions->all()) {
+        rocksdb::Slice upper_bound(record_limit);
+        rocksdb::ReadOptions read_options;
+        read_options.iterate_upper_bound = &upper_bound;
+        std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(read_options, partition.second.get()));
+        for (it->Seek(record_prefix); it->Valid(); it->Next()) {
+            try {
+                Log log = Log::deserialize(to_string_view(it->value()));
+                values.clear();
+                collect_field_values(fields, log, values);
+                sketch_updates.add(log.timestamp(), values);
+                ++sketched;
+            } catch (const std::exception& e) {
+                LOG_ERROR("Error deserializing log: " << e.what());
+            }
+        }
+        if (!it->status().ok()) {
+            throw std::runtime_error("Error iterating over logs: " + it->status().ToString());
+        }
+        // Buckets do not span days unless they are wider than one, so each
+        // partition's sketches are mostly complete when written
+        sketch_updates.write(batch, sketch_cf);
+        write_batch(db, batch, "sketches");
+    }
+
+    LOG_INFO("Sketches built for " << sketched << " logs");
+    return sketched;
+}
+
+SketchQueryResult DBWrapper::query_sketch(const std::string& name, int64_t start_timestamp, int64_t end_timestamp,
+                                          const std::string& group) {
+    if (!shards.empty()) {
+        SketchQueryResult result;
+        for (auto& shard : shards) {
+            result.merge(shard->query_sketch(name, start_timestamp, end_timestamp, group));
+        }
+        return result;
+    }
+    for (const auto& definition : sketch_definitions) {
+        if (definition.name == name) {
+            return read_sketches(db, sketch_cf, definition, start_timestamp, end_timestamp, group);
+        }
+    }
+    throw std::runtime_error("Unknown sketch: " + name);
+}
+
+uint64_t DBWrapper::property_total(const std::string& property) {
+    uint64_t total = 0;
+    for (auto& shard : shards) {
+        total += shard->property_total(property);
+    }
+    if (!db) {
+        return total;
+    }
+    uint64_t value;
+    for (auto* handle : cf_handles) {
+        if (db->GetIntProperty(handle, property, &value)) {
+            total += value;
+        }
+    }
+    for (const auto& partition : partitions->all()) {
+        if (db->GetIntProperty(partition.second.get(), property, &value)) {
+            total += value;
+        }
+    }
+    return total;
+}
+
+uint64_t DBWrapper::property_max(const std::string& property) {
+    uint64_t max = 0;
+    for (auto& shard : shards) {
+        max = std::max(max, shard->property_max(property));
+    }
+    if (!db) {
+        return max;
+    }
+    uint64_t value;
+    for (auto* handle : cf_handles) {
+        if (db->GetIntProperty(handle, property, &value)) {
+            max = std::max(max, value);
+        }
+    }
+    for (const auto& partition : partitions->all()) {
+        if (db->GetIntProperty(partition.second.get(), property, &value)) {
+            max = std::max(max, value);
+        }
+    }
+    return max;
+}
+
+uint64_t DBWrapper::ticker(rocksdb::Tickers ticker) const {
+    return statistics ? statistics->getTickerCount(ticker) : 0;
+}
+
+int64_t DBWrapper::retention_cutoff_for(int64_t now) const {
+    if (retention_days <= 0) {
+        return INT64_MIN;
+    }
+    // Today counts as the first day of the window
+    return (PartitionSet::day_of(now) - retention_days + 1) * PartitionSet::DAY_MS;
+}
+
+size_t DBWrapper::enforce_retention() {
+    if (!shards.empty()) {
+        size_t dropped = 0;
+        for (auto& shard : shards) {
+            dropped += shard->enforce_retention();
+        }
+        return dropped;
+    }
+    int64_t cutoff = retention_cutoff_for(now_ms());
+    if (cutoff == INT64_MIN) {
+        return 0;
+    }
+    std::unique_lock<std::shared_mutex> lock(retention_mutex);
+    retention_cutoff = cutoff;
+    return partitions->drop_before(PartitionSet::day_of(cutoff));
+}
+
+void DBWrapper::retention_loop() {
+    std::unique_lock<std::mutex> lock(retention_thread_mutex);
+    while (!retention_thread_cv.wait_for(lock, retention_check_interval, [this] { return stopping; })) {
+        lock.unlock();
+        try {
+            enforce_retention();
+        } catch (const std::exception& e) {
+            LOG_ERROR("Error enforcing retention: " << e.what());
+        }
+        lock.lock();
+    }
+}
@@ -1,29 +1,261 @@
 #ifndef DB_WRAPPER_H
 #define DB_WRAPPER_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
+#include <rocksdb/cache.h>
 #include <rocksdb/db.h>
-#include <mutex>
+#include <rocksdb/compaction_filter.h>
+#include <rocksdb/statistics.h>
 #include "log.h"
+#include "aggregate.h"
 #include "config_reader.h"
+#include "group_commit.h"
+#include "log_scanner.h"
+#include "log_tail.h"
+#include "partition_set.h"
+#include "reference_cache.h"
+#include "scan_pool.h"
+#include "shard_ring.h"
+#include "sketch_store.h"
 
+enum class LookupStatus { Found, NotFound };
+
+// The log store. With a "shards" section in the config it is made of one
+// RocksDB instance per configured directory, each with a WAL, memtables,
+// compactions and group commit writer of its own: references are placed on
+// shards by consistent hashing, so writes and lookups of a reference go to
+// one shard, while scans, aggregations and sketches read all of them and
+// merge the results. The shards share the block cache, the statistics, the
+// scan pool and the live tail.
 class DBWrapper {
 public:
     DBWrapper(const std::string& db_path, const std::string& config_path);
     ~DBWrapper();
 
-    bool insert_log(const Log& log);
+    // 1 for an unsharded database
+    size_t shard_count() const { return shards.empty() ? 1 : shards.size(); }
+
+    InsertStatus insert_log(const Log& log, Durability durability = Durability::Wal);
+    // Throws std::runtime_error if there is no such log
     Log get_log(const std::string& reference);
+    // Stored record of the log, from the reference cache when it is there.
+    // A missing or expired log is NotFound; only storage errors throw.
+    LookupStatus find_log_record(const std::string& reference, ReferenceCache::Record& record);
     std::vector<Log> get_logs_by_time_range(int64_t start_timestamp, int64_t end_timestamp);
 
-    bool batch_insert_logs(const std::vector<Log>& logs);
+    // Inserts every log whose reference is not stored yet and that is within
+    // the retention window, and returns what became of each log
+    std::vector<InsertStatus> batch_insert_logs(const std::vector<Log>& logs, Durability durability = Durability::Wal);
+    using InsertCallback = std::function<void(std::vector<InsertStatus> statuses, const std::exception_ptr& error)>;
+    // Same without waiting: done is called on a group commit writer thread
+    // once the logs are committed, or with the error of a failed commit
+    void batch_insert_logs_async(const std::vector<Log>& logs, Durability durability, InsertCallback done);
+
+    // Queues the logs for insertion and returns without waiting for them to
+    // be committed. Returns false, queuing none of them, when the ingest
+    // queue is full; with shards, that of any shard the logs go to. Inserts
+    // skip references already stored, so the caller can simply retry the
+    // whole batch.
+    bool enqueue_logs(std::vector<Log> logs, Durability durability = Durability::Wal);
+    // Builds the stored form of a log whose metadata is already MessagePack,
+    // checking that the metadata is one well-formed value. A zero timestamp
+    // means now. Throws std::runtime_error on malformed metadata or a
+    // timestamp outside PartitionSet::in_range.
+    LogRecord make_record(std::string reference, int64_t timestamp, std::string_view msgpack_metadata) const;
+    // Queues writes of records, each reporting through its on_commit on the
+    // group commit writer thread. Writes queued together share a group when
+    // they fit in one.
+    void insert_records_async(std::vector<std::unique_ptr<PendingWrite>> writes);
+    // Logs queued by enqueue_logs and not committed yet, and how many of
+    // them failed to commit since startup
+    size_t ingest_queue_logs() const;
+    uint64_t ingest_failed_logs() const;
+
+    // Follows the logs committed from now on through inserts (bulk loads
+    // excepted). Returns null when tail.max_subscribers tails are open.
+    std::unique_ptr<LogTail::Reader> subscribe();
+    size_t tail_subscribers() const;
+
+    struct ReferenceCacheStats {
+        uint64_t hits = 0;
+        uint64_t missing_hits = 0;
+        uint64_t misses = 0;
+        size_t bytes = 0;
+    };
+    // All zero when the cache is disabled
+    ReferenceCacheStats reference_cache_stats() const;
 
     std::vector<Log> get_all_logs();
 
+    // Scans in timestamp order, starting after the given scanner position.
+    // Only the partitions overlapping the time range are opened. Each shard
+    // is read from a snapshot of its own.
+    std::unique_ptr<LogScanner> scan_all(const std::string& after_key = "");
+    std::unique_ptr<LogScanner> scan_time_range(int64_t start_timestamp, int64_t end_timestamp,
+                                                const std::string& after_key = "");
+    // Time range plus metadata filters; positions are interchangeable with
+    // those of scan_time_range
+    std::unique_ptr<LogScanner> scan_query(const LogQuery& query, const std::string& after_key = "");
+    // Same query split into ranges of similar size that are read at once on
+    // the scan pool. Ordered scans return logs in timestamp order, with the
+    // same positions as scan_query; unordered ones cannot be resumed.
+    std::unique_ptr<LogScanner> scan_query_parallel(const LogQuery& query, const std::string& after_key = "",
+                                                    bool ordered = true);
+
+    // Drops the partitions that have fallen out of the retention window and
+    // returns how many were dropped. Runs periodically in the background.
+    size_t enforce_retention();
+
+    // Integer RocksDB property summed over all column families
+    uint64_t property_total(const std::string& property);
+    // Largest value of an integer RocksDB property over all column families,
+    // for flags and rates such as rocksdb.is-write-stopped
+    uint64_t property_max(const std::string& property);
+    // Statistics ticker, or 0 when rocksdb.statistics is off
+    uint64_t ticker(rocksdb::Tickers ticker) const;
+
+    // Evaluates counts, group-bys and time histograms while scanning,
+    // splitting large windows into time ranges aggregated in parallel
+    AggregateResult aggregate(const AggregateQuery& query);
+
+    // Merges the buckets of a configured sketch that overlap the time range.
+    // Throws std::runtime_error for an unknown sketch.
+    SketchQueryResult query_sketch(const std::string& name, int64_t start_timestamp, int64_t end_timestamp,
+                                   const std::string& group = "");
+    const std::vector<SketchDefinition>& sketches() const { return sketch_definitions; }
+
+    // Rewrites records stored in the legacy JSON text format in the binary
+    // format. Works in chunks, so it can run while the server is serving;
+    // inserts never overwrite an existing record, so they cannot race it.
+    size_t convert_legacy_records();
+
+    struct BulkLoadResult {
+        size_t read = 0;         // input lines
+        size_t loaded = 0;
+        size_t duplicates = 0;   // reference already stored or seen earlier in the input
+        size_t expired = 0;      // older than the retention window
+        size_t invalid = 0;      // lines that are not a log, or whose timestamp is out of range
+    };
+
+    // Loads NDJSON logs ({"reference", "metadata", "timestamp"} per line)
+    // without going through the WAL or memtables: each chunk of the input is
+    // sorted, written as SST files for the partitions (records and metadata
+    // index) and the reference locators on several threads, then ingested.
+    // References are checked against what is stored when their chunk is
+    // loaded, and checked again with inserts paused just before ingestion,
+    // so a live insert of the same reference wins over the load.
+    BulkLoadResult bulk_load(const std::string& input_path, size_t threads = 0);
+
 private:
+    // A shard of a sharded database, sharing what the parent shares
+    DBWrapper(const DBWrapper& parent, const std::string& db_path, const ConfigReader& config, size_t shard,
+              size_t shard_count);
+    // Opens the RocksDB instance at db_path as the given shard (0 of 1 when
+    // unsharded)
+    void open(const ConfigReader& config, size_t shard, size_t shard_count);
+    // Refuses a database created as another shard or with another number of
+    // shards, whose references would be looked for on the wrong shards
+    void check_shard_layout(size_t shard, size_t shard_count, bool has_logs);
+
+    DBWrapper& shard_for(const std::string& reference) { return *shards[ring->shard_of(reference)]; }
+    // Moves the records of the write into one write per shard they go to,
+    // appended to parts. A write with an on_commit reports through it once
+    // the last of its parts has been committed.
+    void split_write(std::unique_ptr<PendingWrite> write, std::vector<std::vector<std::unique_ptr<PendingWrite>>>& parts);
+
+    // A time range of one partition to aggregate, with what to read it from
+    struct AggregateRange {
+        rocksdb::DB* db;
+        SharedSnapshot snapshot;
+        const std::set<std::string>* indexed_fields;
+        PartitionSet::Handle partition;
+        int64_t start_timestamp;
+        int64_t end_timestamp;
+    };
+    // Splits the window of the query over this database's partitions,
+    // further while there are fewer ranges than threads
+    void aggregate_ranges(const AggregateQuery& query, size_t threads, std::vector<AggregateRange>& ranges);
+
+    // Serializes the log and extracts its indexed fields on the caller's
+    // thread, leaving the writer thread only the batch to build
+    LogRecord make_record(const Log& log) const;
+    // Reads the record from RocksDB, leaving the cache alone
+    LookupStatus read_log_record(const std::string& reference, rocksdb::PinnableSlice& record, int64_t& timestamp);
+    // Runs on the group commit writer thread; hands the data of the records
+    // it inserts to the reference cache and live tails
+    void commit_group(std::vector<PendingWrite*>& group);
+
+    // Brings the metadata index in line with the configured fields: indexes
+    // existing logs for newly added fields and drops removed ones
+    void sync_metadata_index_fields();
+    size_t backfill_metadata_index(const std::set<std::string>& fields);
+    // Likewise for sketches: drops those removed or redefined, and builds the
+    // new ones from the stored logs
+    void sync_sketch_definitions();
+    size_t backfill_sketches(const std::vector<SketchDefinition>& definitions);
+
+    // Moves the records of a database using the unpartitioned layout (records
+    // in the default column family, with or without separate time and
+    // metadata index column families) into partitions
+    size_t migrate_unpartitioned_layout(const std::vector<rocksdb::ColumnFamilyHandle*>& legacy_handles);
+
+    void bulk_load_chunk(const std::vector<Log>& logs, const std::string& dir, size_t threads,
+                         BulkLoadResult& result);
+
+    int64_t retention_cutoff_for(int64_t now) const;
+    void retention_loop();
+
+    // Set when sharded; the database then has no RocksDB instance of its own
+    std::vector<std::unique_ptr<DBWrapper>> shards;
+    std::unique_ptr<ShardRing> ring;
+
     rocksdb::DB* db;
-    std::mutex db_mutex;
+    std::string db_path;
+    rocksdb::Options options;
+    std::shared_ptr<rocksdb::Cache> block_cache;
+    std::shared_ptr<rocksdb::Statistics> statistics;
+    rocksdb::ColumnFamilyHandle* meta_cf;
+    std::set<std::string> indexed_fields;
+    rocksdb::ColumnFamilyHandle* sketch_cf;
+    std::vector<SketchDefinition> sketch_definitions;
+    std::set<std::string> sketched_fields;  // fields and group_by fields
+    std::vector<rocksdb::ColumnFamilyHandle*> cf_handles;
+    std::unique_ptr<PartitionSet> partitions;
+    size_t query_parallelism;
+    std::unique_ptr<ScanPool> own_scan_pool;  // null in shards
+    ScanPool* scan_pool;
+    std::unique_ptr<ReferenceCache> reference_cache;  // null when disabled
+    std::shared_ptr<LogTail> tail;
+
+    // Logs older than the cutoff are expired. Writers hold the lock shared
+    // while they commit so that a partition is never dropped under them.
+    int retention_days;
+    std::chrono::seconds retention_check_interval;
+    std::atomic<int64_t> retention_cutoff;
+    std::shared_mutex retention_mutex;
+    std::unique_ptr<rocksdb::CompactionFilter> locator_filter;
+
+    std::thread retention_thread;
+    std::mutex retention_thread_mutex;
+    std::condition_variable retention_thread_cv;
+    bool stopping;
+
+    std::unique_ptr<GroupCommitter> committer;
+    // Held by commit_group; a bulk load takes it to keep inserts out between
+    // its last duplicate check and the ingestion
+    std::mutex commit_mutex;
+    std::mutex bulk_load_mutex;
 };
 
 #endif // DB_WRAPPER_H
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "group_commit.h"
+#include <exception>
+#include "logger.h"
+
+bool parse_durability(const std::string& name, Durability& durability) {
+    if (name == "memory") {
+        durability = Durability::Memory;
+    } else if (name == "wal") {
+        durability = Durability::Wal;
+    } else if (name == "sync") {
+        durability = Durability::Sync;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* insert_status_name(InsertStatus status) {
+    switch (status) {
+        case InsertStatus::Inserted: return "inserted";
+        case InsertStatus::Duplicate: return "duplicate";
+        case InsertStatus::Expired: return "expired";
+    }
+    return "unknown";
+}
+
+GroupCommitter::GroupCommitter(CommitFunction commit, std::chrono::microseconds window, size_t max_group_logs,
+                               size_t max_detached_logs)
+    : commit(std::move(commit)),
+      window(window),
+      max_group_logs(max_group_logs),
+      max_detached_logs(max_detached_logs),
+      queued_logs(0),
+      detached_logs(0),
+      detached_failures(0),
+      stopping(false) {
+    writer = std::thread([this]() { run(); });
+}
+
+GroupCommitter::~GroupCommitter() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    writer.join();
+}
+
+void GroupCommitter::submit(PendingWrite& write) {
+    submit_async(write).get();
+}
+
+std::future<void> GroupCommitter::submit_async(PendingWrite& write) {
+    std::future<void> committed = write.committed.get_future();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(&write);
+        queued_logs += write.records.size();
+    }
+    queue_cv.notify_all();
+    return committed;
+}
+
+bool GroupCommitter::submit_detached(std::unique_ptr<PendingWrite> write) {
+    if (!reserve_detached(write->records.size())) {
+        return false;
+    }
+    submit_reserved(std::move(write));
+    return true;
+}
+
+bool GroupCommitter::reserve_detached(size_t logs) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    // A write larger than the limit is still taken when nothing is queued
+    size_t queued = detached_logs.load(std::memory_order_relaxed);
+    if (queued > 0 && queued + logs > max_detached_logs) {
+        return false;
+    }
+    detached_logs.fetch_add(logs, std::memory_order_relaxed);
+    return true;
+}
+
+void GroupCommitter::cancel_reservation(size_t logs) {
+    detached_logs.fetch_sub(logs, std::memory_order_relaxed);
+}
+
+void GroupCommitter::submit_reserved(std::unique_ptr<PendingWrite> write) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queued_logs += write->records.size();
+        write->detached = true;
+        write->queue_limited = true;
+        queue.push_back(write.release());
+    }
+    queue_cv.notify_all();
+}
+
+void GroupCommitter::submit_detached(std::vector<std::unique_ptr<PendingWrite>> writes) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        for (auto& write : writes) {
+            queued_logs += write->records.size();
+            write->detached = true;
+            queue.push_back(write.release());
+        }
+    }
+    queue_cv.notify_all();
+}
+
+void GroupCommitter::run() {
+    std::vector<PendingWrite*> group;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;  // stopping and fully drained
+            }
+
+            // Give other writers a chance to join the group
+            if (window.count() > 0) {
+                auto deadline = std::chrono::steady_clock::now() + window;
+                queue_cv.wait_until(lock, deadline, [this]() {
+                    return stopping || queued_logs >= max_group_logs;
+                });
+            }
+
+            // Always take at least one write, even if it alone exceeds the limit
+            size_t group_logs = 0;
+            while (!queue.empty() && (group.empty() || group_logs + queue.front()->records.size() <= max_group_logs)) {
+                group_logs += queue.front()->records.size();
+                group.push_back(queue.front());
+                queue.pop_front();
+            }
+            queued_logs -= group_logs;
+        }
+
+        std::exception_ptr error;
+        try {
+            commit(group);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        for (auto* write : group) {
+            if (write->detached) {
+                finish_detached(write, error);
+            } else if (error) {
+                write->committed.set_exception(error);
+            } else {
+                write->committed.set_value();
+            }
+        }
+        group.clear();
+    }
+}
+
+void GroupCommitter::finish_detached(PendingWrite* write, const std::exception_ptr& error) {
+    std::unique_ptr<PendingWrite> owned(write);
+    if (owned->queue_limited) {
+        detached_logs.fetch_sub(owned->records.size(), std::memory_order_relaxed);
+        if (error) {
+            detached_failures.fetch_add(owned->records.size(), std::memory_order_relaxed);
+        }
+    }
+    if (owned->on_commit) {
+        owned->on_commit(*owned, error);
+        return;
+    }
+    if (!error) {
+        return;
+    }
+    try {
+        std::rethrow_exception(error);
+    } catch (const std::exception& e) {
+        LOG_ERROR("Detached write of " << owned->records.size() << " logs failed: " << e.what());
+    } catch (...) {
+        LOG_ERROR("Detached write of " << owned->records.size() << " logs failed");
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef GROUP_COMMIT_H
+#define GROUP_COMMIT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "log.h"
+
+// When a write counts as committed: once in the memtable (no WAL, lost on
+// a crash), once in the WAL (lost only on a machine crash), or once the WAL
+// has been fsynced
+enum class Durability { Memory, Wal, Sync };
+
+// Returns false if name is not "memory", "wal" or "sync"
+bool parse_durability(const std::string& name, Durability& durability);
+
+// What became of one record of a write
+enum class InsertStatus : uint8_t {
+    Inserted,
+    Duplicate,  // its reference was already stored
+    Expired     // older than the retention window, so there is nowhere to keep it
+};
+
+// "inserted", "duplicate" or "expired"
+const char* insert_status_name(InsertStatus status);
+
+// One caller's contribution to a commit group
+struct PendingWrite {
+    std::vector<LogRecord> records;
+    Durability durability = Durability::Wal;
+    // Owned by the committer, with nobody waiting for the result
+    bool detached = false;
+    // Queued with submit_detached(write) or submit_reserved: counts against
+    // max_detached_logs and in detached_queued_logs/detached_failed_logs
+    bool queue_limited = false;
+    // For detached writes: called on the writer thread once the write has
+    // been committed, with a null error, or has failed
+    std::function<void(PendingWrite& write, const std::exception_ptr& error)> on_commit;
+    // Filled in by the commit, one per record
+    std::vector<InsertStatus> statuses;
+    std::promise<void> committed;
+};
+
+// Funnels concurrent writers into one writer thread that commits everything
+// queued during a flush window as a single WriteBatch, so N callers share one
+// WAL write. Because every write goes through this thread, check-then-write
+// sequences inside the commit function need no further locking. A group is
+// committed with the strongest durability any of its writes asked for, so
+// concurrent sync writers share a single fsync.
+class GroupCommitter {
+public:
+    // Called on the writer thread with the writes of one group. Throwing
+    // fails every write in the group with that exception.
+    using CommitFunction = std::function<void(std::vector<PendingWrite*>& group)>;
+
+    GroupCommitter(CommitFunction commit, std::chrono::microseconds window, size_t max_group_logs,
+                   size_t max_detached_logs);
+    // Commits everything still queued, detached writes included
+    ~GroupCommitter();
+
+    // Queues the write and blocks until its group has been committed.
+    // Rethrows the commit's exception if it failed.
+    void submit(PendingWrite& write);
+    // Same without blocking: the future is ready once the group has been
+    // committed. The write must stay alive until then.
+    std::future<void> submit_async(PendingWrite& write);
+
+    // Queues the write and returns right away. Returns false, without
+    // queuing, when the detached writes already queued hold max_detached_logs
+    // logs. Failures of detached writes are only logged and counted.
+    bool submit_detached(std::unique_ptr<PendingWrite> write);
+    // The same in two steps, for callers that must know that several
+    // committers all take their part before queuing any: reserve room for
+    // the logs (false if there is none), then either queue writes holding
+    // exactly that many logs or cancel the reservation
+    bool reserve_detached(size_t logs);
+    void cancel_reservation(size_t logs);
+    void submit_reserved(std::unique_ptr<PendingWrite> write);
+
+    // Queues detached writes that report through their on_commit, all at
+    // once so that they can share a group. There is no queue limit: callers
+    // bound how many such writes they have in flight. Their callers are
+    // waiting on them, so they are not counted as queued detached logs.
+    void submit_detached(std::vector<std::unique_ptr<PendingWrite>> writes);
+
+    size_t detached_queued_logs() const { return detached_logs.load(std::memory_order_relaxed); }
+    uint64_t detached_failed_logs() const { return detached_failures.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+    void finish_detached(PendingWrite* write, const std::exception_ptr& error);
+
+    CommitFunction commit;
+    std::chrono::microseconds window;
+    size_t max_group_logs;
+    size_t max_detached_logs;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<PendingWrite*> queue;
+    size_t queued_logs;
+    std::atomic<size_t> detached_logs;
+    std::atomic<uint64_t> detached_failures;
+    bool stopping;
+    std::thread writer;
+};
+
+#endif // GROUP_COMMIT_H
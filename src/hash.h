@@ -0,0 +1,24 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <string_view>
+
+// FNV-1a, then the splitmix64 finalizer so that every bit depends on every
+// input byte. Sketches and the placement of references on shards depend on
+// it, so it must never change.
+inline uint64_t hash_text(std::string_view text) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+#endif // HASH_H
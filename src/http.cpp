@@ -0,0 +1,356 @@
+#include "http.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+std::string to_lower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::tolower(c); });
+    return s;
+}
+
+std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+// True if a comma-separated header value such as "keep-alive, Upgrade"
+// contains the given token, compared case-insensitively
+bool has_token(const std::string& value, const std::string& token) {
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t comma = value.find(',', start);
+        if (comma == std::string::npos) {
+            comma = value.size();
+        }
+        if (to_lower(trim(value.substr(start, comma - start))) == token) {
+            return true;
+        }
+        start = comma + 1;
+    }
+    return false;
+}
+
+bool is_token_char(unsigned char c) {
+    return std::isalnum(c) || std::strchr("!#$%&'*+-.^_`|~", c) != nullptr;
+}
+
+}
+
+const std::string* HttpRequest::header(const std::string& name) const {
+    std::string lower = to_lower(name);
+    for (const auto& h : headers) {
+        if (h.first == lower) {
+            return &h.second;
+        }
+    }
+    return nullptr;
+}
+
+bool HttpRequest::keep_alive() const {
+    const std::string* connection = header("connection");
+    if (version_minor == 0) {
+        return connection && has_token(*connection, "keep-alive");
+    }
+    return !(connection && has_token(*connection, "close"));
+}
+
+const char* http_status_text(int status_code) {
+    switch (status_code) {
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 408: return "Request Timeout";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        case 505: return "HTTP Version Not Supported";
+        default: return "Unknown";
+    }
+}
+
+std::string HttpResponse::to_string(bool keep_alive) const {
+    return header(keep_alive) + body;
+}
+
+std::string HttpResponse::header(bool keep_alive) const {
+    std::string response_str = "HTTP/1.1 " + std::to_string(status_code) + " " + http_status_text(status_code) + "\r\n";
+    response_str += "Content-Type: " + content_type + "\r\n";
+    response_str += "Content-Length: " + std::to_string(body.length()) + "\r\n";
+    for (const auto& h : headers) {
+        response_str += h.first + ": " + h.second + "\r\n";
+    }
+    response_str += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    response_str += "\r\n";
+    return response_str;
+}
+
+std::string HttpResponse::stream_header(bool chunked, bool keep_alive) const {
+    std::string response_str = "HTTP/1.1 " + std::to_string(status_code) + " " + http_status_text(status_code) + "\r\n";
+    response_str += "Content-Type: " + content_type + "\r\n";
+    if (chunked) {
+        response_str += "Transfer-Encoding: chunked\r\n";
+    }
+    for (const auto& h : headers) {
+        response_str += h.first + ": " + h.second + "\r\n";
+    }
+    response_str += chunked && keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    response_str += "\r\n";
+    return response_str;
+}
+
+const std::string HTTP_LAST_CHUNK = "0\r\n\r\n";
+
+std::string http_chunk(const std::string& data) {
+    std::string chunk = http_chunk_header(data.size());
+    chunk.reserve(chunk.size() + data.size() + 2);
+    chunk.append(data);
+    chunk.append("\r\n");
+    return chunk;
+}
+
+std::string http_chunk_header(size_t size) {
+    char line[20];
+    int n = std::snprintf(line, sizeof(line), "%zx\r\n", size);
+    return std::string(line, n);
+}
+
+HttpRequestParser::HttpRequestParser(size_t max_header_bytes, size_t max_body_bytes)
+    : max_header_bytes(max_header_bytes), max_body_bytes(max_body_bytes) {
+    reset();
+}
+
+void HttpRequestParser::reset() {
+    state = State::RequestLine;
+    current = HttpRequest();
+    line.clear();
+    header_bytes = 0;
+    body_remaining = 0;
+    status = 0;
+    message.clear();
+}
+
+HttpRequest& HttpRequestParser::request() {
+    return current;
+}
+
+bool HttpRequestParser::in_progress() const {
+    return state != State::RequestLine || !line.empty();
+}
+
+bool HttpRequestParser::awaiting_body() const {
+    return state == State::Body || state == State::ChunkSize || state == State::ChunkData ||
+           state == State::ChunkDataEnd || state == State::Trailers;
+}
+
+int HttpRequestParser::error_status() const {
+    return status;
+}
+
+const std::string& HttpRequestParser::error_message() const {
+    return message;
+}
+
+HttpRequestParser::Result HttpRequestParser::parse(const char* data, size_t size, size_t& consumed) {
+    consumed = 0;
+    while (consumed < size) {
+        switch (state) {
+            case State::Complete:
+                return Result::Complete;
+            case State::Error:
+                return Result::Error;
+            case State::Body:
+            case State::ChunkData: {
+                size_t n = std::min(body_remaining, size - consumed);
+                current.body.append(data + consumed, n);
+                consumed += n;
+                body_remaining -= n;
+                if (body_remaining == 0) {
+                    if (state == State::Body) {
+                        state = State::Complete;
+                        return Result::Complete;
+                    }
+                    state = State::ChunkDataEnd;
+                }
+                break;
+            }
+            default: {
+                // Every other state consumes CRLF-terminated lines
+                const char* start = data + consumed;
+                const char* newline = static_cast<const char*>(std::memchr(start, '\n', size - consumed));
+                size_t n = newline ? static_cast<size_t>(newline - start) + 1 : size - consumed;
+                header_bytes += n;
+                if (header_bytes > max_header_bytes) {
+                    consumed += n;
+                    return fail(431, "Request headers too large");
+                }
+                line.append(start, n);
+                consumed += n;
+                if (!newline) {
+                    return Result::Incomplete;
+                }
+                line.pop_back();
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                Result result = on_line();
+                line.clear();
+                if (result != Result::Incomplete) {
+                    return result;
+                }
+                break;
+            }
+        }
+    }
+    return state == State::Complete ? Result::Complete : Result::Incomplete;
+}
+
+HttpRequestParser::Result HttpRequestParser::on_line() {
+    switch (state) {
+        case State::RequestLine: return on_request_line();
+        case State::Headers: return on_header_line();
+        case State::ChunkSize: return on_chunk_size_line();
+        case State::ChunkDataEnd:
+            if (!line.empty()) {
+                return fail(400, "Malformed chunk terminator");
+            }
+            state = State::ChunkSize;
+            return Result::Incomplete;
+        case State::Trailers:
+            // Trailer fields are accepted but not used
+            if (line.empty()) {
+                state = State::Complete;
+                return Result::Complete;
+            }
+            return Result::Incomplete;
+        default:
+            return fail(500, "Parser in unexpected state");
+    }
+}
+
+HttpRequestParser::Result HttpRequestParser::on_request_line() {
+    // Clients may send stray CRLFs between pipelined requests
+    if (line.empty()) {
+        header_bytes = 0;
+        return Result::Incomplete;
+    }
+
+    size_t first_space = line.find(' ');
+    size_t second_space = first_space == std::string::npos ? std::string::npos : line.find(' ', first_space + 1);
+    if (second_space == std::string::npos) {
+        return fail(400, "Malformed request line");
+    }
+
+    current.method = line.substr(0, first_space);
+    current.target = line.substr(first_space + 1, second_space - first_space - 1);
+    std::string version = line.substr(second_space + 1);
+    if (current.method.empty() || current.target.empty()) {
+        return fail(400, "Malformed request line");
+    }
+    if (version == "HTTP/1.1") {
+        current.version_minor = 1;
+    } else if (version == "HTTP/1.0") {
+        current.version_minor = 0;
+    } else {
+        return fail(505, "Unsupported HTTP version");
+    }
+
+    state = State::Headers;
+    return Result::Incomplete;
+}
+
+HttpRequestParser::Result HttpRequestParser::on_header_line() {
+    if (line.empty()) {
+        return on_headers_complete();
+    }
+    if (line[0] == ' ' || line[0] == '\t') {
+        return fail(400, "Obsolete header line folding is not supported");
+    }
+
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || colon == 0) {
+        return fail(400, "Malformed header line");
+    }
+    std::string name = line.substr(0, colon);
+    for (unsigned char c : name) {
+        if (!is_token_char(c)) {
+            return fail(400, "Invalid header name");
+        }
+    }
+    current.headers.emplace_back(to_lower(name), trim(line.substr(colon + 1)));
+    return Result::Incomplete;
+}
+
+HttpRequestParser::Result HttpRequestParser::on_headers_complete() {
+    const std::string* transfer_encoding = current.header("transfer-encoding");
+    const std::string* content_length = current.header("content-length");
+
+    if (transfer_encoding) {
+        if (!has_token(*transfer_encoding, "chunked")) {
+            return fail(501, "Unsupported Transfer-Encoding");
+        }
+        // Content-Length is ignored when the body is chunked
+        state = State::ChunkSize;
+        return Result::Incomplete;
+    }
+
+    if (content_length) {
+        if (content_length->empty() || content_length->size() > 19 ||
+            !std::all_of(content_length->begin(), content_length->end(), [](unsigned char c) { return std::isdigit(c); })) {
+            return fail(400, "Invalid Content-Length");
+        }
+        body_remaining = std::stoull(*content_length);
+        if (body_remaining > max_body_bytes) {
+            return fail(413, "Request body too large");
+        }
+        if (body_remaining > 0) {
+            current.body.reserve(body_remaining);
+            state = State::Body;
+            return Result::Incomplete;
+        }
+    }
+
+    state = State::Complete;
+    return Result::Complete;
+}
+
+HttpRequestParser::Result HttpRequestParser::on_chunk_size_line() {
+    // Chunk extensions after ';' are ignored
+    std::string size_str = trim(line.substr(0, line.find(';')));
+    if (size_str.empty() || size_str.size() > 15 ||
+        !std::all_of(size_str.begin(), size_str.end(), [](unsigned char c) { return std::isxdigit(c); })) {
+        return fail(400, "Invalid chunk size");
+    }
+    size_t chunk_size = std::stoull(size_str, nullptr, 16);
+    if (chunk_size == 0) {
+        state = State::Trailers;
+        return Result::Incomplete;
+    }
+    if (current.body.size() + chunk_size > max_body_bytes) {
+        return fail(413, "Request body too large");
+    }
+    // Chunk boundaries do not count towards the header limit
+    header_bytes = 0;
+    body_remaining = chunk_size;
+    state = State::ChunkData;
+    return Result::Incomplete;
+}
+
+HttpRequestParser::Result HttpRequestParser::fail(int status_code, const std::string& reason) {
+    state = State::Error;
+    status = status_code;
+    message = reason;
+    return Result::Error;
+}
@@ -0,0 +1,135 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct HttpRequest {
+    std::string method;
+    std::string target;
+    int version_minor = 1;  // HTTP/1.x
+    // Header names are stored lower-cased
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    // Case-insensitive lookup; returns nullptr when the header is absent
+    const std::string* header(const std::string& name) const;
+
+    // HTTP/1.1 connections persist unless the client sends "Connection: close";
+    // HTTP/1.0 connections only persist with "Connection: keep-alive".
+    bool keep_alive() const;
+};
+
+// Produces a response body piece by piece so it never has to be held in
+// memory as a whole. Sent with chunked transfer encoding.
+class HttpBodyStream {
+public:
+    virtual ~HttpBodyStream() = default;
+
+    // Replaces out with the next piece of the body. Returns false once the
+    // body is complete; out may hold a final piece in that case.
+    virtual bool next_chunk(std::string& out) = 0;
+
+    // Streams following live data leave out empty while none has arrived;
+    // the connection then asks again after this long instead of right away.
+    // Zero for streams that always have more to give.
+    virtual std::chrono::milliseconds poll_interval() const { return std::chrono::milliseconds(0); }
+};
+
+struct HttpResponse {
+    int status_code = 200;
+    std::string content_type = "application/json";
+    std::string body;
+    // Sent in addition to the headers written for every response
+    std::vector<std::pair<std::string, std::string>> headers;
+    // When set, the body is streamed from here instead of taken from body
+    std::shared_ptr<HttpBodyStream> stream;
+    // Set by handlers that hand the actual response over later, from
+    // another thread, instead of blocking the server thread for it
+    bool deferred = false;
+
+    // Status line, headers and body ready to be written to the socket
+    std::string to_string(bool keep_alive = false) const;
+
+    // Status line and headers alone, so the body can be written after them
+    // without being copied
+    std::string header(bool keep_alive) const;
+
+    // Status line and headers of a streamed response. Without chunked
+    // encoding (HTTP/1.0 clients) the body is delimited by closing the
+    // connection instead.
+    std::string stream_header(bool chunked, bool keep_alive) const;
+};
+
+// Frames one piece of a chunked body
+std::string http_chunk(const std::string& data);
+// Size line of a chunk, for writing the data after it without copying;
+// the chunk still needs a trailing CRLF
+std::string http_chunk_header(size_t size);
+extern const std::string HTTP_LAST_CHUNK;
+
+const char* http_status_text(int status_code);
+
+// Incremental HTTP/1.1 request parser. Bytes can be fed in arbitrary pieces;
+// parse() stops right after a complete request so that pipelined requests
+// remaining in the same buffer can be fed to the next parse() call.
+class HttpRequestParser {
+public:
+    enum class Result { Incomplete, Complete, Error };
+
+    HttpRequestParser(size_t max_header_bytes, size_t max_body_bytes);
+
+    // Consumes bytes from data and sets consumed to how many were used
+    Result parse(const char* data, size_t size, size_t& consumed);
+
+    // The request being parsed; complete once parse() returns Complete
+    HttpRequest& request();
+
+    // Prepares the parser for the next request on the same connection
+    void reset();
+
+    // True once any byte of the current request has been consumed
+    bool in_progress() const;
+
+    // True when the headers are done and the body is still to come
+    bool awaiting_body() const;
+
+    // Status code and reason to answer with after parse() returns Error
+    int error_status() const;
+    const std::string& error_message() const;
+
+private:
+    enum class State {
+        RequestLine,
+        Headers,
+        Body,
+        ChunkSize,
+        ChunkData,
+        ChunkDataEnd,
+        Trailers,
+        Complete,
+        Error
+    };
+
+    Result on_line();
+    Result on_request_line();
+    Result on_header_line();
+    Result on_headers_complete();
+    Result on_chunk_size_line();
+    Result fail(int status, const std::string& message);
+
+    size_t max_header_bytes;
+    size_t max_body_bytes;
+    State state;
+    HttpRequest current;
+    std::string line;
+    size_t header_bytes;
+    size_t body_remaining;
+    int status;
+    std::string message;
+};
+
+#endif // HTTP_H
@@ -0,0 +1,501 @@
+#include "ingest_server.h"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+#include "logger.h"
+#include "varint.h"
+
+namespace {
+
+const size_t INITIAL_BUFFER_SIZE = 64 * 1024;
+const size_t FRAME_HEADER_BYTES = 4;
+
+const uint8_t FRAME_HELLO = 0x01;
+const uint8_t FRAME_RECORDS = 0x10;
+const uint8_t FRAME_ACK = 0x20;
+const uint8_t FRAME_ERROR = 0x21;
+
+// <u64 seq><u8 durability>, before the record count
+const size_t RECORDS_HEADER_BYTES = 9;
+// Timestamp, reference length and metadata length take a byte each at least
+const size_t MIN_RECORD_BYTES = 3;
+
+void put_be(std::string& dst, uint64_t value, size_t bytes) {
+    for (size_t i = bytes; i > 0; --i) {
+        dst.push_back(static_cast<char>(value >> (8 * (i - 1))));
+    }
+}
+
+uint64_t read_be(const char* p, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value = (value << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return value;
+}
+
+// Starts a frame; finish_frame fills in its length
+std::string start_frame(uint8_t type) {
+    std::string frame(FRAME_HEADER_BYTES, '\0');
+    frame.push_back(static_cast<char>(type));
+    return frame;
+}
+
+std::string finish_frame(std::string frame) {
+    uint64_t length = frame.size() - FRAME_HEADER_BYTES;
+    for (size_t i = 0; i < FRAME_HEADER_BYTES; ++i) {
+        frame[i] = static_cast<char>(length >> (8 * (FRAME_HEADER_BYTES - 1 - i)));
+    }
+    return frame;
+}
+
+std::string hello_frame(const IngestOptions& options) {
+    std::string frame = start_frame(FRAME_HELLO);
+    put_be(frame, IngestServer::PROTOCOL_VERSION, 2);
+    put_be(frame, options.window, 4);
+    put_be(frame, options.max_frame_bytes, 4);
+    return finish_frame(std::move(frame));
+}
+
+// Appends a bitmap with bit i set when record i has the status
+void put_status_bitmap(std::string& frame, const std::vector<InsertStatus>& statuses, InsertStatus status) {
+    size_t bitmap_start = frame.size();
+    frame.append((statuses.size() + 7) / 8, '\0');
+    for (size_t i = 0; i < statuses.size(); ++i) {
+        if (statuses[i] == status) {
+            frame[bitmap_start + i / 8] |= static_cast<char>(1 << (i % 8));
+        }
+    }
+}
+
+std::string ack_frame(uint64_t seq, const std::vector<InsertStatus>& statuses) {
+    std::string frame = start_frame(FRAME_ACK);
+    put_be(frame, seq, 8);
+    put_varint64(frame, statuses.size());
+    put_status_bitmap(frame, statuses, InsertStatus::Inserted);
+    put_status_bitmap(frame, statuses, InsertStatus::Expired);
+    return finish_frame(std::move(frame));
+}
+
+std::string error_frame(uint64_t seq, const std::string& message) {
+    std::string frame = start_frame(FRAME_ERROR);
+    put_be(frame, seq, 8);
+    frame.append(message);
+    return finish_frame(std::move(frame));
+}
+
+bool read_bytes(const char*& p, const char* limit, std::string_view& bytes) {
+    uint64_t length;
+    if (!get_varint64(p, limit, length) || length > static_cast<uint64_t>(limit - p)) {
+        return false;
+    }
+    bytes = std::string_view(p, length);
+    p += length;
+    return true;
+}
+
+// One persistent ingest connection. Frames are parsed straight out of the
+// read buffer; every RECORDS frame becomes one write queued with the group
+// committer, and its reply slot is filled in when the commit reports back.
+// Reading pauses while `window` replies are outstanding, and while admission
+// control finds the storage stalled, which pushes back on the client through
+// TCP.
+template<typename Protocol>
+class IngestConnection : public std::enable_shared_from_this<IngestConnection<Protocol>> {
+public:
+    IngestConnection(typename Protocol::socket socket, std::shared_ptr<DBWrapper> db, std::shared_ptr<Metrics> metrics,
+                     std::shared_ptr<AdmissionController> admission, const IngestOptions& options,
+                     std::shared_ptr<IngestInFlight> in_flight)
+        : socket(std::move(socket)),
+          stall_timer(this->socket.get_executor()),
+          buffer(INITIAL_BUFFER_SIZE),
+          db(std::move(db)),
+          metrics(std::move(metrics)),
+          admission(std::move(admission)),
+          options(options),
+          in_flight(std::move(in_flight)) {}
+
+    void start() {
+        replies.push_back({true, hello_frame(options)});
+        process_input();
+    }
+
+private:
+    struct Reply {
+        bool ready;
+        std::string frame;
+    };
+
+    void do_read() {
+        if (reading || stalled || closing || input_closed || closed || replies.size() >= options.window) {
+            return;
+        }
+
+        // Move the partial frame left in the buffer to the front and make
+        // room for all of it
+        if (begin > 0) {
+            std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        size_t needed = end >= FRAME_HEADER_BYTES
+            ? FRAME_HEADER_BYTES + read_be(buffer.data(), FRAME_HEADER_BYTES)
+            : INITIAL_BUFFER_SIZE;
+        if (buffer.size() < needed) {
+            buffer.resize(needed);
+        } else if (buffer.size() > INITIAL_BUFFER_SIZE && needed <= INITIAL_BUFFER_SIZE && end <= INITIAL_BUFFER_SIZE) {
+            // Give back the memory of an unusually large frame
+            buffer.resize(INITIAL_BUFFER_SIZE);
+            buffer.shrink_to_fit();
+        }
+
+        reading = true;
+        auto self = this->shared_from_this();
+        socket.async_read_some(boost::asio::buffer(buffer.data() + end, buffer.size() - end),
+            [this, self](const boost::system::error_code& ec, size_t bytes_transferred) {
+                reading = false;
+                if (ec) {
+                    if (ec != boost::asio::error::eof && ec != boost::asio::error::operation_aborted) {
+                        LOG_WARN("Error reading ingest frames: " << ec.message());
+                        close();
+                        return;
+                    }
+                    // Replies still owed are sent before closing
+                    input_closed = true;
+                    flush_replies();
+                    return;
+                }
+                metrics->add_bytes_in(bytes_transferred);
+                end += bytes_transferred;
+                process_input();
+            });
+    }
+
+    // Handles every complete frame in the buffer, up to the window, then
+    // queues their writes together so they can share a commit group
+    void process_input() {
+        std::vector<std::unique_ptr<PendingWrite>> writes;
+        if (!closing && !closed && admission->ingest_stalled()) {
+            // Frames wait in the buffer, and the client behind them, until
+            // the storage catches up
+            hold_input();
+            flush_replies();
+            return;
+        }
+        while (!closing && !closed && replies.size() < options.window && end - begin >= FRAME_HEADER_BYTES) {
+            uint64_t length = read_be(buffer.data() + begin, FRAME_HEADER_BYTES);
+            if (length == 0 || length > options.max_frame_bytes) {
+                fail("Invalid frame length " + std::to_string(length));
+                break;
+            }
+            if (end - begin < FRAME_HEADER_BYTES + length) {
+                break;
+            }
+            const char* frame = buffer.data() + begin + FRAME_HEADER_BYTES;
+            begin += FRAME_HEADER_BYTES + length;
+            handle_frame(frame, length, writes);
+        }
+
+        if (!writes.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(in_flight->mutex);
+                in_flight->writes += writes.size();
+            }
+            db->insert_records_async(std::move(writes));
+        }
+        flush_replies();
+        do_read();
+    }
+
+    void hold_input() {
+        if (stalled) {
+            return;
+        }
+        stalled = true;
+        stall_timer.expires_after(admission->check_interval());
+        auto self = this->shared_from_this();
+        stall_timer.async_wait([this, self](const boost::system::error_code& ec) {
+            stalled = false;
+            if (!ec) {
+                process_input();
+            }
+        });
+    }
+
+    void handle_frame(const char* frame, size_t length, std::vector<std::unique_ptr<PendingWrite>>& writes) {
+        uint8_t type = static_cast<uint8_t>(frame[0]);
+        const char* p = frame + 1;
+        const char* limit = frame + length;
+        if (type != FRAME_RECORDS) {
+            fail("Unexpected frame type " + std::to_string(type));
+            return;
+        }
+        if (static_cast<size_t>(limit - p) < RECORDS_HEADER_BYTES) {
+            fail("Truncated RECORDS frame");
+            return;
+        }
+        metrics->count_request("ingest");
+        uint64_t seq = read_be(p, 8);
+        uint8_t durability = static_cast<uint8_t>(p[8]);
+        p += RECORDS_HEADER_BYTES;
+
+        std::unique_ptr<PendingWrite> write(new PendingWrite());
+        try {
+            if (durability > static_cast<uint8_t>(Durability::Sync)) {
+                throw std::runtime_error("Unknown durability " + std::to_string(durability));
+            }
+            write->durability = static_cast<Durability>(durability);
+
+            uint64_t count;
+            if (!get_varint64(p, limit, count) || count > static_cast<uint64_t>(limit - p) / MIN_RECORD_BYTES) {
+                throw std::runtime_error("Invalid record count");
+            }
+            write->records.reserve(count);
+            for (uint64_t i = 0; i < count; ++i) {
+                uint64_t timestamp;
+                std::string_view reference;
+                std::string_view metadata;
+                if (!get_varint64(p, limit, timestamp) || !read_bytes(p, limit, reference) ||
+                    !read_bytes(p, limit, metadata)) {
+                    throw std::runtime_error("Truncated record " + std::to_string(i));
+                }
+                if (reference.empty()) {
+                    throw std::runtime_error("Record " + std::to_string(i) + " has no reference");
+                }
+                try {
+                    write->records.push_back(db->make_record(std::string(reference), zigzag_decode(timestamp), metadata));
+                } catch (const std::exception& e) {
+                    throw std::runtime_error("Record " + std::to_string(i) + ": " + e.what());
+                }
+            }
+            if (p != limit) {
+                throw std::runtime_error("Trailing bytes after the records");
+            }
+        } catch (const std::exception& e) {
+            metrics->count_error();
+            replies.push_back({true, error_frame(seq, e.what())});
+            return;
+        }
+
+        // The commit reports back on the writer thread; the reply is built
+        // there and handed to this connection's strand
+        uint64_t reply_id = first_reply_id + replies.size();
+        replies.push_back({false, std::string()});
+        auto self = this->shared_from_this();
+        auto start = std::chrono::steady_clock::now();
+        write->on_commit = [self, reply_id, seq, start](PendingWrite& write, const std::exception_ptr& error) mutable {
+            std::string frame;
+            if (!error) {
+                frame = ack_frame(seq, write.statuses);
+            } else {
+                try {
+                    std::rethrow_exception(error);
+                } catch (const std::exception& e) {
+                    frame = error_frame(seq, e.what());
+                } catch (...) {
+                    frame = error_frame(seq, "Write failed");
+                }
+            }
+            self->metrics->record_latency(Metrics::Stage::DbWrite, std::chrono::steady_clock::now() - start);
+
+            // The connection must not be released here: once in_flight
+            // drops, the io_context it belongs to may go away
+            std::shared_ptr<IngestInFlight> in_flight = self->in_flight;
+            auto executor = self->socket.get_executor();
+            boost::asio::post(executor,
+                [connection = std::move(self), reply_id, frame = std::move(frame)]() mutable {
+                    connection->complete(reply_id, std::move(frame));
+                });
+            {
+                std::lock_guard<std::mutex> lock(in_flight->mutex);
+                --in_flight->writes;
+            }
+            in_flight->done.notify_all();
+        };
+        writes.push_back(std::move(write));
+    }
+
+    void complete(uint64_t reply_id, std::string frame) {
+        Reply& reply = replies[reply_id - first_reply_id];
+        reply.ready = true;
+        reply.frame = std::move(frame);
+        // Sends it if it is next, and replies leaving the window may let
+        // more frames in
+        process_input();
+    }
+
+    // A framing error: the stream cannot be followed any further
+    void fail(const std::string& message) {
+        LOG_WARN("Ingest protocol error: " << message);
+        metrics->count_error();
+        replies.push_back({true, error_frame(0, message)});
+        closing = true;
+    }
+
+    // Writes the replies that are ready, in frame order
+    void flush_replies() {
+        if (writing || closed) {
+            return;
+        }
+        write_pieces.clear();
+        while (!replies.empty() && replies.front().ready) {
+            write_pieces.push_back(std::move(replies.front().frame));
+            replies.pop_front();
+            ++first_reply_id;
+        }
+        if (write_pieces.empty()) {
+            if (replies.empty() && (closing || input_closed)) {
+                close();
+            }
+            return;
+        }
+
+        write_buffers.clear();
+        for (const auto& piece : write_pieces) {
+            write_buffers.push_back(boost::asio::buffer(piece));
+        }
+        writing = true;
+        auto self = this->shared_from_this();
+        boost::asio::async_write(socket, write_buffers,
+            [this, self](const boost::system::error_code& ec, size_t bytes_transferred) {
+                writing = false;
+                if (ec) {
+                    LOG_WARN("Error sending ingest replies: " << ec.message());
+                    close();
+                    return;
+                }
+                metrics->add_bytes_out(bytes_transferred);
+                process_input();
+            });
+    }
+
+    void close() {
+        if (closed) {
+            return;
+        }
+        closed = true;
+        closing = true;
+        stall_timer.cancel();
+        boost::system::error_code ignored;
+        socket.shutdown(Protocol::socket::shutdown_both, ignored);
+        socket.close(ignored);
+    }
+
+    typename Protocol::socket socket;
+    boost::asio::steady_timer stall_timer;
+    std::vector<char> buffer;
+    size_t begin = 0;
+    size_t end = 0;
+    bool reading = false;
+    bool writing = false;
+    bool stalled = false;       // waiting out a storage stall
+    bool input_closed = false;  // the client has finished sending
+    bool closing = false;       // close once the replies owed are sent
+    bool closed = false;
+
+    // Replies owed, in frame order; slot i belongs to reply id first_reply_id + i
+    std::deque<Reply> replies;
+    uint64_t first_reply_id = 0;
+    std::vector<std::string> write_pieces;
+    std::vector<boost::asio::const_buffer> write_buffers;
+
+    std::shared_ptr<DBWrapper> db;
+    std::shared_ptr<Metrics> metrics;
+    std::shared_ptr<AdmissionController> admission;
+    IngestOptions options;
+    std::shared_ptr<IngestInFlight> in_flight;
+};
+
+}
+
+IngestOptions IngestOptions::from_config(const ConfigReader& config) {
+    IngestOptions options;
+    options.port = static_cast<unsigned short>(config.getInt("ingest", "port", options.port));
+    options.unix_socket = config.getString("ingest", "unix_socket", options.unix_socket);
+    options.window = static_cast<uint32_t>(
+        std::max(1, config.getInt("ingest", "window", static_cast<int>(options.window))));
+    options.max_frame_bytes = static_cast<uint32_t>(
+        config.getInt64("ingest", "max_frame_bytes", options.max_frame_bytes));
+    return options;
+}
+
+IngestServer::IngestServer(boost::asio::io_context& io_context, const IngestOptions& options,
+                           std::shared_ptr<DBWrapper> db, std::shared_ptr<Metrics> metrics,
+                           std::shared_ptr<AdmissionController> admission)
+    : io_context(io_context),
+      options(options),
+      db(std::move(db)),
+      metrics(std::move(metrics)),
+      admission(std::move(admission)),
+      in_flight(std::make_shared<IngestInFlight>()) {
+    if (options.port != 0) {
+        tcp_acceptor.reset(new boost::asio::ip::tcp::acceptor(
+            io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), options.port)));
+    }
+    if (!options.unix_socket.empty()) {
+        // A socket file left behind by an earlier run would fail the bind
+        ::unlink(options.unix_socket.c_str());
+        unix_acceptor.reset(new boost::asio::local::stream_protocol::acceptor(
+            io_context, boost::asio::local::stream_protocol::endpoint(options.unix_socket)));
+    }
+}
+
+IngestServer::~IngestServer() {
+    boost::system::error_code ignored;
+    if (tcp_acceptor) {
+        tcp_acceptor->close(ignored);
+    }
+    if (unix_acceptor) {
+        unix_acceptor->close(ignored);
+        ::unlink(options.unix_socket.c_str());
+    }
+    std::unique_lock<std::mutex> lock(in_flight->mutex);
+    in_flight->done.wait(lock, [this]() { return in_flight->writes == 0; });
+}
+
+void IngestServer::start() {
+    if (tcp_acceptor) {
+        do_accept_tcp();
+    }
+    if (unix_acceptor) {
+        do_accept_unix();
+    }
+}
+
+void IngestServer::do_accept_tcp() {
+    using tcp = boost::asio::ip::tcp;
+    tcp_acceptor->async_accept(boost::asio::make_strand(io_context),
+        [this](const boost::system::error_code& ec, tcp::socket socket) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (ec) {
+                LOG_ERROR("Ingest accept error: " << ec.message());
+            } else {
+                boost::system::error_code ignored;
+                socket.set_option(tcp::no_delay(true), ignored);
+                std::make_shared<IngestConnection<tcp>>(std::move(socket), db, metrics, admission, options, in_flight)->start();
+            }
+            do_accept_tcp();
+        });
+}
+
+void IngestServer::do_accept_unix() {
+    using local = boost::asio::local::stream_protocol;
+    unix_acceptor->async_accept(boost::asio::make_strand(io_context),
+        [this](const boost::system::error_code& ec, local::socket socket) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (ec) {
+                LOG_ERROR("Ingest accept error: " << ec.message());
+            } else {
+                std::make_shared<IngestConnection<local>>(std::move(socket), db, metrics, admission, options, in_flight)->start();
+            }
+            do_accept_unix();
+        });
+}
@@ -0,0 +1,79 @@
+#ifndef INGEST_SERVER_H
+#define INGEST_SERVER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <boost/asio.hpp>
+#include "admission.h"
+#include "config_reader.h"
+#include "db_wrapper.h"
+#include "metrics.h"
+
+struct IngestOptions {
+    unsigned short port = 54322;  // 0 = no TCP listener
+    std::string unix_socket;      // empty = no Unix socket listener
+    uint32_t window = 64;         // RECORDS frames a connection may have unacknowledged
+    uint32_t max_frame_bytes = 16 * 1024 * 1024;
+
+    static IngestOptions from_config(const ConfigReader& config);
+};
+
+// Writes still owed an acknowledgement, across all connections
+struct IngestInFlight {
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t writes = 0;
+};
+
+// Listener for the binary streaming ingest protocol: persistent connections
+// carrying length-prefixed frames of MessagePack records, acknowledged by
+// sequence number, with up to `window` frames in flight per connection.
+// Records go to the group commit writer without passing through JSON, and
+// every frame read in one go is queued at once so they share a commit.
+// Runs on the HTTP server's io_context and threads. While the storage is
+// stalled, frames are left unread rather than rejected.
+//
+// Frame: <u32 big-endian length of what follows><u8 type><payload>
+//   0x01 HELLO   (server)  <u16 version><u32 window><u32 max_frame_bytes>
+//   0x10 RECORDS (client)  <u64 seq><u8 durability: 0 memory, 1 wal, 2 sync><varint count>
+//                          count x <varint zigzag timestamp, 0 = now><varint length><reference>
+//                                  <varint length><MessagePack metadata>
+//   0x20 ACK     (server)  <u64 seq><varint count><bitmap, bit i set when record i was inserted>
+//                          <bitmap, bit i set when record i was past retention> (version 2)
+//   0x21 ERROR   (server)  <u64 seq><message>
+// Timestamps are milliseconds since the epoch within the years 0000-9999
+// (PartitionSet::MIN_TIMESTAMP to MAX_TIMESTAMP); anything else makes the
+// record invalid. Replies go out in the order the frames came in. A frame
+// with an invalid record is rejected whole with ERROR; a framing error gets ERROR with
+// seq 0 and the connection is closed.
+class IngestServer {
+public:
+    static const uint16_t PROTOCOL_VERSION = 2;
+
+    IngestServer(boost::asio::io_context& io_context, const IngestOptions& options, std::shared_ptr<DBWrapper> db,
+                 std::shared_ptr<Metrics> metrics, std::shared_ptr<AdmissionController> admission);
+    // Stops accepting and waits for queued writes to report back, so none
+    // of them outlives the io_context
+    ~IngestServer();
+
+    void start();
+
+private:
+    void do_accept_tcp();
+    void do_accept_unix();
+
+    boost::asio::io_context& io_context;
+    IngestOptions options;
+    std::shared_ptr<DBWrapper> db;
+    std::shared_ptr<Metrics> metrics;
+    std::shared_ptr<AdmissionController> admission;
+    std::shared_ptr<IngestInFlight> in_flight;
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> tcp_acceptor;
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> unix_acceptor;
+};
+
+#endif // INGEST_SERVER_H
@@ -0,0 +1,293 @@
+#include "json_writer.h"
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <nlohmann/json.hpp>
+
+namespace {
+
+// Deeper nesting than this is rejected rather than risking the stack
+const int MAX_DEPTH = 512;
+
+void need(const char* p, const char* limit, size_t n) {
+    if (static_cast<size_t>(limit - p) < n) {
+        throw std::runtime_error("Truncated MessagePack value");
+    }
+}
+
+uint64_t read_be(const char*& p, const char* limit, size_t n) {
+    need(p, limit, n);
+    uint64_t value = 0;
+    for (size_t i = 0; i < n; ++i) {
+        value = (value << 8) | static_cast<unsigned char>(p[i]);
+    }
+    p += n;
+    return value;
+}
+
+void append_string(std::string& out, const char*& p, const char* limit, size_t length) {
+    need(p, limit, length);
+    append_json_string(out, std::string_view(p, length));
+    p += length;
+}
+
+// Floats are rare in metadata; letting the library format them keeps the
+// output identical to dump()
+void append_double(std::string& out, double value) {
+    out += nlohmann::json(value).dump();
+}
+
+void append_value(std::string& out, const char*& p, const char* limit, int depth);
+
+void append_array(std::string& out, const char*& p, const char* limit, uint64_t size, int depth) {
+    out += '[';
+    for (uint64_t i = 0; i < size; ++i) {
+        if (i > 0) {
+            out += ',';
+        }
+        append_value(out, p, limit, depth + 1);
+    }
+    out += ']';
+}
+
+void append_map(std::string& out, const char*& p, const char* limit, uint64_t size, int depth) {
+    out += '{';
+    for (uint64_t i = 0; i < size; ++i) {
+        if (i > 0) {
+            out += ',';
+        }
+        need(p, limit, 1);
+        unsigned char key_type = static_cast<unsigned char>(*p);
+        if (!((key_type >= 0xa0 && key_type <= 0xbf) || (key_type >= 0xd9 && key_type <= 0xdb))) {
+            throw std::runtime_error("MessagePack map keys must be strings");
+        }
+        append_value(out, p, limit, depth + 1);
+        out += ':';
+        append_value(out, p, limit, depth + 1);
+    }
+    out += '}';
+}
+
+void append_value(std::string& out, const char*& p, const char* limit, int depth) {
+    if (depth > MAX_DEPTH) {
+        throw std::runtime_error("MessagePack value nested too deeply");
+    }
+    need(p, limit, 1);
+    unsigned char type = static_cast<unsigned char>(*p++);
+
+    if (type <= 0x7f) {
+        out += std::to_string(type);
+    } else if (type <= 0x8f) {
+        append_map(out, p, limit, type & 0x0f, depth);
+    } else if (type <= 0x9f) {
+        append_array(out, p, limit, type & 0x0f, depth);
+    } else if (type <= 0xbf) {
+        append_string(out, p, limit, type & 0x1f);
+    } else if (type >= 0xe0) {
+        out += std::to_string(static_cast<int8_t>(type));
+    } else {
+        switch (type) {
+            case 0xc0: out += "null"; break;
+            case 0xc2: out += "false"; break;
+            case 0xc3: out += "true"; break;
+            case 0xca: {
+                uint32_t bits = static_cast<uint32_t>(read_be(p, limit, 4));
+                float value;
+                std::memcpy(&value, &bits, sizeof(value));
+                append_double(out, value);
+                break;
+            }
+            case 0xcb: {
+                uint64_t bits = read_be(p, limit, 8);
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                append_double(out, value);
+                break;
+            }
+            case 0xcc: out += std::to_string(read_be(p, limit, 1)); break;
+            case 0xcd: out += std::to_string(read_be(p, limit, 2)); break;
+            case 0xce: out += std::to_string(read_be(p, limit, 4)); break;
+            case 0xcf: out += std::to_string(read_be(p, limit, 8)); break;
+            case 0xd0: out += std::to_string(static_cast<int8_t>(read_be(p, limit, 1))); break;
+            case 0xd1: out += std::to_string(static_cast<int16_t>(read_be(p, limit, 2))); break;
+            case 0xd2: out += std::to_string(static_cast<int32_t>(read_be(p, limit, 4))); break;
+            case 0xd3: out += std::to_string(static_cast<int64_t>(read_be(p, limit, 8))); break;
+            case 0xd9: append_string(out, p, limit, read_be(p, limit, 1)); break;
+            case 0xda: append_string(out, p, limit, read_be(p, limit, 2)); break;
+            case 0xdb: append_string(out, p, limit, read_be(p, limit, 4)); break;
+            case 0xdc: append_array(out, p, limit, read_be(p, limit, 2), depth); break;
+            case 0xdd: append_array(out, p, limit, read_be(p, limit, 4), depth); break;
+            case 0xde: append_map(out, p, limit, read_be(p, limit, 2), depth); break;
+            case 0xdf: append_map(out, p, limit, read_be(p, limit, 4), depth); break;
+            default:
+                throw std::runtime_error("Unsupported MessagePack type");
+        }
+    }
+}
+
+bool read_string(const char*& p, const char* limit, std::string_view& s);
+
+// Clears sorted_keys when a map's keys are not in strictly ascending order
+void skip_value(const char*& p, const char* limit, int depth, bool& sorted_keys) {
+    if (depth > MAX_DEPTH) {
+        throw std::runtime_error("MessagePack value nested too deeply");
+    }
+    need(p, limit, 1);
+    unsigned char type = static_cast<unsigned char>(*p++);
+
+    uint64_t length = 0;    // string bytes to skip
+    uint64_t children = 0;  // values to skip
+    if (type <= 0x7f || type >= 0xe0) {
+        return;
+    } else if (type <= 0x8f) {
+        children = 2 * (type & 0x0f);
+    } else if (type <= 0x9f) {
+        children = type & 0x0f;
+    } else if (type <= 0xbf) {
+        length = type & 0x1f;
+    } else {
+        switch (type) {
+            case 0xc0: case 0xc2: case 0xc3: return;
+            case 0xcc: case 0xd0: length = 1; break;
+            case 0xcd: case 0xd1: length = 2; break;
+            case 0xca: case 0xce: case 0xd2: length = 4; break;
+            case 0xcb: case 0xcf: case 0xd3: length = 8; break;
+            case 0xd9: length = read_be(p, limit, 1); break;
+            case 0xda: length = read_be(p, limit, 2); break;
+            case 0xdb: length = read_be(p, limit, 4); break;
+            case 0xdc: children = read_be(p, limit, 2); break;
+            case 0xdd: children = read_be(p, limit, 4); break;
+            case 0xde: children = 2 * read_be(p, limit, 2); break;
+            case 0xdf: children = 2 * read_be(p, limit, 4); break;
+            default:
+                throw std::runtime_error("Unsupported MessagePack type");
+        }
+    }
+    need(p, limit, length);
+    p += length;
+    bool map = (type >= 0x80 && type <= 0x8f) || type == 0xde || type == 0xdf;
+    std::string_view previous_key;
+    for (uint64_t i = 0; i < children; ++i) {
+        if (map && i % 2 == 0) {
+            std::string_view key;
+            if (!read_string(p, limit, key)) {
+                throw std::runtime_error("MessagePack map keys must be strings");
+            }
+            if (i > 0 && !(previous_key < key)) {
+                sorted_keys = false;
+            }
+            previous_key = key;
+            continue;
+        }
+        skip_value(p, limit, depth + 1, sorted_keys);
+    }
+}
+
+// Reads a string value, or returns false leaving p alone if it is not one
+bool read_string(const char*& p, const char* limit, std::string_view& s) {
+    need(p, limit, 1);
+    unsigned char type = static_cast<unsigned char>(*p);
+    const char* q = p + 1;
+    uint64_t length;
+    if (type >= 0xa0 && type <= 0xbf) {
+        length = type & 0x1f;
+    } else if (type == 0xd9) {
+        length = read_be(q, limit, 1);
+    } else if (type == 0xda) {
+        length = read_be(q, limit, 2);
+    } else if (type == 0xdb) {
+        length = read_be(q, limit, 4);
+    } else {
+        return false;
+    }
+    need(q, limit, length);
+    s = std::string_view(q, length);
+    p = q + length;
+    return true;
+}
+
+}
+
+bool skip_msgpack_value(const char*& p, const char* limit) {
+    bool sorted_keys = true;
+    skip_value(p, limit, 0, sorted_keys);
+    return sorted_keys;
+}
+
+void for_each_msgpack_field_text(std::string_view msgpack,
+                                 const std::function<void(std::string_view key, const std::string& text)>& field) {
+    const char* p = msgpack.data();
+    const char* limit = p + msgpack.size();
+    need(p, limit, 1);
+    unsigned char type = static_cast<unsigned char>(*p);
+    uint64_t size;
+    if (type >= 0x80 && type <= 0x8f) {
+        size = type & 0x0f;
+        ++p;
+    } else if (type == 0xde) {
+        ++p;
+        size = read_be(p, limit, 2);
+    } else if (type == 0xdf) {
+        ++p;
+        size = read_be(p, limit, 4);
+    } else {
+        return;
+    }
+
+    std::string text;
+    for (uint64_t i = 0; i < size; ++i) {
+        std::string_view key;
+        if (!read_string(p, limit, key)) {
+            throw std::runtime_error("MessagePack map keys must be strings");
+        }
+        need(p, limit, 1);
+        unsigned char value_type = static_cast<unsigned char>(*p);
+        std::string_view value;
+        if (read_string(p, limit, value)) {
+            text.assign(value.data(), value.size());
+            field(key, text);
+        } else if (value_type == 0xc0 || (value_type >= 0x80 && value_type <= 0x9f) ||
+                   (value_type >= 0xdc && value_type <= 0xdf)) {
+            bool sorted_keys;
+            skip_value(p, limit, 1, sorted_keys);  // null, arrays and maps are not indexed
+        } else {
+            text.clear();
+            append_value(text, p, limit, 1);
+            field(key, text);
+        }
+    }
+}
+
+void append_json_string(std::string& out, std::string_view s) {
+    static const char HEX[] = "0123456789abcdef";
+    out += '"';
+    size_t run_start = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(s.data() + run_start, i - run_start);
+        run_start = i + 1;
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                out += "\\u00";
+                out += HEX[c >> 4];
+                out += HEX[c & 0x0f];
+        }
+    }
+    out.append(s.data() + run_start, s.size() - run_start);
+    out += '"';
+}
+
+void append_msgpack_as_json(std::string& out, const char*& p, const char* limit) {
+    append_value(out, p, limit, 0);
+}
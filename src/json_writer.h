@@ -0,0 +1,30 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+// Appends s as a JSON string literal, escaped the way nlohmann::json::dump()
+// escapes it
+void append_json_string(std::string& out, std::string_view s);
+
+// Appends the MessagePack value starting at p as compact JSON text, the same
+// text nlohmann::json::from_msgpack(...).dump() would produce, without
+// building the json tree. Advances p past the value; throws on malformed or
+// unsupported (binary, extension) input.
+void append_msgpack_as_json(std::string& out, const char*& p, const char* limit);
+
+// Advances p past one MessagePack value, checking that it is well formed
+// and something append_msgpack_as_json can transcode. Returns whether the
+// keys of every map in it are unique and in the order nlohmann::json keeps
+// them (ascending bytes).
+bool skip_msgpack_value(const char*& p, const char* limit);
+
+// When the MessagePack value is a map, calls field(key, text) for each
+// entry holding a string, number or boolean, with the text
+// metadata_value_text() gives for the same value. Throws on malformed input.
+void for_each_msgpack_field_text(std::string_view msgpack,
+                                 const std::function<void(std::string_view key, const std::string& text)>& field);
+
+#endif // JSON_WRITER_H
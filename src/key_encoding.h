@@ -0,0 +1,115 @@
+#ifndef KEY_ENCODING_H
+#define KEY_ENCODING_H
+
+#include <string>
+#include <cstdint>
+#include <rocksdb/slice.h>
+#include "varint.h"
+
+// Fixed-width big-endian integers sort correctly under RocksDB's default
+// bytewise comparator, which is what makes range scans over them possible.
+inline void put_fixed64_be(std::string& dst, uint64_t value) {
+    char buf[8];
+    for (int i = 7; i >= 0; --i) {
+        buf[i] = static_cast<char>(value & 0xff);
+        value >>= 8;
+    }
+    dst.append(buf, sizeof(buf));
+}
+
+inline uint64_t decode_fixed64_be(const char* p) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return value;
+}
+
+// Timestamps are signed; flipping the sign bit keeps negative values ordered
+// before positive ones once encoded.
+inline void put_timestamp(std::string& dst, int64_t timestamp) {
+    put_fixed64_be(dst, static_cast<uint64_t>(timestamp) ^ (1ULL << 63));
+}
+
+inline int64_t decode_timestamp(const char* p) {
+    return static_cast<int64_t>(decode_fixed64_be(p) ^ (1ULL << 63));
+}
+
+// Time key: <8-byte big-endian timestamp><reference>. Orders logs by time;
+// it is the tail of every key in a partition and serves as scan position.
+inline std::string encode_time_key(int64_t timestamp, const std::string& reference) {
+    std::string key;
+    key.reserve(8 + reference.size());
+    put_timestamp(key, timestamp);
+    key.append(reference);
+    return key;
+}
+
+inline int64_t time_key_timestamp(const rocksdb::Slice& key) {
+    return decode_timestamp(key.data());
+}
+
+inline std::string time_key_reference(const rocksdb::Slice& key) {
+    return std::string(key.data() + 8, key.size() - 8);
+}
+
+// A partition holds both the records and the metadata index entries of its
+// day; a tag byte keeps the two key spaces apart.
+const char RECORD_KEY_TAG = 'r';
+const char METADATA_INDEX_KEY_TAG = 'i';
+
+// Record key: <'r'><time key>
+inline std::string encode_record_key(int64_t timestamp, const std::string& reference) {
+    return RECORD_KEY_TAG + encode_time_key(timestamp, reference);
+}
+
+// Metadata index key: <'i'><varint length><field><varint length><value><time key>
+// Length-prefixing makes the field/value prefix unambiguous, and the time key
+// at the end keeps the entries for one field/value pair ordered by timestamp.
+inline std::string encode_metadata_index_prefix(const std::string& field, const std::string& value) {
+    std::string prefix(1, METADATA_INDEX_KEY_TAG);
+    put_varint64(prefix, field.size());
+    prefix.append(field);
+    put_varint64(prefix, value.size());
+    prefix.append(value);
+    return prefix;
+}
+
+inline std::string encode_metadata_field_prefix(const std::string& field) {
+    std::string prefix(1, METADATA_INDEX_KEY_TAG);
+    put_varint64(prefix, field.size());
+    prefix.append(field);
+    return prefix;
+}
+
+// The default column family maps each reference to the timestamp of its log,
+// which names the partition holding the record
+inline std::string encode_locator(int64_t timestamp) {
+    std::string value;
+    put_timestamp(value, timestamp);
+    return value;
+}
+
+inline bool decode_locator(const rocksdb::Slice& value, int64_t& timestamp) {
+    if (value.size() != 8) {
+        return false;
+    }
+    timestamp = decode_timestamp(value.data());
+    return true;
+}
+
+// Smallest key greater than every key starting with prefix, or an empty
+// string if there is none (prefix is all 0xff bytes)
+inline std::string prefix_successor(std::string prefix) {
+    while (!prefix.empty()) {
+        unsigned char last = static_cast<unsigned char>(prefix.back());
+        if (last != 0xff) {
+            prefix.back() = static_cast<char>(last + 1);
+            return prefix;
+        }
+        prefix.pop_back();
+    }
+    return prefix;
+}
+
+#endif // KEY_ENCODING_H
@@ -0,0 +1,478 @@
+// End-to-end load generator: drives a running server over keep-alive HTTP
+// connections with a weighted mix of requests and reports latency
+// percentiles per request type.
+//
+// With --rate the load is open-loop: every connection sends on a fixed
+// schedule, and latency is measured from when a request was due rather than
+// when it was sent, so a stalled server cannot hide its stalls by slowing the
+// client down (coordinated omission).
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <nlohmann/json.hpp>
+#include "metrics.h"
+
+using boost::asio::ip::tcp;
+using json = nlohmann::json;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum RequestType { INSERT, BATCH_INSERT, QUERY_BY_REFERENCE, QUERY, REQUEST_TYPE_COUNT };
+const char* const REQUEST_NAMES[] = { "insert", "batch_insert", "query_by_reference", "query" };
+
+const double REPORTED_QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+// References remembered per connection for query_by_reference
+const size_t MAX_KNOWN_REFERENCES = 10000;
+
+struct LoadOptions {
+    std::string host = "127.0.0.1";
+    std::string port = "54321";
+    size_t connections = 64;
+    size_t threads = 2;
+    double rate = 0;  // requests per second over all connections; 0 = closed loop
+    double duration_s = 10;
+    size_t batch_size = 100;
+    size_t value_size = 128;
+    size_t query_limit = 100;
+    std::array<unsigned, REQUEST_TYPE_COUNT> weights = { 50, 10, 30, 10 };
+    std::string json_path;
+};
+
+struct Stats {
+    std::array<Histogram, REQUEST_TYPE_COUNT> latency;
+    std::array<Counter, REQUEST_TYPE_COUNT> errors;
+    Counter connection_errors;
+    Counter bytes_in;
+    Counter bytes_out;
+};
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// One keep-alive connection with a single request in flight at a time
+class ClientConnection : public std::enable_shared_from_this<ClientConnection> {
+public:
+    ClientConnection(boost::asio::io_context& io_context, const LoadOptions& options, Stats& stats,
+                     size_t index, const std::string& run_id, Clock::time_point start, Clock::time_point end)
+        : socket(boost::asio::make_strand(io_context)),
+          timer(socket.get_executor()),
+          options(options),
+          stats(stats),
+          gen(index + 1),
+          pick(options.weights.begin(), options.weights.end()),
+          reference_prefix("lg-" + run_id + "-" + std::to_string(index) + "-"),
+          start(start),
+          end(end) {
+        if (options.rate > 0) {
+            // Connections take turns, so the combined schedule is evenly spaced
+            auto period = std::chrono::duration<double>(1.0 / options.rate);
+            interval = std::chrono::duration_cast<Clock::duration>(period * static_cast<double>(options.connections));
+            this->start += std::chrono::duration_cast<Clock::duration>(period * static_cast<double>(index));
+        }
+    }
+
+    void run(const tcp::resolver::results_type& endpoints) {
+        auto self = shared_from_this();
+        boost::asio::async_connect(socket, endpoints,
+            [this, self](const boost::system::error_code& ec, const tcp::endpoint&) {
+                if (ec) {
+                    fail(ec);
+                    return;
+                }
+                socket.set_option(tcp::no_delay(true));
+                schedule_next();
+            });
+    }
+
+private:
+    void schedule_next() {
+        Clock::time_point due = options.rate > 0 ? start + interval * static_cast<long>(sent) : Clock::now();
+        if (due >= end || Clock::now() >= end) {
+            close();
+            return;
+        }
+        if (due <= Clock::now()) {
+            send(due);
+            return;
+        }
+        timer.expires_at(due);
+        auto self = shared_from_this();
+        timer.async_wait([this, self, due](const boost::system::error_code& ec) {
+            if (!ec) {
+                send(due);
+            }
+        });
+    }
+
+    void send(Clock::time_point due) {
+        ++sent;
+        type = static_cast<RequestType>(pick(gen));
+        std::string body = build_body();
+        request = "POST / HTTP/1.1\r\nHost: " + options.host +
+                  "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size()) +
+                  "\r\n\r\n" + body;
+        // Closed loop has no schedule; latency then starts at the send
+        request_start = options.rate > 0 ? due : Clock::now();
+
+        auto self = shared_from_this();
+        boost::asio::async_write(socket, boost::asio::buffer(request),
+            [this, self](const boost::system::error_code& ec, size_t bytes_transferred) {
+                if (ec) {
+                    fail(ec);
+                    return;
+                }
+                stats.bytes_out.add(bytes_transferred);
+                read_header();
+            });
+    }
+
+    std::string build_body() {
+        switch (type) {
+            case INSERT: {
+                pending_reference = next_reference();
+                return json{{"action", "insert"}, {"reference", pending_reference}, {"metadata", make_metadata()}}.dump();
+            }
+            case BATCH_INSERT: {
+                json logs = json::array();
+                for (size_t i = 0; i < options.batch_size; ++i) {
+                    logs.push_back({{"reference", next_reference()}, {"metadata", make_metadata()}});
+                }
+                return json{{"action", "batch_insert"}, {"logs", logs}}.dump();
+            }
+            case QUERY_BY_REFERENCE: {
+                std::string reference = known_references.empty()
+                    ? reference_prefix + "missing"
+                    : known_references[gen() % known_references.size()];
+                return json{{"action", "query_by_reference"}, {"reference", reference}}.dump();
+            }
+            default:
+                return json{{"action", "query"}, {"start_timestamp", now_ms() - 60000},
+                            {"limit", options.query_limit}}.dump();
+        }
+    }
+
+    std::string next_reference() {
+        return reference_prefix + std::to_string(next_id++);
+    }
+
+    json make_metadata() {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+        std::string payload(options.value_size, ' ');
+        for (auto& c : payload) {
+            c = alphabet[gen() % (sizeof(alphabet) - 1)];
+        }
+        return {{"event", "Event" + std::to_string(gen() % 5)}, {"user_id", std::to_string(gen() % 10000)},
+                {"payload", payload}};
+    }
+
+    void read_header() {
+        auto self = shared_from_this();
+        boost::asio::async_read_until(socket, response_buffer, "\r\n\r\n",
+            [this, self](const boost::system::error_code& ec, size_t header_bytes) {
+                if (ec) {
+                    fail(ec);
+                    return;
+                }
+                std::string header(boost::asio::buffers_begin(response_buffer.data()),
+                                   boost::asio::buffers_begin(response_buffer.data()) + header_bytes);
+                response_buffer.consume(header_bytes);
+                stats.bytes_in.add(header_bytes);
+
+                status_code = header.size() > 12 ? std::atoi(header.c_str() + 9) : 0;
+                size_t content_length = 0;
+                std::istringstream lines(header);
+                std::string line;
+                while (std::getline(lines, line)) {
+                    std::string name = line.substr(0, line.find(':'));
+                    for (auto& c : name) {
+                        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                    }
+                    if (name == "content-length") {
+                        content_length = std::stoul(line.substr(line.find(':') + 1));
+                    }
+                }
+
+                if (response_buffer.size() >= content_length) {
+                    finish(content_length);
+                    return;
+                }
+                boost::asio::async_read(socket, response_buffer,
+                    boost::asio::transfer_exactly(content_length - response_buffer.size()),
+                    [this, self, content_length](const boost::system::error_code& ec, size_t) {
+                        if (ec) {
+                            fail(ec);
+                            return;
+                        }
+                        finish(content_length);
+                    });
+            });
+    }
+
+    void finish(size_t content_length) {
+        stats.latency[type].record(std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - request_start).count());
+        stats.bytes_in.add(content_length);
+        response_buffer.consume(content_length);
+
+        if (status_code != 200) {
+            stats.errors[type].add();
+        } else if (type == INSERT) {
+            if (known_references.size() < MAX_KNOWN_REFERENCES) {
+                known_references.push_back(pending_reference);
+            } else {
+                known_references[gen() % MAX_KNOWN_REFERENCES] = pending_reference;
+            }
+        }
+        schedule_next();
+    }
+
+    void fail(const boost::system::error_code& ec) {
+        std::cerr << "Connection error: " << ec.message() << std::endl;
+        stats.connection_errors.add();
+        if (sent > 0) {
+            stats.errors[type].add();
+        }
+        close();
+    }
+
+    void close() {
+        boost::system::error_code ignored;
+        timer.cancel();
+        socket.shutdown(tcp::socket::shutdown_both, ignored);
+        socket.close(ignored);
+    }
+
+    tcp::socket socket;
+    boost::asio::steady_timer timer;
+    const LoadOptions& options;
+    Stats& stats;
+    std::mt19937_64 gen;
+    std::discrete_distribution<int> pick;
+    std::string reference_prefix;
+    size_t next_id = 0;
+    std::vector<std::string> known_references;
+    std::string pending_reference;
+
+    Clock::time_point start;
+    Clock::time_point end;
+    Clock::duration interval{0};
+    size_t sent = 0;
+
+    RequestType type = INSERT;
+    std::string request;
+    Clock::time_point request_start;
+    boost::asio::streambuf response_buffer;
+    int status_code = 0;
+};
+
+json report(const LoadOptions& options, Stats& stats, double seconds) {
+    json requests = json::object();
+    uint64_t total = 0;
+    for (size_t t = 0; t < REQUEST_TYPE_COUNT; ++t) {
+        Histogram::Snapshot latency = stats.latency[t].snapshot();
+        if (latency.count == 0) {
+            continue;
+        }
+        total += latency.count;
+        json entry = {
+            {"requests", latency.count},
+            {"errors", stats.errors[t].value()},
+            {"requests_per_sec", latency.count / seconds},
+            {"mean_us", static_cast<double>(latency.sum) / latency.count}
+        };
+        for (double q : REPORTED_QUANTILES) {
+            std::ostringstream name;
+            name << "p" << q * 100 << "_us";
+            entry[name.str()] = latency.quantile(q);
+        }
+        entry["max_us"] = latency.quantile(1.0);
+        requests[REQUEST_NAMES[t]] = entry;
+    }
+
+    return {
+        {"options", {
+            {"connections", options.connections},
+            {"threads", options.threads},
+            {"rate", options.rate},
+            {"duration_s", options.duration_s},
+            {"batch_size", options.batch_size},
+            {"value_size", options.value_size},
+            {"query_limit", options.query_limit},
+            {"mix", {{"insert", options.weights[INSERT]}, {"batch_insert", options.weights[BATCH_INSERT]},
+                     {"query_by_reference", options.weights[QUERY_BY_REFERENCE]}, {"query", options.weights[QUERY]}}}
+        }},
+        {"seconds", seconds},
+        {"requests", total},
+        {"requests_per_sec", total / seconds},
+        {"connection_errors", stats.connection_errors.value()},
+        {"bytes_in", stats.bytes_in.value()},
+        {"bytes_out", stats.bytes_out.value()},
+        {"by_type", requests}
+    };
+}
+
+void print_report(const json& results) {
+    std::cout << std::fixed << std::setprecision(0)
+              << "\n" << results["requests"].get<uint64_t>() << " requests in " << std::setprecision(2)
+              << results["seconds"].get<double>() << " s, " << std::setprecision(0)
+              << results["requests_per_sec"].get<double>() << " req/s, "
+              << results["connection_errors"].get<uint64_t>() << " connection errors\n";
+    std::cout << std::left << std::setw(20) << "request" << std::right
+              << std::setw(10) << "req/s" << std::setw(10) << "p50 us" << std::setw(10) << "p90 us"
+              << std::setw(10) << "p99 us" << std::setw(10) << "p99.9 us" << std::setw(10) << "max us"
+              << std::setw(8) << "errors" << "\n";
+    for (const auto& entry : results["by_type"].items()) {
+        const auto& stats = entry.value();
+        std::cout << std::left << std::setw(20) << entry.key() << std::right
+                  << std::setw(10) << stats["requests_per_sec"].get<double>()
+                  << std::setw(10) << stats["p50_us"].get<double>()
+                  << std::setw(10) << stats["p90_us"].get<double>()
+                  << std::setw(10) << stats["p99_us"].get<double>()
+                  << std::setw(10) << stats["p99.9_us"].get<double>()
+                  << std::setw(10) << stats["max_us"].get<double>()
+                  << std::setw(8) << stats["errors"].get<uint64_t>() << "\n";
+    }
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --host HOST           server address (default 127.0.0.1)\n"
+              << "  --port PORT           server port (default 54321)\n"
+              << "  --connections N       keep-alive connections (default 64)\n"
+              << "  --threads N           client I/O threads (default 2)\n"
+              << "  --rate R              requests per second, open loop; 0 = closed loop (default 0)\n"
+              << "  --duration S          seconds to run (default 10)\n"
+              << "  --mix insert=50,batch_insert=10,query_by_reference=30,query=10\n"
+              << "                        request weights\n"
+              << "  --batch-size N        logs per batch_insert (default 100)\n"
+              << "  --value-size BYTES    payload bytes per log (default 128)\n"
+              << "  --query-limit N       logs per query page (default 100)\n"
+              << "  --json PATH           write results as JSON (- for stdout)\n";
+}
+
+void parse_mix(const std::string& text, LoadOptions& options) {
+    options.weights.fill(0);
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            throw std::runtime_error("Invalid mix entry: " + item);
+        }
+        std::string name = item.substr(0, eq);
+        size_t t = 0;
+        while (t < REQUEST_TYPE_COUNT && name != REQUEST_NAMES[t]) {
+            ++t;
+        }
+        if (t == REQUEST_TYPE_COUNT) {
+            throw std::runtime_error("Unknown request type in mix: " + name);
+        }
+        options.weights[t] = std::stoul(item.substr(eq + 1));
+    }
+    unsigned total = 0;
+    for (unsigned weight : options.weights) {
+        total += weight;
+    }
+    if (total == 0) {
+        throw std::runtime_error("Mix has no requests");
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    LoadOptions options;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                print_usage(argv[0]);
+                return 0;
+            }
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for " + arg);
+            }
+            std::string value = argv[++i];
+            if (arg == "--host") options.host = value;
+            else if (arg == "--port") options.port = value;
+            else if (arg == "--connections") options.connections = std::stoul(value);
+            else if (arg == "--threads") options.threads = std::stoul(value);
+            else if (arg == "--rate") options.rate = std::stod(value);
+            else if (arg == "--duration") options.duration_s = std::stod(value);
+            else if (arg == "--mix") parse_mix(value, options);
+            else if (arg == "--batch-size") options.batch_size = std::stoul(value);
+            else if (arg == "--value-size") options.value_size = std::stoul(value);
+            else if (arg == "--query-limit") options.query_limit = std::stoul(value);
+            else if (arg == "--json") options.json_path = value;
+            else throw std::runtime_error("Unknown option: " + arg);
+        }
+        if (options.connections == 0 || options.threads == 0) {
+            throw std::runtime_error("--connections and --threads must be positive");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        boost::asio::io_context io_context;
+        tcp::resolver resolver(io_context);
+        tcp::resolver::results_type endpoints = resolver.resolve(options.host, options.port);
+
+        Stats stats;
+        std::string run_id = std::to_string(now_ms());
+        auto start = Clock::now();
+        auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration_s));
+
+        std::cout << "Running " << options.connections << " connections for " << options.duration_s << " s"
+                  << (options.rate > 0 ? " at " + std::to_string(static_cast<long>(options.rate)) + " req/s" : std::string(", closed loop"))
+                  << std::endl;
+        for (size_t i = 0; i < options.connections; ++i) {
+            std::make_shared<ClientConnection>(io_context, options, stats, i, run_id, start, end)->run(endpoints);
+        }
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < options.threads; ++i) {
+            workers.emplace_back([&io_context]() { io_context.run(); });
+        }
+        io_context.run();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        json results = report(options, stats, seconds);
+        print_report(results);
+
+        if (options.json_path == "-") {
+            std::cout << results.dump(2) << std::endl;
+        } else if (!options.json_path.empty()) {
+            std::ofstream out(options.json_path);
+            if (!out) {
+                throw std::runtime_error("Cannot write " + options.json_path);
+            }
+            out << results.dump(2) << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
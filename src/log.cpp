@@ -1,5 +1,8 @@
 #include "log.h"
 #include <chrono>
+#include <stdexcept>
+#include "json_writer.h"
+#include "varint.h"
 
 Log::Log(std::string reference, nlohmann::json metadata, int64_t timestamp)
     : m_reference(std::move(reference)), m_metadata(std::move(metadata)) {
@@ -11,20 +14,106 @@ Log::Log(std::string reference, nlohmann::json metadata, int64_t timestamp)
     }
 }
 
-std::string Log::reference() const { return m_reference; }
-nlohmann::json Log::metadata() const { return m_metadata; }
-int64_t Log::timestamp() const { return m_timestamp; }
+void Log::append_json(std::string& out) const {
+    out += "{\"metadata\":";
+    out += m_metadata.dump();
+    out += ",\"reference\":";
+    append_json_string(out, m_reference);
+    out += ",\"timestamp\":";
+    out += std::to_string(m_timestamp);
+    out += '}';
+}
 
 std::string Log::serialize() const {
-    nlohmann::json j = {
-        {"reference", m_reference},
-        {"metadata", m_metadata},
-        {"timestamp", m_timestamp}
-    };
-    return j.dump();
-}
-
-Log Log::deserialize(const std::string& data) {
-    nlohmann::json j = nlohmann::json::parse(data);
-    return Log(j["reference"], j["metadata"], j["timestamp"]);
-}
\ No newline at end of file
+    std::string data;
+    data.reserve(16 + m_reference.size());
+    data.push_back(static_cast<char>(FORMAT_VERSION));
+    put_varint64(data, zigzag_encode(m_timestamp));
+    put_varint64(data, m_reference.size());
+    data.append(m_reference);
+    nlohmann::json::to_msgpack(m_metadata, data);
+    return data;
+}
+
+std::string Log::encode_record(int64_t timestamp, std::string_view reference, std::string_view msgpack_metadata) {
+    std::string data;
+    data.reserve(21 + reference.size() + msgpack_metadata.size());
+    data.push_back(static_cast<char>(FORMAT_VERSION));
+    put_varint64(data, zigzag_encode(timestamp));
+    put_varint64(data, reference.size());
+    data.append(reference);
+    data.append(msgpack_metadata);
+    return data;
+}
+
+namespace {
+
+// Splits a binary record into its timestamp, reference and MessagePack
+// metadata, which is left at p
+void read_record_header(std::string_view data, const char*& p, int64_t& timestamp, std::string_view& reference) {
+    if (data.empty() || static_cast<uint8_t>(data[0]) != Log::FORMAT_VERSION) {
+        throw std::runtime_error("Unknown log record format");
+    }
+
+    p = data.data() + 1;
+    const char* limit = data.data() + data.size();
+    uint64_t encoded_timestamp = 0;
+    uint64_t reference_length = 0;
+    if (!get_varint64(p, limit, encoded_timestamp) || !get_varint64(p, limit, reference_length) ||
+        reference_length > static_cast<uint64_t>(limit - p)) {
+        throw std::runtime_error("Truncated log record");
+    }
+    timestamp = zigzag_decode(encoded_timestamp);
+    reference = std::string_view(p, reference_length);
+    p += reference_length;
+}
+
+}
+
+Log Log::deserialize(std::string_view data) {
+    if (is_legacy_format(data)) {
+        nlohmann::json j = nlohmann::json::parse(data.begin(), data.end());
+        return Log(j["reference"], j["metadata"], j["timestamp"]);
+    }
+
+    const char* p;
+    int64_t timestamp;
+    std::string_view reference;
+    read_record_header(data, p, timestamp, reference);
+    return Log(std::string(reference), nlohmann::json::from_msgpack(p, data.data() + data.size()), timestamp);
+}
+
+void Log::append_record_json(std::string_view data, std::string& out) {
+    if (is_legacy_format(data)) {
+        deserialize(data).append_json(out);
+        return;
+    }
+
+    const char* p;
+    int64_t timestamp;
+    std::string_view reference;
+    read_record_header(data, p, timestamp, reference);
+    const char* limit = data.data() + data.size();
+    out += "{\"metadata\":";
+    append_msgpack_as_json(out, p, limit);
+    if (p != limit) {
+        throw std::runtime_error("Trailing bytes in log record");
+    }
+    out += ",\"reference\":";
+    append_json_string(out, reference);
+    out += ",\"timestamp\":";
+    out += std::to_string(timestamp);
+    out += '}';
+}
+
+std::string_view Log::record_metadata(std::string_view data) {
+    const char* p;
+    int64_t timestamp;
+    std::string_view reference;
+    read_record_header(data, p, timestamp, reference);
+    return std::string_view(p, data.data() + data.size() - p);
+}
+
+bool Log::is_legacy_format(std::string_view data) {
+    return !data.empty() && data[0] == '{';
+}
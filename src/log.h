@@ -2,19 +2,43 @@
 #define LOG_H
 
 #include <string>
+#include <string_view>
 #include <cstdint>
+#include <utility>
+#include <vector>
 #include <nlohmann/json.hpp>
 
 class Log {
 public:
+    // First byte of every record written by serialize(). Records written
+    // before the binary format are JSON text and always start with '{'.
+    static constexpr uint8_t FORMAT_VERSION = 1;
+
     Log(std::string reference, nlohmann::json metadata, int64_t timestamp = 0);
 
-    std::string reference() const;
-    nlohmann::json metadata() const;
-    int64_t timestamp() const;
+    const std::string& reference() const { return m_reference; }
+    const nlohmann::json& metadata() const { return m_metadata; }
+    int64_t timestamp() const { return m_timestamp; }
+
+    // Appends {"metadata":...,"reference":...,"timestamp":...} as compact JSON
+    void append_json(std::string& out) const;
 
+    // Binary record layout:
+    //   <version byte><varint zigzag timestamp><varint length><reference><MessagePack metadata>
     std::string serialize() const;
-    static Log deserialize(const std::string& data);
+    // Same layout from metadata that is already MessagePack
+    static std::string encode_record(int64_t timestamp, std::string_view reference,
+                                     std::string_view msgpack_metadata);
+    // Reads both the binary format and legacy JSON records
+    static Log deserialize(std::string_view data);
+
+    static bool is_legacy_format(std::string_view data);
+
+    // Same JSON as append_json, written straight from a stored record: the
+    // metadata is transcoded from MessagePack without building a json tree
+    static void append_record_json(std::string_view data, std::string& out);
+    // MessagePack metadata of a record in the binary format
+    static std::string_view record_metadata(std::string_view data);
 
 private:
     std::string m_reference;
@@ -22,4 +46,17 @@ private:
     int64_t m_timestamp;
 };
 
-#endif // LOG_H
\ No newline at end of file
+// A log in its stored form, as the write path takes it: serialized, with
+// the text of its indexed metadata fields already extracted, so the commit
+// does not need to look at the metadata again
+struct LogRecord {
+    std::string reference;
+    int64_t timestamp = 0;
+    std::string data;  // Log::serialize() layout; moved out once committed
+    // Indexed field -> value text, for the fields the log has
+    std::vector<std::pair<std::string, std::string>> index_values;
+    // Sketched field (or group_by field) -> value text, likewise
+    std::vector<std::pair<std::string, std::string>> sketch_values;
+};
+
+#endif // LOG_H
@@ -0,0 +1,253 @@
+#include "log_scanner.h"
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include "key_encoding.h"
+#include "logger.h"
+#include "prefix_cursor.h"
+
+namespace {
+
+const size_t MULTIGET_BATCH_SIZE = 256;
+
+std::string_view to_string_view(const rocksdb::Slice& slice) {
+    return std::string_view(slice.data(), slice.size());
+}
+
+class QueryScanner : public LogScanner {
+public:
+    QueryScanner(rocksdb::DB* db, std::vector<PartitionSet::Partition> partitions,
+                 const std::set<std::string>& indexed_fields, const LogQuery& query, const std::string& after_key,
+                 SharedSnapshot shared_snapshot)
+        : db(db), shared_snapshot(shared_snapshot ? std::move(shared_snapshot) : make_shared_snapshot(db)),
+          partitions(std::move(partitions)), query(query), after_key(after_key),
+          next_partition(0), exhausted(false) {
+        snapshot = this->shared_snapshot.get();
+        read_options.snapshot = snapshot;
+
+        // Filters on indexed fields become index cursors, the rest residual checks
+        for (const auto& filter : query.filters) {
+            if (indexed_fields.count(filter.first)) {
+                index_filters.push_back(filter);
+            } else {
+                residual_filters.push_back(filter);
+            }
+        }
+
+        // Days before the one the position is in are already done
+        if (after_key.size() >= 8) {
+            int64_t resume_day = PartitionSet::day_of(time_key_timestamp(after_key));
+            while (next_partition < this->partitions.size() && this->partitions[next_partition].first < resume_day) {
+                ++next_partition;
+            }
+        }
+    }
+
+    ~QueryScanner() override {
+        records.reset();
+        candidates.reset();
+    }
+
+    bool next(std::vector<Log>& out, size_t max_logs) override {
+        size_t added = 0;
+        if (peeked && max_logs > 0) {
+            out.push_back(std::move(*peeked));
+            peeked.reset();
+            last_key = std::move(peeked_key);
+            ++added;
+        }
+        added += read(out, max_logs - added);
+        if (added < max_logs) {
+            return false;
+        }
+        // Reads one log ahead, so that a page ending with the last matching
+        // log says there is no more instead of leading to an empty page
+        std::string position = last_key;
+        std::vector<Log> ahead;
+        if (read(ahead, 1) == 0) {
+            last_key = std::move(position);
+            return false;
+        }
+        peeked = std::move(ahead.front());
+        peeked_key = std::move(last_key);
+        last_key = std::move(position);
+        return true;
+    }
+
+private:
+    // Reads up to max_logs logs, fewer only once the scan is exhausted
+    size_t read(std::vector<Log>& out, size_t max_logs) {
+        size_t added = 0;
+        while (added < max_logs) {
+            if (!records && !candidates && !open_next_partition()) {
+                break;
+            }
+            added += records ? scan_records(out, max_logs - added) : scan_candidates(out, max_logs - added);
+        }
+        return added;
+    }
+
+    bool open_next_partition() {
+        if (next_partition == partitions.size()) {
+            return false;
+        }
+        current = partitions[next_partition++].second;
+
+        if (index_filters.empty()) {
+            records.reset(new PrefixCursor(db, snapshot, current.get(), std::string(1, RECORD_KEY_TAG),
+                query.start_timestamp, query.end_timestamp));
+            records->start(after_key);
+            return true;
+        }
+
+        std::vector<std::unique_ptr<PrefixCursor>> cursors;
+        for (const auto& filter : index_filters) {
+            cursors.emplace_back(new PrefixCursor(db, snapshot, current.get(),
+                encode_metadata_index_prefix(filter.first, filter.second),
+                query.start_timestamp, query.end_timestamp));
+            cursors.back()->start(after_key);
+        }
+        candidates.reset(new Intersection(std::move(cursors)));
+        exhausted = false;
+        return true;
+    }
+
+    // Without indexed filters the records of the partition are read in order
+    size_t scan_records(std::vector<Log>& out, size_t max_logs) {
+        size_t added = 0;
+        for (; records->valid() && added < max_logs; records->next()) {
+            last_key = records->suffix().ToString();
+            try {
+                Log log = Log::deserialize(to_string_view(records->value()));
+                if (!matches(log)) {
+                    continue;
+                }
+                out.push_back(std::move(log));
+                ++added;
+            } catch (const std::exception& e) {
+                LOG_ERROR("Error deserializing log: " << e.what());
+            }
+        }
+        if (!records->valid()) {
+            if (!records->status().ok()) {
+                throw std::runtime_error("Error iterating over logs: " + records->status().ToString());
+            }
+            records.reset();
+        }
+        return added;
+    }
+
+    // With indexed filters only the records the index intersection yields are read
+    size_t scan_candidates(std::vector<Log>& out, size_t max_logs) {
+        std::string suffix;
+        while (!exhausted && pending.size() < MULTIGET_BATCH_SIZE) {
+            if (candidates->next(suffix)) {
+                pending.push_back(std::move(suffix));
+            } else {
+                exhausted = true;
+            }
+        }
+        if (pending.empty()) {
+            candidates.reset();
+            return 0;
+        }
+
+        std::vector<std::string> record_keys;
+        for (const auto& candidate : pending) {
+            record_keys.push_back(RECORD_KEY_TAG + candidate);
+        }
+        // Batched MultiGet on one column family, pinning values in place
+        std::vector<rocksdb::Slice> keys(record_keys.begin(), record_keys.end());
+        std::vector<rocksdb::PinnableSlice> values(keys.size());
+        std::vector<rocksdb::Status> statuses(keys.size());
+        db->MultiGet(read_options, current.get(), keys.size(), keys.data(), values.data(), statuses.data());
+
+        // Candidates beyond max_logs stay pending for the next call
+        size_t added = 0;
+        size_t examined = 0;
+        for (; examined < pending.size() && added < max_logs; ++examined) {
+            last_key = pending[examined];
+            if (!statuses[examined].ok()) {
+                continue;
+            }
+            try {
+                Log log = Log::deserialize(to_string_view(values[examined]));
+                if (!matches(log)) {
+                    continue;
+                }
+                out.push_back(std::move(log));
+                ++added;
+            } catch (const std::exception& e) {
+                LOG_ERROR("Error deserializing log: " << e.what());
+            }
+        }
+        pending.erase(pending.begin(), pending.begin() + examined);
+        return added;
+    }
+
+    bool matches(const Log& log) const {
+        if (residual_filters.empty()) {
+            return true;
+        }
+        const nlohmann::json& metadata = log.metadata();
+        for (const auto& filter : residual_filters) {
+            auto field = metadata.find(filter.first);
+            std::string text;
+            if (field == metadata.end() || !metadata_value_text(*field, text) || text != filter.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    rocksdb::DB* db;
+    SharedSnapshot shared_snapshot;
+    const rocksdb::Snapshot* snapshot;
+    rocksdb::ReadOptions read_options;
+    std::vector<PartitionSet::Partition> partitions;
+    LogQuery query;
+    std::string after_key;
+    std::vector<std::pair<std::string, std::string>> index_filters;
+    std::vector<std::pair<std::string, std::string>> residual_filters;
+
+    // State of the partition being scanned: either records or candidates is set
+    size_t next_partition;
+    PartitionSet::Handle current;
+    std::unique_ptr<PrefixCursor> records;
+    std::unique_ptr<Intersection> candidates;
+    std::deque<std::string> pending;
+    bool exhausted;
+
+    // The log read ahead by the last call to next, and its time key
+    std::optional<Log> peeked;
+    std::string peeked_key;
+};
+
+}
+
+bool metadata_value_text(const nlohmann::json& value, std::string& text) {
+    if (value.is_string()) {
+        text = value.get<std::string>();
+        return true;
+    }
+    if (value.is_number() || value.is_boolean()) {
+        text = value.dump();
+        return true;
+    }
+    return false;
+}
+
+std::unique_ptr<LogScanner> make_query_scanner(rocksdb::DB* db,
+                                               std::vector<PartitionSet::Partition> partitions,
+                                               const std::set<std::string>& indexed_fields,
+                                               const LogQuery& query,
+                                               const std::string& after_key,
+                                               SharedSnapshot snapshot) {
+    return std::unique_ptr<LogScanner>(new QueryScanner(db, std::move(partitions), indexed_fields, query, after_key,
+                                                        std::move(snapshot)));
+}
+
+SharedSnapshot make_shared_snapshot(rocksdb::DB* db) {
+    return SharedSnapshot(db->GetSnapshot(), [db](const rocksdb::Snapshot* snapshot) { db->ReleaseSnapshot(snapshot); });
+}
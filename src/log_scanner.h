@@ -0,0 +1,63 @@
+#ifndef LOG_SCANNER_H
+#define LOG_SCANNER_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <rocksdb/db.h>
+#include "log.h"
+#include "partition_set.h"
+
+// Pulls logs out of the database a batch at a time so that callers never
+// need to hold a whole result set in memory. Reads from a snapshot taken
+// when the scanner was created.
+class LogScanner {
+public:
+    virtual ~LogScanner() = default;
+
+    // Appends up to max_logs logs to out. Returns false once the scan is
+    // exhausted.
+    virtual bool next(std::vector<Log>& out, size_t max_logs) = 0;
+
+    // Time key of the last log examined. Passing it as after_key to a new
+    // scan of the same kind resumes right after that log.
+    const std::string& position() const { return last_key; }
+
+protected:
+    std::string last_key;
+};
+
+// A time range plus equality filters on top-level metadata fields
+struct LogQuery {
+    int64_t start_timestamp = INT64_MIN;
+    int64_t end_timestamp = INT64_MAX;
+    // Field name -> required value, in the form given by metadata_value_text
+    std::map<std::string, std::string> filters;
+};
+
+// Text form under which metadata values are indexed and compared: strings
+// as they are, numbers and booleans as JSON. Returns false for values that
+// cannot be indexed (null, arrays, objects).
+bool metadata_value_text(const nlohmann::json& value, std::string& text);
+
+// Snapshot released once the last scanner reading from it is gone
+using SharedSnapshot = std::shared_ptr<const rocksdb::Snapshot>;
+SharedSnapshot make_shared_snapshot(rocksdb::DB* db);
+
+// Runs a LogQuery in timestamp order over the given partitions, which must
+// be sorted by day. Filters on indexed fields are answered by intersecting
+// their metadata index ranges in each partition, and only the records that
+// survive are read; without any, the partition's records are walked
+// directly. The remaining filters are checked against the records. Reads
+// from the given snapshot, or from a new one if none is given.
+std::unique_ptr<LogScanner> make_query_scanner(rocksdb::DB* db,
+                                               std::vector<PartitionSet::Partition> partitions,
+                                               const std::set<std::string>& indexed_fields,
+                                               const LogQuery& query,
+                                               const std::string& after_key,
+                                               SharedSnapshot snapshot = nullptr);
+
+#endif // LOG_SCANNER_H
@@ -0,0 +1,73 @@
+#include "log_tail.h"
+#include <algorithm>
+
+LogTail::LogTail(size_t slot_count, size_t max_readers)
+    : slots(std::max<size_t>(slot_count, 1)), published(0), published_logs(0), readers(0), max_readers(max_readers) {}
+
+void LogTail::publish(std::vector<Entry> entries) {
+    std::lock_guard<std::mutex> lock(publish_mutex);
+    uint64_t seq = published.load(std::memory_order_relaxed);
+    uint64_t first_log = published_logs.load(std::memory_order_relaxed);
+    auto batch = std::make_shared<Batch>();
+    batch->seq = seq;
+    batch->first_log = first_log;
+    batch->entries = std::move(entries);
+    size_t logs = batch->entries.size();
+
+    std::atomic_store_explicit(&slots[seq % slots.size()], std::shared_ptr<const Batch>(std::move(batch)),
+                               std::memory_order_release);
+    published_logs.store(first_log + logs, std::memory_order_relaxed);
+    published.store(seq + 1, std::memory_order_release);
+}
+
+std::unique_ptr<LogTail::Reader> LogTail::subscribe() {
+    size_t current = readers.load(std::memory_order_relaxed);
+    do {
+        if (current >= max_readers) {
+            return nullptr;
+        }
+    } while (!readers.compare_exchange_weak(current, current + 1, std::memory_order_relaxed));
+
+    // A batch being published right now may be missed or counted as skipped
+    uint64_t seq = published.load(std::memory_order_acquire);
+    return std::unique_ptr<Reader>(new Reader(*this, seq, published_logs.load(std::memory_order_relaxed)));
+}
+
+LogTail::Reader::Reader(LogTail& tail, uint64_t next_seq, uint64_t next_log)
+    : tail(tail), next_seq(next_seq), next_log(next_log) {}
+
+LogTail::Reader::~Reader() {
+    tail.readers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void LogTail::Reader::read(std::vector<std::shared_ptr<const Batch>>& batches, size_t max_batches,
+                           uint64_t& skipped_logs) {
+    const uint64_t capacity = tail.slots.size();
+    size_t taken = 0;
+    while (taken < max_batches) {
+        uint64_t head = tail.published.load(std::memory_order_acquire);
+        if (next_seq >= head) {
+            return;
+        }
+        // Fallen a whole ring behind: only the newest slots can still hold
+        // the batches they were written with
+        if (head - next_seq > capacity) {
+            next_seq = head - capacity;
+        }
+        std::shared_ptr<const Batch> batch =
+            std::atomic_load_explicit(&tail.slots[next_seq % capacity], std::memory_order_acquire);
+        if (!batch || batch->seq != next_seq) {
+            // Overwritten since head was read; look again from the new head
+            uint64_t newest = tail.published.load(std::memory_order_acquire);
+            next_seq = newest > capacity ? std::max(next_seq + 1, newest - capacity) : next_seq + 1;
+            continue;
+        }
+        if (batch->first_log > next_log) {
+            skipped_logs += batch->first_log - next_log;
+        }
+        next_log = batch->first_log + batch->entries.size();
+        ++next_seq;
+        batches.push_back(std::move(batch));
+        ++taken;
+    }
+}
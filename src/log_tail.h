@@ -0,0 +1,72 @@
+#ifndef LOG_TAIL_H
+#define LOG_TAIL_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Broadcast ring of freshly committed logs, for live tails. The group commit
+// writer publishes each committed group into the next slot and never waits
+// for readers: a reader more than a ring behind finds its slots overwritten,
+// skips ahead to the oldest group still there and is told how many logs it
+// missed. Slots hold immutable batches swapped in and out with the atomic
+// shared_ptr operations, so a reader can keep a batch while it is replaced.
+class LogTail {
+public:
+    struct Entry {
+        int64_t timestamp;
+        std::string reference;
+        std::shared_ptr<const std::string> record;  // Log::serialize() layout
+    };
+
+    struct Batch {
+        uint64_t seq;
+        uint64_t first_log;  // logs published before this batch
+        std::vector<Entry> entries;
+    };
+
+    class Reader {
+    public:
+        ~Reader();
+
+        // Appends the batches published since the last call, at most
+        // max_batches of them, and adds the logs skipped over to skipped_logs
+        void read(std::vector<std::shared_ptr<const Batch>>& batches, size_t max_batches, uint64_t& skipped_logs);
+
+    private:
+        friend class LogTail;
+        Reader(LogTail& tail, uint64_t next_seq, uint64_t next_log);
+
+        LogTail& tail;
+        uint64_t next_seq;
+        uint64_t next_log;
+    };
+
+    LogTail(size_t slots, size_t max_readers);
+
+    // Called by the group commit writer. The writers of the shards of a
+    // sharded database share one tail, so publishers take turns; readers
+    // never wait for them.
+    void publish(std::vector<Entry> entries);
+
+    // Lets publishers skip building entries nobody would read
+    bool has_readers() const { return readers.load(std::memory_order_relaxed) > 0; }
+    size_t reader_count() const { return readers.load(std::memory_order_relaxed); }
+
+    // Starts at the next batch published. Returns null when max_readers
+    // readers already exist.
+    std::unique_ptr<Reader> subscribe();
+
+private:
+    std::mutex publish_mutex;
+    std::vector<std::shared_ptr<const Batch>> slots;
+    std::atomic<uint64_t> published;       // batches published so far
+    std::atomic<uint64_t> published_logs;  // logs in them
+    std::atomic<size_t> readers;
+    size_t max_readers;
+};
+
+#endif // LOG_TAIL_H
@@ -0,0 +1,220 @@
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+
+namespace {
+
+const char* const LEVEL_NAMES[] = { "debug", "info", "warn", "error", "off" };
+const char* const LEVEL_LABELS[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void append_time(std::string& out, int64_t time_us) {
+    std::time_t seconds = static_cast<std::time_t>(time_us / 1000000);
+    std::tm local;
+    localtime_r(&seconds, &local);
+    char text[32];
+    size_t length = std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    length += std::snprintf(text + length, sizeof(text) - length, ".%03d",
+                            static_cast<int>(time_us / 1000 % 1000));
+    out.append(text, length);
+}
+
+}
+
+bool parse_log_level(const std::string& name, LogLevel& level) {
+    for (int i = 0; i <= static_cast<int>(LogLevel::Off); ++i) {
+        if (name == LEVEL_NAMES[i]) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+LoggerOptions LoggerOptions::from_config(const ConfigReader& config) {
+    LoggerOptions options;
+    std::string level = config.getString("logging", "level", LEVEL_NAMES[static_cast<int>(options.level)]);
+    if (!parse_log_level(level, options.level)) {
+        throw std::runtime_error("Unknown log level '" + level + "' for logging.level");
+    }
+    options.max_lines_per_second = config.getInt64("logging", "max_lines_per_second",
+                                                   options.max_lines_per_second);
+    options.buffer_lines = std::max<int64_t>(1, config.getInt64("logging", "buffer_lines", options.buffer_lines));
+    options.flush_interval = std::chrono::milliseconds(
+        std::max(1, config.getInt("logging", "flush_interval_ms", options.flush_interval.count())));
+    return options;
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : window_second(0), window_lines(0), dropped(0), suppressed(0) {
+    LoggerOptions defaults;
+    min_level = static_cast<int>(defaults.level);
+    max_lines_per_second = defaults.max_lines_per_second;
+    buffer_lines = defaults.buffer_lines;
+    flush_interval_ms = defaults.flush_interval.count();
+    writer = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    drain();
+}
+
+void Logger::configure(const LoggerOptions& options) {
+    min_level = static_cast<int>(options.level);
+    max_lines_per_second = options.max_lines_per_second;
+    buffer_lines = std::max<size_t>(1, options.buffer_lines);
+    flush_interval_ms = options.flush_interval.count();
+}
+
+void Logger::write(LogLevel level, std::string text) {
+    if (!admit()) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Buffer& buffer = thread_buffer();
+    uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+    if (tail - buffer.head.load(std::memory_order_acquire) >= buffer.lines.size()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Line& line = buffer.lines[tail % buffer.lines.size()];
+    line.time_us = now_us();
+    line.level = level;
+    line.text = std::move(text);
+    buffer.tail.store(tail + 1, std::memory_order_release);
+}
+
+void Logger::flush() {
+    drain();
+}
+
+Logger::Buffer& Logger::thread_buffer() {
+    // Marks the ring retired when its thread exits; the writer frees it once
+    // it has been drained
+    struct Owner {
+        std::shared_ptr<Buffer> buffer;
+        ~Owner() {
+            if (buffer) {
+                buffer->retired.store(true, std::memory_order_release);
+            }
+        }
+    };
+    thread_local Owner owner;
+    if (!owner.buffer) {
+        owner.buffer = std::make_shared<Buffer>(buffer_lines.load(std::memory_order_relaxed));
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(owner.buffer);
+    }
+    return *owner.buffer;
+}
+
+bool Logger::admit() {
+    size_t limit = max_lines_per_second.load(std::memory_order_relaxed);
+    if (limit == 0) {
+        return true;
+    }
+    int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t current = window_second.load(std::memory_order_relaxed);
+    // Lines racing with the start of a new second may count against either
+    if (second != current && window_second.compare_exchange_strong(current, second, std::memory_order_relaxed)) {
+        window_lines.store(0, std::memory_order_relaxed);
+    }
+    return window_lines.fetch_add(1, std::memory_order_relaxed) < limit;
+}
+
+void Logger::run() {
+    std::unique_lock<std::mutex> lock(wake_mutex);
+    while (!stopping) {
+        wake.wait_for(lock, std::chrono::milliseconds(flush_interval_ms.load(std::memory_order_relaxed)));
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+void Logger::drain() {
+    std::lock_guard<std::mutex> drain_lock(drain_mutex);
+    std::vector<std::shared_ptr<Buffer>> rings;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        rings = buffers;
+    }
+
+    std::vector<Line> lines;
+    std::vector<Buffer*> finished;
+    for (const auto& ring : rings) {
+        // Checked first: once retired, nothing more can arrive after this drain
+        bool retired = ring->retired.load(std::memory_order_acquire);
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head < tail; ++head) {
+            lines.push_back(std::move(ring->lines[head % ring->lines.size()]));
+        }
+        ring->head.store(head, std::memory_order_release);
+        if (retired) {
+            finished.push_back(ring.get());
+        }
+    }
+    if (!finished.empty()) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [&](const std::shared_ptr<Buffer>& ring) {
+            return std::find(finished.begin(), finished.end(), ring.get()) != finished.end();
+        }), buffers.end());
+    }
+
+    uint64_t dropped_lines = dropped.exchange(0, std::memory_order_relaxed);
+    uint64_t suppressed_lines = suppressed.exchange(0, std::memory_order_relaxed);
+    if (dropped_lines > 0 || suppressed_lines > 0) {
+        Line line;
+        line.time_us = now_us();
+        line.level = LogLevel::Warn;
+        line.text = "Log lines lost: " + std::to_string(suppressed_lines) + " over the rate limit, "
+            + std::to_string(dropped_lines) + " to full buffers";
+        lines.push_back(std::move(line));
+    }
+    if (lines.empty()) {
+        return;
+    }
+
+    // Threads are drained one after another; put their lines back in order
+    std::stable_sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) {
+        return a.time_us < b.time_us;
+    });
+    std::string out;
+    std::string err;
+    for (const auto& line : lines) {
+        std::string& target = line.level >= LogLevel::Warn ? err : out;
+        append_time(target, line.time_us);
+        target += ' ';
+        target += LEVEL_LABELS[static_cast<int>(line.level)];
+        target += ' ';
+        target += line.text;
+        target += '\n';
+    }
+    if (!out.empty()) {
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+    }
+    if (!err.empty()) {
+        std::fwrite(err.data(), 1, err.size(), stderr);
+        std::fflush(stderr);
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config_reader.h"
+
+enum class LogLevel { Debug = 0, Info = 1, Warn = 2, Error = 3, Off = 4 };
+
+// Lines below this level are compiled out (0 debug ... 3 error), set with
+// the STICKYLOGS_MIN_LOG_LEVEL CMake cache variable
+#ifndef STICKYLOGS_MIN_LOG_LEVEL
+#define STICKYLOGS_MIN_LOG_LEVEL 0
+#endif
+
+// debug, info, warn, error or off. Returns false for anything else.
+bool parse_log_level(const std::string& name, LogLevel& level);
+
+struct LoggerOptions {
+    LogLevel level = LogLevel::Info;
+    size_t max_lines_per_second = 1000;  // 0 = no limit
+    size_t buffer_lines = 4096;          // per logging thread
+    std::chrono::milliseconds flush_interval{50};
+
+    // Reads the "logging" section. Throws std::runtime_error on an unknown level.
+    static LoggerOptions from_config(const ConfigReader& config);
+};
+
+// Server diagnostics, written to stdout (debug, info) and stderr (warn,
+// error) by a background thread. Every thread that logs appends to a ring of
+// its own that only the writer drains, so logging takes no lock and never
+// waits on the terminal. Lines beyond max_lines_per_second or arriving at a
+// full ring are dropped, and the writer reports how many were.
+class Logger {
+public:
+    static Logger& instance();
+
+    ~Logger();
+
+    // Rings created before a change of buffer_lines keep their size
+    void configure(const LoggerOptions& options);
+
+    bool enabled(LogLevel level) const {
+        return static_cast<int>(level) >= min_level.load(std::memory_order_relaxed);
+    }
+
+    void write(LogLevel level, std::string text);
+
+    // Writes out everything logged so far
+    void flush();
+
+private:
+    struct Line {
+        int64_t time_us = 0;
+        LogLevel level = LogLevel::Info;
+        std::string text;
+    };
+
+    // Single producer (the owning thread), single consumer (whoever holds
+    // drain_mutex)
+    struct Buffer {
+        explicit Buffer(size_t capacity) : lines(capacity) {}
+
+        std::vector<Line> lines;
+        std::atomic<uint64_t> head{0};  // next line to drain
+        std::atomic<uint64_t> tail{0};  // next slot to fill
+        std::atomic<bool> retired{false};  // owning thread has exited
+    };
+
+    Logger();
+
+    Buffer& thread_buffer();
+    bool admit();
+    void run();
+    void drain();
+
+    std::atomic<int> min_level;
+    std::atomic<size_t> max_lines_per_second;
+    std::atomic<size_t> buffer_lines;
+    std::atomic<int64_t> flush_interval_ms;
+
+    // Rate limit over whole seconds of the steady clock
+    std::atomic<int64_t> window_second;
+    std::atomic<size_t> window_lines;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> suppressed;
+
+    std::mutex buffers_mutex;  // guards the list, not the rings
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    std::mutex drain_mutex;  // one consumer at a time
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread writer;
+};
+
+#define STICKYLOGS_LOG(level, expr) \
+    do { \
+        if (static_cast<int>(level) >= STICKYLOGS_MIN_LOG_LEVEL && Logger::instance().enabled(level)) { \
+            std::ostringstream log_line_; \
+            log_line_ << expr; \
+            Logger::instance().write(level, log_line_.str()); \
+        } \
+    } while (0)
+
+// The arguments are only evaluated when the level is enabled:
+//   LOG_DEBUG("Parsed " << logs.size() << " logs");
+#define LOG_DEBUG(expr) STICKYLOGS_LOG(LogLevel::Debug, expr)
+#define LOG_INFO(expr) STICKYLOGS_LOG(LogLevel::Info, expr)
+#define LOG_WARN(expr) STICKYLOGS_LOG(LogLevel::Warn, expr)
+#define LOG_ERROR(expr) STICKYLOGS_LOG(LogLevel::Error, expr)
+
+#endif // LOGGER_H
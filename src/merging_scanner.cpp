@@ -0,0 +1,115 @@
+#include "merging_scanner.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include "key_encoding.h"
+
+namespace {
+
+// Logs read from a scanner at a time
+const size_t MERGE_BATCH_SIZE = 256;
+
+struct Source {
+    std::unique_ptr<LogScanner> scanner;
+    std::vector<Log> logs;
+    size_t next = 0;
+    bool more = true;
+
+    // Reads until there is a log to take or the scanner is exhausted
+    bool fill() {
+        while (next == logs.size() && more) {
+            logs.clear();
+            next = 0;
+            more = scanner->next(logs, MERGE_BATCH_SIZE);
+        }
+        return next < logs.size();
+    }
+};
+
+class OrderedMergeScanner : public LogScanner {
+public:
+    explicit OrderedMergeScanner(std::vector<std::unique_ptr<LogScanner>> scanners) : started(false) {
+        for (auto& scanner : scanners) {
+            sources.emplace_back();
+            sources.back().scanner = std::move(scanner);
+        }
+    }
+
+    bool next(std::vector<Log>& out, size_t max_logs) override {
+        if (!started) {
+            // The first reads wait for every scanner; parallel ones are all
+            // filling in the background by then
+            started = true;
+            for (size_t i = 0; i < sources.size(); ++i) {
+                push(i);
+            }
+        }
+        size_t added = 0;
+        while (added < max_logs && !heap.empty()) {
+            size_t i = heap.top().second;
+            last_key = heap.top().first;
+            heap.pop();
+            Source& source = sources[i];
+            out.push_back(std::move(source.logs[source.next++]));
+            ++added;
+            push(i);
+        }
+        return !heap.empty();
+    }
+
+private:
+    using Head = std::pair<std::string, size_t>;  // time key of the next log, source
+
+    void push(size_t i) {
+        Source& source = sources[i];
+        if (source.fill()) {
+            const Log& log = source.logs[source.next];
+            heap.emplace(encode_time_key(log.timestamp(), log.reference()), i);
+        }
+    }
+
+    std::vector<Source> sources;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+    bool started;
+};
+
+class InterleavedScanner : public LogScanner {
+public:
+    explicit InterleavedScanner(std::vector<std::unique_ptr<LogScanner>> scanners) : turn(0) {
+        for (auto& scanner : scanners) {
+            sources.emplace_back();
+            sources.back().scanner = std::move(scanner);
+        }
+    }
+
+    bool next(std::vector<Log>& out, size_t max_logs) override {
+        for (size_t tried = 0; tried < sources.size(); ++tried) {
+            Source& source = sources[turn];
+            turn = (turn + 1) % sources.size();
+            if (!source.more) {
+                continue;
+            }
+            size_t before = out.size();
+            source.more = source.scanner->next(out, max_logs);
+            if (out.size() > before) {
+                break;
+            }
+        }
+        return std::any_of(sources.begin(), sources.end(), [](const Source& source) { return source.more; });
+    }
+
+private:
+    std::vector<Source> sources;
+    size_t turn;
+};
+
+}
+
+std::unique_ptr<LogScanner> make_merging_scanner(std::vector<std::unique_ptr<LogScanner>> scanners, bool ordered) {
+    if (ordered) {
+        return std::unique_ptr<LogScanner>(new OrderedMergeScanner(std::move(scanners)));
+    }
+    return std::unique_ptr<LogScanner>(new InterleavedScanner(std::move(scanners)));
+}
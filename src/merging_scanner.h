@@ -0,0 +1,16 @@
+#ifndef MERGING_SCANNER_H
+#define MERGING_SCANNER_H
+
+#include <memory>
+#include <vector>
+#include "log_scanner.h"
+
+// Combines scanners over disjoint sets of logs, such as the shards of a
+// sharded database. Ordered merges return logs in timestamp order, each
+// scanner being read as far as the merge needs; the position is the time key
+// of the last log returned, which the scanners that were merged all accept
+// as after_key. Unordered merges take a batch from each scanner in turn and
+// cannot be resumed.
+std::unique_ptr<LogScanner> make_merging_scanner(std::vector<std::unique_ptr<LogScanner>> scanners, bool ordered);
+
+#endif // MERGING_SCANNER_H
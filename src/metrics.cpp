@@ -0,0 +1,174 @@
+#include "metrics.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+const char* const KNOWN_ACTIONS[] = {
+    "insert", "batch_insert", "query_by_reference", "query", "query_all", "aggregate", "sketch", "convert_records", "bulk_load", "ingest", "tail", "other"
+};
+
+const char* const STAGE_NAMES[] = { "parse", "db_write", "db_read", "response_write" };
+
+const double QUANTILES[] = { 0.5, 0.99 };
+
+// Largest value the buckets can tell apart, about 25 days
+const uint64_t MAX_TRACKED_MICROS = (1ULL << 41) - 1;
+
+void write_header(std::ostringstream& out, const std::string& name, const std::string& type, const std::string& help) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+// Writes the shortest of 15 or 17 significant digits that reads back as the
+// same double; the stream's default of 6 would round large counters
+void write_value(std::ostringstream& out, double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.15g", value);
+    if (std::strtod(buf, nullptr) != value) {
+        std::snprintf(buf, sizeof(buf), "%.17g", value);
+    }
+    out << buf;
+}
+
+}
+
+size_t metric_shard() {
+    static std::atomic<size_t> next_shard{0};
+    thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+    return shard;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto& shard : shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t Histogram::bucket_of(uint64_t micros) {
+    if (micros < 8) {
+        return micros;
+    }
+    if (micros > MAX_TRACKED_MICROS) {
+        micros = MAX_TRACKED_MICROS;
+    }
+    int exponent = 63 - __builtin_clzll(micros);
+    size_t sub_bucket = (micros >> (exponent - 3)) & 7;
+    return (exponent - 2) * 8 + sub_bucket;
+}
+
+uint64_t Histogram::bucket_lower(size_t bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    int exponent = static_cast<int>(bucket / 8) + 2;
+    return (8 + bucket % 8) << (exponent - 3);
+}
+
+uint64_t Histogram::bucket_upper(size_t bucket) {
+    return bucket + 1 < BUCKETS ? bucket_lower(bucket + 1) : MAX_TRACKED_MICROS + 1;
+}
+
+void Histogram::record(uint64_t micros) {
+    Shard& shard = shards[metric_shard()];
+    shard.counts[bucket_of(micros)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(micros, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot result;
+    result.counts.assign(BUCKETS, 0);
+    for (size_t s = 0; s < METRIC_SHARDS; ++s) {
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            uint64_t n = shards[s].counts[b].load(std::memory_order_relaxed);
+            result.counts[b] += n;
+            result.count += n;
+        }
+        result.sum += shards[s].sum.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+double Histogram::Snapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * count));
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t b = 0; b < counts.size(); ++b) {
+        seen += counts[b];
+        if (seen >= rank) {
+            // Middle of the bucket; exact for the small single-value buckets
+            return (bucket_lower(b) + bucket_upper(b) - 1) / 2.0;
+        }
+    }
+    return static_cast<double>(MAX_TRACKED_MICROS);
+}
+
+Metrics::Metrics() {
+    for (const char* action : KNOWN_ACTIONS) {
+        requests[action].reset(new Counter());
+    }
+}
+
+void Metrics::count_request(const std::string& action) {
+    auto it = requests.find(action);
+    (it != requests.end() ? it->second : requests.at("other"))->add();
+}
+
+void Metrics::record_latency(Stage stage, std::chrono::steady_clock::duration elapsed) {
+    latencies[static_cast<size_t>(stage)].record(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+void Metrics::add_callback(const std::string& name, const std::string& type, const std::string& help,
+                           std::function<double()> value) {
+    std::lock_guard<std::mutex> lock(callbacks_mutex);
+    callbacks.push_back({name, type, help, std::move(value)});
+}
+
+std::string Metrics::render() const {
+    std::ostringstream out;
+
+    write_header(out, "stickylogs_requests_total", "counter", "Requests handled, by action.");
+    for (const auto& request : requests) {
+        out << "stickylogs_requests_total{action=\"" << request.first << "\"} " << request.second->value() << "\n";
+    }
+    write_header(out, "stickylogs_request_errors_total", "counter", "Requests answered with an error.");
+    out << "stickylogs_request_errors_total " << errors.value() << "\n";
+
+    write_header(out, "stickylogs_latency_seconds", "summary", "Time spent per request stage.");
+    for (size_t stage = 0; stage < latencies.size(); ++stage) {
+        Histogram::Snapshot snapshot = latencies[stage].snapshot();
+        for (double q : QUANTILES) {
+            out << "stickylogs_latency_seconds{stage=\"" << STAGE_NAMES[stage] << "\",quantile=\"" << q << "\"} ";
+            write_value(out, snapshot.quantile(q) / 1e6);
+            out << "\n";
+        }
+        out << "stickylogs_latency_seconds_sum{stage=\"" << STAGE_NAMES[stage] << "\"} ";
+        write_value(out, snapshot.sum / 1e6);
+        out << "\n";
+        out << "stickylogs_latency_seconds_count{stage=\"" << STAGE_NAMES[stage] << "\"} " << snapshot.count << "\n";
+    }
+
+    write_header(out, "stickylogs_bytes_in_total", "counter", "Bytes read from clients.");
+    out << "stickylogs_bytes_in_total " << bytes_in.value() << "\n";
+    write_header(out, "stickylogs_bytes_out_total", "counter", "Bytes written to clients.");
+    out << "stickylogs_bytes_out_total " << bytes_out.value() << "\n";
+
+    std::lock_guard<std::mutex> lock(callbacks_mutex);
+    for (const auto& callback : callbacks) {
+        write_header(out, callback.name, callback.type, callback.help);
+        out << callback.name << " ";
+        write_value(out, callback.value());
+        out << "\n";
+    }
+    return out.str();
+}
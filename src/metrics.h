@@ -0,0 +1,117 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Recording is lock-free: every value is spread over per-thread shards of
+// relaxed atomics, which are only summed when the metrics are scraped.
+const size_t METRIC_SHARDS = 16;
+
+// Shard of the calling thread, assigned round-robin on first use
+size_t metric_shard();
+
+class Counter {
+public:
+    void add(uint64_t n = 1) { shards[metric_shard()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, METRIC_SHARDS> shards;
+};
+
+// Log-linear histogram of durations in microseconds: eight sub-buckets per
+// power of two, so quantiles are exact to within 12.5%.
+class Histogram {
+public:
+    static const size_t BUCKETS = 312;
+
+    void record(uint64_t micros);
+
+    struct Snapshot {
+        std::vector<uint64_t> counts;
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        // Microseconds at or below which the given fraction of values fall
+        double quantile(double q) const;
+    };
+    Snapshot snapshot() const;
+
+    static size_t bucket_of(uint64_t micros);
+    static uint64_t bucket_lower(size_t bucket);
+    static uint64_t bucket_upper(size_t bucket);
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+        std::atomic<uint64_t> sum{0};
+    };
+    std::unique_ptr<Shard[]> shards{new Shard[METRIC_SHARDS]};
+};
+
+// Server-wide metrics, rendered in the Prometheus text format
+class Metrics {
+public:
+    enum class Stage { Parse, DbWrite, DbRead, ResponseWrite };
+
+    Metrics();
+
+    // Actions not known in advance are counted as "other"
+    void count_request(const std::string& action);
+    void count_error() { errors.add(); }
+    void record_latency(Stage stage, std::chrono::steady_clock::duration elapsed);
+    void add_bytes_in(size_t bytes) { bytes_in.add(bytes); }
+    void add_bytes_out(size_t bytes) { bytes_out.add(bytes); }
+
+    // Values read from elsewhere (connection count, RocksDB properties)
+    // when scraped; type is "gauge" or "counter"
+    void add_callback(const std::string& name, const std::string& type, const std::string& help,
+                      std::function<double()> value);
+
+    std::string render() const;
+
+private:
+    struct Callback {
+        std::string name;
+        std::string type;
+        std::string help;
+        std::function<double()> value;
+    };
+
+    // Built once in the constructor and only read afterwards
+    std::map<std::string, std::unique_ptr<Counter>> requests;
+    Counter errors;
+    Counter bytes_in;
+    Counter bytes_out;
+    std::array<Histogram, 4> latencies;
+
+    mutable std::mutex callbacks_mutex;
+    std::vector<Callback> callbacks;
+};
+
+// Records the time between construction and destruction
+class LatencyTimer {
+public:
+    LatencyTimer(Metrics& metrics, Metrics::Stage stage)
+        : metrics(metrics), stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~LatencyTimer() { metrics.record_latency(stage, std::chrono::steady_clock::now() - start); }
+
+private:
+    Metrics& metrics;
+    Metrics::Stage stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,290 @@
+#include "parallel_scanner.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include "key_encoding.h"
+
+namespace {
+
+// Logs a range reads per step, and how many finished batches it may hold
+// before it pauses for the consumer
+const size_t SCAN_BATCH_SIZE = 256;
+const size_t MAX_BUFFERED_BATCHES = 4;
+
+// Time slices sized per range wanted, so that the grouping into ranges has
+// some resolution to work with
+const size_t SLICES_PER_RANGE = 4;
+const size_t MAX_SLICES_PER_PARTITION = 64;
+
+struct Batch {
+    std::vector<Log> logs;
+    size_t taken = 0;       // logs already handed to the consumer
+    std::string position;   // scanner position after the batch
+};
+
+struct RangeState {
+    std::unique_ptr<LogScanner> scanner;
+    std::deque<Batch> batches;
+    bool running = false;   // a fill task owns the scanner
+    bool done = false;
+};
+
+// Shared with the fill tasks, which can outlive the scanner by a little
+struct ScanState {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<RangeState> ranges;
+    std::exception_ptr error;
+    bool cancelled = false;
+};
+
+// Reads batches of one range until its buffer is full or it is exhausted
+void fill(const std::shared_ptr<ScanState>& state, size_t index) {
+    RangeState& range = state->ranges[index];
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->cancelled || state->error || range.batches.size() >= MAX_BUFFERED_BATCHES) {
+                range.running = false;
+                break;
+            }
+        }
+
+        Batch batch;
+        bool more;
+        try {
+            more = range.scanner->next(batch.logs, SCAN_BATCH_SIZE);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->error = std::current_exception();
+            range.running = false;
+            break;
+        }
+        batch.position = range.scanner->position();
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        range.batches.push_back(std::move(batch));
+        if (!more) {
+            range.done = true;
+            range.running = false;
+            range.scanner.reset();
+            break;
+        }
+        state->cv.notify_all();
+    }
+    state->cv.notify_all();
+}
+
+class ParallelScanner : public LogScanner {
+public:
+    ParallelScanner(rocksdb::DB* db, ScanPool& pool, std::vector<ScanRange> ranges,
+                    const std::set<std::string>& indexed_fields, const LogQuery& query,
+                    const std::string& after_key, bool ordered)
+        : pool(pool), state(std::make_shared<ScanState>()), ordered(ordered), current(0) {
+        SharedSnapshot snapshot = make_shared_snapshot(db);
+        state->ranges.resize(ranges.size());
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            LogQuery range_query = query;
+            range_query.start_timestamp = ranges[i].start_timestamp;
+            range_query.end_timestamp = ranges[i].end_timestamp;
+            state->ranges[i].scanner = make_query_scanner(db, {ranges[i].partition}, indexed_fields,
+                                                          range_query, after_key, snapshot);
+        }
+        std::lock_guard<std::mutex> lock(state->mutex);
+        for (size_t i = 0; i < state->ranges.size(); ++i) {
+            schedule(i);
+        }
+    }
+
+    ~ParallelScanner() override {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cancelled = true;
+    }
+
+    bool next(std::vector<Log>& out, size_t max_logs) override {
+        size_t added = 0;
+        std::unique_lock<std::mutex> lock(state->mutex);
+        while (added < max_logs) {
+            size_t index;
+            if (!wait_for_batch(lock, index)) {
+                return false;
+            }
+            RangeState& range = state->ranges[index];
+            Batch& batch = range.batches.front();
+            size_t n = std::min(max_logs - added, batch.logs.size() - batch.taken);
+            auto first = batch.logs.begin() + batch.taken;
+            std::move(first, first + n, std::back_inserter(out));
+            batch.taken += n;
+            added += n;
+
+            if (batch.taken < batch.logs.size()) {
+                if (ordered) {
+                    const Log& last = out.back();
+                    last_key = encode_time_key(last.timestamp(), last.reference());
+                }
+                break;
+            }
+            if (ordered) {
+                last_key = std::move(batch.position);
+            }
+            range.batches.pop_front();
+            schedule(index);
+        }
+        return ordered ? current < state->ranges.size() : !all_done();
+    }
+
+private:
+    // Starts a fill task for the range unless one is running or it is done.
+    // Called with the state locked.
+    void schedule(size_t index) {
+        RangeState& range = state->ranges[index];
+        if (range.running || range.done || range.batches.size() >= MAX_BUFFERED_BATCHES) {
+            return;
+        }
+        range.running = true;
+        std::shared_ptr<ScanState> shared = state;
+        pool.submit([shared, index]() { fill(shared, index); });
+    }
+
+    // Waits until the next range to read from has a batch, and returns false
+    // once every range is exhausted
+    bool wait_for_batch(std::unique_lock<std::mutex>& lock, size_t& index) {
+        while (true) {
+            if (state->error) {
+                std::rethrow_exception(state->error);
+            }
+            if (ordered) {
+                while (current < state->ranges.size() &&
+                       state->ranges[current].done && state->ranges[current].batches.empty()) {
+                    ++current;
+                }
+                if (current == state->ranges.size()) {
+                    return false;
+                }
+                if (!state->ranges[current].batches.empty()) {
+                    index = current;
+                    return true;
+                }
+            } else {
+                bool pending = false;
+                for (size_t i = 0; i < state->ranges.size(); ++i) {
+                    if (!state->ranges[i].batches.empty()) {
+                        index = i;
+                        return true;
+                    }
+                    pending = pending || !state->ranges[i].done;
+                }
+                if (!pending) {
+                    return false;
+                }
+            }
+            state->cv.wait(lock);
+        }
+    }
+
+    bool all_done() const {
+        for (const auto& range : state->ranges) {
+            if (!range.done || !range.batches.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ScanPool& pool;
+    std::shared_ptr<ScanState> state;
+    bool ordered;
+    size_t current;  // range being read, in ordered mode
+};
+
+}
+
+std::vector<ScanRange> split_scan_ranges(rocksdb::DB* db,
+                                         const std::vector<PartitionSet::Partition>& partitions,
+                                         int64_t start_timestamp, int64_t end_timestamp,
+                                         size_t target_ranges) {
+    struct TimeSlice {
+        size_t partition;
+        int64_t start_timestamp;
+        int64_t end_timestamp;
+        uint64_t bytes;
+    };
+    std::vector<TimeSlice> slices;
+    uint64_t total_bytes = 0;
+    size_t slices_per_partition = partitions.empty() ? 1 :
+        std::min(MAX_SLICES_PER_PARTITION,
+                 std::max<size_t>(1, (target_ranges * SLICES_PER_RANGE + partitions.size() - 1) / partitions.size()));
+
+    for (size_t p = 0; p < partitions.size(); ++p) {
+        int64_t day_start = partitions[p].first * PartitionSet::DAY_MS;
+        int64_t low = std::max(start_timestamp, day_start);
+        int64_t high = std::min(end_timestamp, day_start + PartitionSet::DAY_MS - 1);
+        if (low > high) {
+            continue;
+        }
+        int64_t span = high - low + 1;
+        int64_t count = std::min<int64_t>(slices_per_partition, span);
+
+        std::vector<std::string> bounds;
+        for (int64_t i = 0; i <= count; ++i) {
+            bounds.push_back(encode_record_key(i == count ? high + 1 : low + i * (span / count), ""));
+        }
+        std::vector<rocksdb::Range> key_ranges;
+        for (int64_t i = 0; i < count; ++i) {
+            key_ranges.emplace_back(bounds[i], bounds[i + 1]);
+        }
+        std::vector<uint64_t> sizes(count, 0);
+        rocksdb::SizeApproximationOptions options;
+        options.include_memtables = true;
+        rocksdb::Status status = db->GetApproximateSizes(options, partitions[p].second.get(),
+                                                         key_ranges.data(), static_cast<int>(count), sizes.data());
+        if (!status.ok()) {
+            std::fill(sizes.begin(), sizes.end(), 0);
+        }
+        for (int64_t i = 0; i < count; ++i) {
+            int64_t slice_low = low + i * (span / count);
+            int64_t slice_high = i + 1 == count ? high : slice_low + span / count - 1;
+            slices.push_back({p, slice_low, slice_high, sizes[i]});
+            total_bytes += sizes[i];
+        }
+    }
+
+    // Without any size information every slice weighs the same
+    if (total_bytes == 0) {
+        for (auto& slice : slices) {
+            slice.bytes = 1;
+        }
+        total_bytes = slices.size();
+    }
+
+    // Consecutive slices of a partition are merged until they reach the
+    // target size
+    uint64_t target_bytes = std::max<uint64_t>(1, total_bytes / std::max<size_t>(1, target_ranges));
+    std::vector<ScanRange> ranges;
+    uint64_t range_bytes = 0;
+    for (size_t i = 0; i < slices.size(); ++i) {
+        const TimeSlice& slice = slices[i];
+        bool extend = !ranges.empty() && slices[i - 1].partition == slice.partition &&
+                      range_bytes + slice.bytes <= target_bytes;
+        if (extend) {
+            ranges.back().end_timestamp = slice.end_timestamp;
+            range_bytes += slice.bytes;
+        } else {
+            ranges.push_back({partitions[slice.partition], slice.start_timestamp, slice.end_timestamp});
+            range_bytes = slice.bytes;
+        }
+    }
+    return ranges;
+}
+
+std::unique_ptr<LogScanner> make_parallel_scanner(rocksdb::DB* db, ScanPool& pool,
+                                                  std::vector<ScanRange> ranges,
+                                                  const std::set<std::string>& indexed_fields,
+                                                  const LogQuery& query,
+                                                  const std::string& after_key,
+                                                  bool ordered) {
+    return std::unique_ptr<LogScanner>(new ParallelScanner(db, pool, std::move(ranges), indexed_fields,
+                                                           query, after_key, ordered));
+}
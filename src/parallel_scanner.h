@@ -0,0 +1,43 @@
+#ifndef PARALLEL_SCANNER_H
+#define PARALLEL_SCANNER_H
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <rocksdb/db.h>
+#include "log_scanner.h"
+#include "partition_set.h"
+#include "scan_pool.h"
+
+// Time range [start_timestamp, end_timestamp] inside one partition
+struct ScanRange {
+    PartitionSet::Partition partition;
+    int64_t start_timestamp;
+    int64_t end_timestamp;
+};
+
+// Splits [start_timestamp, end_timestamp] over the given partitions into
+// about target_ranges ranges holding similar amounts of data, going by
+// RocksDB's approximate sizes of the records (memtables included). Ranges
+// never span partitions and come back in timestamp order.
+std::vector<ScanRange> split_scan_ranges(rocksdb::DB* db,
+                                         const std::vector<PartitionSet::Partition>& partitions,
+                                         int64_t start_timestamp, int64_t end_timestamp,
+                                         size_t target_ranges);
+
+// Runs a LogQuery over the ranges at once on the scan pool, all reading
+// from one snapshot. Each range buffers a few batches ahead of the
+// consumer and pauses once they are full, so memory stays bounded however
+// far the workers get ahead. Ordered scans return logs in timestamp order
+// and their positions work with make_query_scanner's; unordered scans
+// return each batch as soon as any range has one, and cannot be resumed.
+std::unique_ptr<LogScanner> make_parallel_scanner(rocksdb::DB* db, ScanPool& pool,
+                                                  std::vector<ScanRange> ranges,
+                                                  const std::set<std::string>& indexed_fields,
+                                                  const LogQuery& query,
+                                                  const std::string& after_key,
+                                                  bool ordered);
+
+#endif // PARALLEL_SCANNER_H
@@ -0,0 +1,159 @@
+#include "partition_set.h"
+#include <cstdio>
+#include <stdexcept>
+#include "logger.h"
+
+namespace {
+
+const std::string PARTITION_PREFIX = "logs_";
+
+// Day number <-> proleptic Gregorian date, after Howard Hinnant's
+// days_from_civil / civil_from_days
+int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+void civil_from_days(int64_t z, int64_t& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = static_cast<int64_t>(yoe) + era * 400 + (m <= 2);
+}
+
+}
+
+int64_t PartitionSet::day_of(int64_t timestamp) {
+    // Floor division, so negative timestamps land in the day they belong to
+    int64_t day = timestamp / DAY_MS;
+    if (timestamp % DAY_MS < 0) {
+        --day;
+    }
+    return day;
+}
+
+std::string PartitionSet::name_of(int64_t day) {
+    if (day < MIN_DAY || day > MAX_DAY) {
+        throw std::runtime_error("Day " + std::to_string(day) + " is outside the years 0000-9999");
+    }
+    int64_t year;
+    unsigned month, dom;
+    civil_from_days(day, year, month, dom);
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%04lld%02u%02u", static_cast<long long>(year), month, dom);
+    return PARTITION_PREFIX + buf;
+}
+
+bool PartitionSet::parse_name(const std::string& name, int64_t& day) {
+    if (name.size() != PARTITION_PREFIX.size() + 8 || name.compare(0, PARTITION_PREFIX.size(), PARTITION_PREFIX) != 0) {
+        return false;
+    }
+    int64_t value = 0;
+    for (size_t i = PARTITION_PREFIX.size(); i < name.size(); ++i) {
+        if (name[i] < '0' || name[i] > '9') {
+            return false;
+        }
+        value = value * 10 + (name[i] - '0');
+    }
+    unsigned month = static_cast<unsigned>(value / 100 % 100);
+    unsigned dom = static_cast<unsigned>(value % 100);
+    if (month < 1 || month > 12 || dom < 1 || dom > 31) {
+        return false;
+    }
+    int64_t parsed = days_from_civil(value / 10000, month, dom);
+    // Rejects dates that don't exist, such as February 31st
+    if (name_of(parsed) != name) {
+        return false;
+    }
+    day = parsed;
+    return true;
+}
+
+PartitionSet::PartitionSet(rocksdb::DB* db, const rocksdb::ColumnFamilyOptions& options)
+    : db(db), options(options) {}
+
+PartitionSet::~PartitionSet() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    partitions.clear();
+}
+
+PartitionSet::Handle PartitionSet::wrap(rocksdb::ColumnFamilyHandle* handle) {
+    rocksdb::DB* owner = db;
+    return Handle(handle, [owner](rocksdb::ColumnFamilyHandle* h) { owner->DestroyColumnFamilyHandle(h); });
+}
+
+void PartitionSet::adopt(int64_t day, rocksdb::ColumnFamilyHandle* handle) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    partitions[day] = wrap(handle);
+}
+
+PartitionSet::Handle PartitionSet::get(int64_t day) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = partitions.find(day);
+    return it == partitions.end() ? nullptr : it->second;
+}
+
+PartitionSet::Handle PartitionSet::get_or_create(int64_t day) {
+    Handle existing = get(day);
+    if (existing) {
+        return existing;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = partitions.find(day);
+    if (it != partitions.end()) {
+        return it->second;
+    }
+    rocksdb::ColumnFamilyHandle* handle;
+    rocksdb::Status status = db->CreateColumnFamily(options, name_of(day), &handle);
+    if (!status.ok()) {
+        throw std::runtime_error("Failed to create partition " + name_of(day) + ": " + status.ToString());
+    }
+    LOG_INFO("Created partition " << name_of(day));
+    return partitions[day] = wrap(handle);
+}
+
+std::vector<PartitionSet::Partition> PartitionSet::overlapping(int64_t start_timestamp, int64_t end_timestamp) const {
+    std::vector<Partition> result;
+    if (start_timestamp > end_timestamp) {
+        return result;
+    }
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto end = partitions.upper_bound(day_of(end_timestamp));
+    for (auto it = partitions.lower_bound(day_of(start_timestamp)); it != end; ++it) {
+        result.push_back(*it);
+    }
+    return result;
+}
+
+std::vector<PartitionSet::Partition> PartitionSet::all() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return std::vector<Partition>(partitions.begin(), partitions.end());
+}
+
+size_t PartitionSet::drop_before(int64_t first_kept_day) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    size_t dropped = 0;
+    auto end = partitions.lower_bound(first_kept_day);
+    for (auto it = partitions.begin(); it != end;) {
+        // The files are released once the last handle (scanners may still
+        // hold one) goes away
+        rocksdb::Status status = db->DropColumnFamily(it->second.get());
+        if (!status.ok()) {
+            throw std::runtime_error("Failed to drop partition " + name_of(it->first) + ": " + status.ToString());
+        }
+        LOG_INFO("Dropped expired partition " << name_of(it->first));
+        it = partitions.erase(it);
+        ++dropped;
+    }
+    return dropped;
+}
@@ -0,0 +1,64 @@
+#ifndef PARTITION_SET_H
+#define PARTITION_SET_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <rocksdb/db.h>
+
+// Logs are stored in one column family per UTC day ("logs_YYYYMMDD"), so a
+// whole day can be expired by dropping its column family instead of
+// deleting rows, and time range scans only open the days they overlap.
+class PartitionSet {
+public:
+    // Handles stay usable while shared, even after their partition is dropped
+    using Handle = std::shared_ptr<rocksdb::ColumnFamilyHandle>;
+    using Partition = std::pair<int64_t, Handle>;
+
+    static constexpr int64_t DAY_MS = 24LL * 60 * 60 * 1000;
+    // Partition names have four digit years, so only days from 0000-01-01
+    // to 9999-12-31 have one
+    static constexpr int64_t MIN_DAY = -719528;
+    static constexpr int64_t MAX_DAY = 2932896;
+    static constexpr int64_t MIN_TIMESTAMP = MIN_DAY * DAY_MS;
+    static constexpr int64_t MAX_TIMESTAMP = (MAX_DAY + 1) * DAY_MS - 1;
+
+    static bool in_range(int64_t timestamp) { return timestamp >= MIN_TIMESTAMP && timestamp <= MAX_TIMESTAMP; }
+    static int64_t day_of(int64_t timestamp);
+    // Throws if the day is outside [MIN_DAY, MAX_DAY]
+    static std::string name_of(int64_t day);
+    // Returns false if name is not a partition column family name
+    static bool parse_name(const std::string& name, int64_t& day);
+
+    PartitionSet(rocksdb::DB* db, const rocksdb::ColumnFamilyOptions& options);
+    ~PartitionSet();
+
+    // Takes ownership of a partition handle opened with the database
+    void adopt(int64_t day, rocksdb::ColumnFamilyHandle* handle);
+
+    // Returns nullptr if the day has no partition
+    Handle get(int64_t day) const;
+    Handle get_or_create(int64_t day);
+
+    // Partitions whose day overlaps [start_timestamp, end_timestamp], in order
+    std::vector<Partition> overlapping(int64_t start_timestamp, int64_t end_timestamp) const;
+    std::vector<Partition> all() const;
+
+    // Drops the partitions of every day before first_kept_day and returns how
+    // many were dropped
+    size_t drop_before(int64_t first_kept_day);
+
+private:
+    Handle wrap(rocksdb::ColumnFamilyHandle* handle);
+
+    rocksdb::DB* db;
+    rocksdb::ColumnFamilyOptions options;
+    mutable std::shared_mutex mutex;
+    std::map<int64_t, Handle> partitions;
+};
+
+#endif // PARTITION_SET_H
@@ -0,0 +1,75 @@
+#include "prefix_cursor.h"
+#include <stdexcept>
+#include "key_encoding.h"
+
+void seek_after(rocksdb::Iterator* it, const std::string& lower_key, const std::string& after_key) {
+    if (after_key.empty() || after_key < lower_key) {
+        it->Seek(lower_key);
+        return;
+    }
+    it->Seek(after_key);
+    if (it->Valid() && it->key() == rocksdb::Slice(after_key)) {
+        it->Next();
+    }
+}
+
+PrefixCursor::PrefixCursor(rocksdb::DB* db, const rocksdb::Snapshot* snapshot, rocksdb::ColumnFamilyHandle* cf,
+                           const std::string& prefix, int64_t start_timestamp, int64_t end_timestamp)
+    : prefix(prefix) {
+    rocksdb::ReadOptions read_options;
+    read_options.snapshot = snapshot;
+    upper_key = end_timestamp < INT64_MAX
+        ? prefix + encode_time_key(end_timestamp + 1, "")
+        : prefix_successor(prefix);
+    if (!upper_key.empty()) {
+        upper_bound = upper_key;
+        read_options.iterate_upper_bound = &upper_bound;
+    }
+    it.reset(db->NewIterator(read_options, cf));
+    lower_suffix = encode_time_key(start_timestamp, "");
+}
+
+void PrefixCursor::start(const std::string& after_suffix) {
+    seek_after(it.get(), prefix + lower_suffix, after_suffix.empty() ? "" : prefix + after_suffix);
+}
+
+bool Intersection::next(std::string& suffix) {
+    while (true) {
+        for (const auto& cursor : cursors) {
+            if (!cursor->valid()) {
+                check_status();
+                return false;
+            }
+        }
+
+        std::string target = cursors[0]->suffix().ToString();
+        for (size_t i = 1; i < cursors.size(); ++i) {
+            if (cursors[i]->suffix().compare(target) > 0) {
+                target = cursors[i]->suffix().ToString();
+            }
+        }
+
+        bool aligned = true;
+        for (const auto& cursor : cursors) {
+            if (cursor->suffix().compare(target) < 0) {
+                cursor->seek(target);
+                aligned = false;
+            }
+        }
+        if (aligned) {
+            suffix = std::move(target);
+            for (const auto& cursor : cursors) {
+                cursor->next();
+            }
+            return true;
+        }
+    }
+}
+
+void Intersection::check_status() const {
+    for (const auto& cursor : cursors) {
+        if (!cursor->status().ok()) {
+            throw std::runtime_error("Error iterating over index: " + cursor->status().ToString());
+        }
+    }
+}
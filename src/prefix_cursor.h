@@ -0,0 +1,61 @@
+#ifndef PREFIX_CURSOR_H
+#define PREFIX_CURSOR_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <rocksdb/db.h>
+
+// Positions it on the first key after after_key, or on the first key at or
+// after lower_key when there is no cursor to resume from
+void seek_after(rocksdb::Iterator* it, const std::string& lower_key, const std::string& after_key);
+
+// Iterates the keys <prefix><suffix> of one column family, where suffix is a
+// time key (<timestamp><reference>) inside [start, end]
+class PrefixCursor {
+public:
+    PrefixCursor(rocksdb::DB* db, const rocksdb::Snapshot* snapshot, rocksdb::ColumnFamilyHandle* cf,
+                 const std::string& prefix, int64_t start_timestamp, int64_t end_timestamp);
+
+    // Seeks to the first entry after after_suffix, or to the start of the range
+    void start(const std::string& after_suffix);
+
+    bool valid() const { return it->Valid(); }
+
+    rocksdb::Slice suffix() const {
+        rocksdb::Slice key = it->key();
+        key.remove_prefix(prefix.size());
+        return key;
+    }
+
+    rocksdb::Slice value() const { return it->value(); }
+
+    void seek(const rocksdb::Slice& target_suffix) { it->Seek(prefix + target_suffix.ToString()); }
+    void next() { it->Next(); }
+    rocksdb::Status status() const { return it->status(); }
+
+private:
+    std::string prefix;
+    std::string lower_suffix;
+    std::string upper_key;
+    rocksdb::Slice upper_bound;
+    std::unique_ptr<rocksdb::Iterator> it;
+};
+
+// Yields the suffixes present in every cursor, in ascending order, by
+// leapfrogging: each lagging cursor seeks straight to the largest current
+// suffix, so non-matching runs are skipped without being read.
+class Intersection {
+public:
+    explicit Intersection(std::vector<std::unique_ptr<PrefixCursor>> cursors) : cursors(std::move(cursors)) {}
+
+    bool next(std::string& suffix);
+
+private:
+    void check_status() const;
+
+    std::vector<std::unique_ptr<PrefixCursor>> cursors;
+};
+
+#endif // PREFIX_CURSOR_H
@@ -0,0 +1,112 @@
+#include "reference_cache.h"
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+// Rough per-entry cost of the list node, index slot and bookkeeping
+const size_t ENTRY_OVERHEAD = 128;
+
+}
+
+ReferenceCache::ReferenceCache(size_t max_bytes, size_t shard_count, std::chrono::milliseconds negative_ttl)
+    : shard_capacity(max_bytes / std::max<size_t>(shard_count, 1)),
+      negative_ttl(negative_ttl),
+      hit_count(0),
+      missing_hit_count(0),
+      miss_count(0) {
+    for (size_t i = 0; i < std::max<size_t>(shard_count, 1); ++i) {
+        shards.emplace_back(new Shard());
+    }
+}
+
+ReferenceCache::Result ReferenceCache::lookup(const std::string& reference, Record& record, int64_t& timestamp,
+                                              uint64_t& version) {
+    Shard& shard = shard_of(reference);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(reference);
+    if (it != shard.index.end()) {
+        Entry& entry = *it->second;
+        if (entry.record) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            record = entry.record;
+            timestamp = entry.timestamp;
+            hit_count.fetch_add(1, std::memory_order_relaxed);
+            return Result::Hit;
+        }
+        if (std::chrono::steady_clock::now() < entry.expires) {
+            missing_hit_count.fetch_add(1, std::memory_order_relaxed);
+            return Result::Missing;
+        }
+        erase(shard, it->second);
+    }
+    version = shard.version;
+    miss_count.fetch_add(1, std::memory_order_relaxed);
+    return Result::Unknown;
+}
+
+void ReferenceCache::insert(const std::string& reference, int64_t timestamp, Record record) {
+    Shard& shard = shard_of(reference);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ++shard.version;
+    size_t charge = ENTRY_OVERHEAD + 2 * reference.size() + record->size();
+    put(shard, Entry{reference, std::move(record), timestamp, {}, charge});
+}
+
+void ReferenceCache::insert_missing(const std::string& reference, uint64_t version) {
+    if (negative_ttl.count() <= 0) {
+        return;
+    }
+    Shard& shard = shard_of(reference);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.version != version) {
+        return;
+    }
+    size_t charge = ENTRY_OVERHEAD + 2 * reference.size();
+    put(shard, Entry{reference, nullptr, 0, std::chrono::steady_clock::now() + negative_ttl, charge});
+}
+
+void ReferenceCache::clear() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        ++shard->version;
+        shard->index.clear();
+        shard->lru.clear();
+        shard->bytes = 0;
+    }
+}
+
+size_t ReferenceCache::bytes() const {
+    size_t total = 0;
+    for (const auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->bytes;
+    }
+    return total;
+}
+
+ReferenceCache::Shard& ReferenceCache::shard_of(const std::string& reference) {
+    return *shards[std::hash<std::string>()(reference) % shards.size()];
+}
+
+void ReferenceCache::put(Shard& shard, Entry entry) {
+    auto existing = shard.index.find(entry.reference);
+    if (existing != shard.index.end()) {
+        erase(shard, existing->second);
+    }
+    if (entry.charge > shard_capacity) {
+        return;
+    }
+    while (shard.bytes + entry.charge > shard_capacity) {
+        erase(shard, std::prev(shard.lru.end()));
+    }
+    shard.bytes += entry.charge;
+    shard.lru.push_front(std::move(entry));
+    shard.index.emplace(shard.lru.front().reference, shard.lru.begin());
+}
+
+void ReferenceCache::erase(Shard& shard, std::list<Entry>::iterator it) {
+    shard.bytes -= it->charge;
+    shard.index.erase(it->reference);
+    shard.lru.erase(it);
+}
@@ -0,0 +1,76 @@
+#ifndef REFERENCE_CACHE_H
+#define REFERENCE_CACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Stored records of recently inserted or looked-up logs, by reference, plus
+// short-lived entries for references that were found missing. Split into
+// shards by reference hash, each an LRU list under its own mutex holding up
+// to max_bytes / shards bytes, so concurrent lookups rarely contend.
+class ReferenceCache {
+public:
+    // Shared so a hit is handed out without copying the record
+    using Record = std::shared_ptr<const std::string>;
+
+    enum class Result { Hit, Missing, Unknown };
+
+    ReferenceCache(size_t max_bytes, size_t shards, std::chrono::milliseconds negative_ttl);
+
+    // Hit fills in the record and its timestamp; Missing means the reference
+    // was recently found absent. On Unknown, version is what to pass to
+    // insert_missing after reading the database.
+    Result lookup(const std::string& reference, Record& record, int64_t& timestamp, uint64_t& version);
+
+    void insert(const std::string& reference, int64_t timestamp, Record record);
+    // Remembers for negative_ttl that the reference is absent, unless the
+    // shard has seen an insert since version was taken: that insert may be
+    // the reference, committed after the read that missed it
+    void insert_missing(const std::string& reference, uint64_t version);
+    // Forgets everything; for writes that bypass insert
+    void clear();
+
+    uint64_t hits() const { return hit_count.load(std::memory_order_relaxed); }
+    uint64_t missing_hits() const { return missing_hit_count.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return miss_count.load(std::memory_order_relaxed); }
+    size_t bytes() const;
+
+private:
+    struct Entry {
+        std::string reference;
+        Record record;  // null for a missing reference
+        int64_t timestamp;
+        std::chrono::steady_clock::time_point expires;  // missing references only
+        size_t charge;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru;  // most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;  // views into lru
+        size_t bytes = 0;
+        uint64_t version = 0;  // bumped by every insert and clear
+    };
+
+    Shard& shard_of(const std::string& reference);
+    // Callers hold the shard mutex
+    void put(Shard& shard, Entry entry);
+    void erase(Shard& shard, std::list<Entry>::iterator it);
+
+    size_t shard_capacity;
+    std::chrono::milliseconds negative_ttl;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint64_t> hit_count;
+    std::atomic<uint64_t> missing_hit_count;
+    std::atomic<uint64_t> miss_count;
+};
+
+#endif // REFERENCE_CACHE_H
@@ -0,0 +1,804 @@
+#include "request_handler.h"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "json_writer.h"
+#include "log.h"
+#include "logger.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+const size_t SCAN_BATCH_SIZE = 256;
+const size_t STREAM_CHUNK_BYTES = 64 * 1024;
+// Live tails look for new logs this often, and send an empty line after
+// this long without any so that clients that went away are noticed
+const std::chrono::milliseconds TAIL_POLL_INTERVAL(100);
+const std::chrono::milliseconds TAIL_HEARTBEAT(15000);
+const size_t TAIL_READ_BATCHES = 64;
+// Bodies can be megabytes; debug lines show only their start
+const size_t DEBUG_BODY_BYTES = 1024;
+
+const char* const INGEST_ACTIONS[] = {"insert", "batch_insert", "bulk_load", "convert_records"};
+const char* const QUERY_ACTIONS[] = {"query_by_reference", "query", "query_all", "aggregate", "sketch"};
+
+// Live tails and unknown actions are not counted against either budget
+bool traffic_class_of(const std::string& action, TrafficClass& traffic) {
+    if (std::find(std::begin(INGEST_ACTIONS), std::end(INGEST_ACTIONS), action) != std::end(INGEST_ACTIONS)) {
+        traffic = TrafficClass::Ingest;
+        return true;
+    }
+    if (std::find(std::begin(QUERY_ACTIONS), std::end(QUERY_ACTIONS), action) != std::end(QUERY_ACTIONS)) {
+        traffic = TrafficClass::Query;
+        return true;
+    }
+    return false;
+}
+
+std::string_view body_excerpt(std::string_view body) {
+    return body.substr(0, DEBUG_BODY_BYTES);
+}
+
+json log_to_json(const Log& log) {
+    return {
+        {"reference", log.reference()},
+        {"metadata", log.metadata()},
+        {"timestamp", log.timestamp()}
+    };
+}
+
+// Cursors are opaque to clients: a kind byte ('a' for query_all, 't' for
+// query) followed by the scanner position, hex encoded
+std::string encode_cursor(const std::string& key, char kind) {
+    static const char digits[] = "0123456789abcdef";
+    std::string token;
+    token.reserve(2 * (key.size() + 1));
+    std::string raw = kind + key;
+    for (unsigned char c : raw) {
+        token.push_back(digits[c >> 4]);
+        token.push_back(digits[c & 0x0f]);
+    }
+    return token;
+}
+
+std::string decode_cursor(const std::string& token, char kind) {
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    std::string raw;
+    for (size_t i = 0; i + 1 < token.size(); i += 2) {
+        int high = nibble(token[i]);
+        int low = nibble(token[i + 1]);
+        if (high < 0 || low < 0) {
+            throw std::runtime_error("Invalid cursor");
+        }
+        raw.push_back(static_cast<char>((high << 4) | low));
+    }
+    if (token.size() % 2 != 0 || raw.empty() || raw[0] != kind) {
+        throw std::runtime_error("Invalid cursor");
+    }
+    return raw.substr(1);
+}
+
+// "query" takes an optional time range and optional equality filters on
+// metadata fields, e.g. {"filters": {"event": "user_login"}}
+LogQuery parse_query(const json& j) {
+    LogQuery query;
+    query.start_timestamp = j.value("start_timestamp", query.start_timestamp);
+    query.end_timestamp = j.value("end_timestamp", query.end_timestamp);
+    if (j.contains("filters")) {
+        if (!j["filters"].is_object()) {
+            throw std::runtime_error("'filters' must be an object");
+        }
+        for (const auto& filter : j["filters"].items()) {
+            std::string text;
+            if (!metadata_value_text(filter.value(), text)) {
+                throw std::runtime_error("Filter values must be strings, numbers or booleans");
+            }
+            query.filters[filter.key()] = text;
+        }
+    }
+    return query;
+}
+
+// "aggregate" takes the same range and filters as "query", plus an optional
+// "group_by" field and an optional "interval" for time buckets: "minute",
+// "hour", "day" or a width in milliseconds
+AggregateQuery parse_aggregate_query(const json& j) {
+    AggregateQuery query;
+    query.query = parse_query(j);
+    query.group_by = j.value("group_by", "");
+    if (j.contains("interval")) {
+        const json& interval = j["interval"];
+        if (interval == "minute") {
+            query.bucket_ms = 60 * 1000;
+        } else if (interval == "hour") {
+            query.bucket_ms = 60 * 60 * 1000;
+        } else if (interval == "day") {
+            query.bucket_ms = 24 * 60 * 60 * 1000;
+        } else if (interval.is_number_integer() && interval.get<int64_t>() > 0) {
+            query.bucket_ms = interval.get<int64_t>();
+        } else {
+            throw std::runtime_error("'interval' must be minute, hour, day or a positive number of milliseconds");
+        }
+    }
+    return query;
+}
+
+// Inserts take an optional "durability" of "memory", "wal" (the default) or
+// "sync"
+Durability parse_write_durability(const json& j) {
+    Durability durability = Durability::Wal;
+    if (j.contains("durability") &&
+        !(j["durability"].is_string() && parse_durability(j["durability"].get<std::string>(), durability))) {
+        throw std::runtime_error("'durability' must be memory, wal or sync");
+    }
+    return durability;
+}
+
+json groups_to_json(const std::map<std::string, uint64_t>& groups) {
+    json result = json::object();
+    for (const auto& group : groups) {
+        result[group.first] = group.second;
+    }
+    return result;
+}
+
+// Streams scan results as newline-delimited JSON, one log per line, reading
+// from the iterator only as fast as the socket accepts chunks
+class NdjsonLogStream : public HttpBodyStream {
+public:
+    // The ticket is held until the stream is done with
+    NdjsonLogStream(std::unique_ptr<LogScanner> scanner, std::shared_ptr<Metrics> metrics,
+                    AdmissionController::Ticket ticket)
+        : scanner(std::move(scanner)), metrics(std::move(metrics)), ticket(std::move(ticket)) {}
+
+    bool next_chunk(std::string& out) override {
+        out.clear();
+        bool more = true;
+        while (more && out.size() < STREAM_CHUNK_BYTES) {
+            logs.clear();
+            {
+                LatencyTimer timer(*metrics, Metrics::Stage::DbRead);
+                more = scanner->next(logs, SCAN_BATCH_SIZE);
+            }
+            for (const auto& log : logs) {
+                log.append_json(out);
+                out += '\n';
+            }
+        }
+        if (!more) {
+            ticket.release();
+        }
+        return more;
+    }
+
+private:
+    std::unique_ptr<LogScanner> scanner;
+    std::shared_ptr<Metrics> metrics;
+    AdmissionController::Ticket ticket;
+    std::vector<Log> logs;
+};
+
+// Follows the logs committed after the tail was opened, as NDJSON. It never
+// ends on its own: with nothing new to send the server polls it again. Logs a
+// slow client missed are reported with a {"skipped": N} line.
+class NdjsonTailStream : public HttpBodyStream {
+public:
+    NdjsonTailStream(std::shared_ptr<DBWrapper> db, std::unique_ptr<LogTail::Reader> reader,
+                     std::map<std::string, std::string> filters)
+        : db(std::move(db)), reader(std::move(reader)), filters(std::move(filters)),
+          last_sent(std::chrono::steady_clock::now()) {}
+
+    bool next_chunk(std::string& out) override {
+        out.clear();
+        while (out.size() < STREAM_CHUNK_BYTES) {
+            batches.clear();
+            uint64_t skipped = 0;
+            reader->read(batches, TAIL_READ_BATCHES, skipped);
+            if (skipped > 0) {
+                out += "{\"skipped\":" + std::to_string(skipped) + "}\n";
+            }
+            if (batches.empty()) {
+                break;
+            }
+            for (const auto& batch : batches) {
+                for (const auto& entry : batch->entries) {
+                    if (matches(*entry.record)) {
+                        Log::append_record_json(*entry.record, out);
+                        out += '\n';
+                    }
+                }
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (!out.empty()) {
+            last_sent = now;
+        } else if (now - last_sent >= TAIL_HEARTBEAT) {
+            out = "\n";
+            last_sent = now;
+        }
+        return true;
+    }
+
+    std::chrono::milliseconds poll_interval() const override { return TAIL_POLL_INTERVAL; }
+
+private:
+    bool matches(const std::string& record) const {
+        if (filters.empty()) {
+            return true;
+        }
+        size_t matched = 0;
+        for_each_msgpack_field_text(Log::record_metadata(record),
+            [&](std::string_view key, const std::string& text) {
+                auto it = filters.find(std::string(key));
+                if (it != filters.end() && it->second == text) {
+                    ++matched;
+                }
+            });
+        return matched == filters.size();
+    }
+
+    std::shared_ptr<DBWrapper> db;  // outlives the reader
+    std::unique_ptr<LogTail::Reader> reader;
+    std::map<std::string, std::string> filters;
+    std::chrono::steady_clock::time_point last_sent;
+    std::vector<std::shared_ptr<const LogTail::Batch>> batches;
+};
+
+}
+
+RequestHandlerOptions RequestHandlerOptions::from_config(const ConfigReader& config) {
+    RequestHandlerOptions options;
+    options.allow_bulk_load = config.getString("server", "allow_bulk_load", "false") == "true";
+    options.max_page_logs = std::max<int64_t>(1, config.getInt64("query", "max_page_logs", options.max_page_logs));
+    return options;
+}
+
+RequestHandler::RequestHandler(std::shared_ptr<DBWrapper> db, std::shared_ptr<Metrics> metrics,
+                               std::shared_ptr<AdmissionController> admission, const RequestHandlerOptions& options)
+    : db(std::move(db)), metrics(std::move(metrics)), admission(std::move(admission)), options(options) {
+    DBWrapper* database = this->db.get();
+    AdmissionController* controller = this->admission.get();
+    this->metrics->add_callback("stickylogs_rocksdb_pending_compaction_bytes", "gauge",
+        "Estimated bytes compaction still has to rewrite.",
+        [database]() { return database->property_total("rocksdb.estimate-pending-compaction-bytes"); });
+    this->metrics->add_callback("stickylogs_rocksdb_memtable_bytes", "gauge",
+        "Size of all memtables.",
+        [database]() { return database->property_total("rocksdb.cur-size-all-mem-tables"); });
+    this->metrics->add_callback("stickylogs_rocksdb_live_sst_bytes", "gauge",
+        "Size of the live SST files.",
+        [database]() { return database->property_total("rocksdb.live-sst-files-size"); });
+    this->metrics->add_callback("stickylogs_rocksdb_stall_micros_total", "counter",
+        "Time writes were stalled by RocksDB.",
+        [database]() { return database->ticker(rocksdb::STALL_MICROS); });
+    this->metrics->add_callback("stickylogs_ingest_queue_logs", "gauge",
+        "Logs of async inserts waiting to be committed.",
+        [database]() { return database->ingest_queue_logs(); });
+    this->metrics->add_callback("stickylogs_ingest_failed_logs_total", "counter",
+        "Logs of async inserts whose commit failed.",
+        [database]() { return database->ingest_failed_logs(); });
+    this->metrics->add_callback("stickylogs_reference_cache_hits_total", "counter",
+        "Lookups by reference answered with a cached log.",
+        [database]() { return database->reference_cache_stats().hits; });
+    this->metrics->add_callback("stickylogs_reference_cache_missing_hits_total", "counter",
+        "Lookups by reference answered from a cached miss.",
+        [database]() { return database->reference_cache_stats().missing_hits; });
+    this->metrics->add_callback("stickylogs_reference_cache_misses_total", "counter",
+        "Lookups by reference that went to RocksDB.",
+        [database]() { return database->reference_cache_stats().misses; });
+    this->metrics->add_callback("stickylogs_reference_cache_bytes", "gauge",
+        "Memory charged to the reference cache.",
+        [database]() { return database->reference_cache_stats().bytes; });
+    this->metrics->add_callback("stickylogs_tail_subscribers", "gauge",
+        "Live tails currently open.",
+        [database]() { return database->tail_subscribers(); });
+    this->metrics->add_callback("stickylogs_rocksdb_block_cache_hit_ratio", "gauge",
+        "Block cache hits over all block cache lookups.",
+        [database]() {
+            double hits = database->ticker(rocksdb::BLOCK_CACHE_HIT);
+            double misses = database->ticker(rocksdb::BLOCK_CACHE_MISS);
+            return hits + misses > 0 ? hits / (hits + misses) : 0.0;
+        });
+    this->metrics->add_callback("stickylogs_ingest_requests_in_flight", "gauge",
+        "Ingest requests being handled.",
+        [controller]() { return controller->in_flight(TrafficClass::Ingest); });
+    this->metrics->add_callback("stickylogs_query_requests_in_flight", "gauge",
+        "Query requests being handled, open query streams included.",
+        [controller]() { return controller->in_flight(TrafficClass::Query); });
+    this->metrics->add_callback("stickylogs_ingest_rejected_total", "counter",
+        "Ingest requests turned away by admission control.",
+        [controller]() { return controller->rejected(TrafficClass::Ingest); });
+    this->metrics->add_callback("stickylogs_query_rejected_total", "counter",
+        "Query requests turned away by admission control.",
+        [controller]() { return controller->rejected(TrafficClass::Query); });
+    this->metrics->add_callback("stickylogs_storage_stall_state", "gauge",
+        "Storage state as seen by admission control: 0 normal, 1 delayed, 2 stalled.",
+        [controller]() { return static_cast<int>(controller->storage_state()); });
+}
+
+HttpResponse RequestHandler::handle_get(const HttpRequest& request) {
+    HttpResponse http_response;
+    if (request.target == "/metrics") {
+        http_response.content_type = "text/plain; version=0.0.4";
+        http_response.body = metrics->render();
+    } else {
+        http_response.status_code = 404;
+        http_response.body = "{\"success\":false,\"message\":\"Not found\"}";
+    }
+    return http_response;
+}
+
+RequestHandler::~RequestHandler() {
+    if (maintenance_thread.joinable()) {
+        maintenance_thread.join();
+    }
+}
+
+HttpResponse RequestHandler::handle(const HttpRequest& request, HttpResponder respond) {
+    if (request.method == "GET") {
+        return handle_get(request);
+    }
+
+    HttpResponse http_response;
+    try {
+        LOG_DEBUG("Received body: " << body_excerpt(request.body));
+
+        json j;
+        {
+            LatencyTimer timer(*metrics, Metrics::Stage::Parse);
+            j = json::parse(request.body);
+        }
+        std::string action = j["action"];
+        metrics->count_request(action);
+
+        LOG_DEBUG("Action: " << action);
+
+        // Turned away before any work is done, with a hint of when to retry
+        AdmissionController::Ticket ticket;
+        TrafficClass traffic;
+        if (traffic_class_of(action, traffic)) {
+            AdmissionController::Verdict verdict = admission->admit(traffic, ticket);
+            if (verdict != AdmissionController::Verdict::Admitted) {
+                bool stalled = verdict == AdmissionController::Verdict::Stalled;
+                http_response.status_code = stalled ? 503 : 429;
+                http_response.headers.emplace_back("Retry-After", std::to_string(admission->retry_after().count()));
+                json rejected = {
+                    {"success", false},
+                    {"message", stalled ? "Storage is catching up, retry later" : "Too many requests, retry later"}
+                };
+                http_response.body = rejected.dump();
+                return http_response;
+            }
+        }
+
+        json response;
+
+        // With "async": true inserts are acknowledged once queued, before
+        // they are committed, and duplicates are not reported
+        if ((action == "insert" || action == "batch_insert") && j.value("async", false)) {
+            std::vector<Log> logs;
+            if (action == "insert") {
+                logs.emplace_back(j["reference"], j["metadata"]);
+            } else {
+                if (!j.contains("logs") || !j["logs"].is_array()) {
+                    throw std::runtime_error("Invalid batch insert request");
+                }
+                for (const auto& log_json : j["logs"]) {
+                    if (!log_json.contains("reference") || !log_json.contains("metadata")) {
+                        throw std::runtime_error("Invalid log entry in batch");
+                    }
+                    logs.emplace_back(log_json["reference"], log_json["metadata"]);
+                }
+            }
+            size_t count = logs.size();
+            bool queued;
+            {
+                LatencyTimer timer(*metrics, Metrics::Stage::DbWrite);
+                queued = db->enqueue_logs(std::move(logs), parse_write_durability(j));
+            }
+            if (!queued) {
+                http_response.status_code = 503;
+                http_response.headers.emplace_back("Retry-After", std::to_string(admission->retry_after().count()));
+            }
+            response["success"] = queued;
+            response["message"] = queued ? "Logs queued" : "Ingest queue full, retry later";
+            response["count"] = count;
+        }
+        else if (action == "insert") {
+            std::vector<Log> logs;
+            logs.emplace_back(j["reference"], j["metadata"]);
+            return insert_deferred(std::move(logs), parse_write_durability(j), std::move(ticket), std::move(respond),
+                [](const std::vector<Log>& logs, const std::vector<InsertStatus>& statuses) {
+                    json response;
+                    response["success"] = statuses[0] == InsertStatus::Inserted;
+                    switch (statuses[0]) {
+                        case InsertStatus::Inserted: response["message"] = "Log saved successfully"; break;
+                        case InsertStatus::Duplicate: response["message"] = "Reference already exists"; break;
+                        case InsertStatus::Expired: response["message"] = "Log is older than the retention window"; break;
+                    }
+                    response["status"] = insert_status_name(statuses[0]);
+                    response["log"] = log_to_json(logs[0]);
+                    return response;
+                });
+        }
+        else if (action == "batch_insert") {
+            LOG_DEBUG("Handling batch insert");
+            if (!j.contains("logs") || !j["logs"].is_array()) {
+                LOG_DEBUG("Invalid batch insert request: missing or invalid 'logs' field");
+                throw std::runtime_error("Invalid batch insert request");
+            }
+            std::vector<Log> logs;
+            for (const auto& log_json : j["logs"]) {
+                if (!log_json.contains("reference") || !log_json.contains("metadata")) {
+                    LOG_DEBUG("Invalid log entry in batch: " << body_excerpt(log_json.dump()));
+                    throw std::runtime_error("Invalid log entry in batch");
+                }
+                logs.emplace_back(log_json["reference"], log_json["metadata"]);
+            }
+            LOG_DEBUG("Parsed " << logs.size() << " logs");
+            return insert_deferred(std::move(logs), parse_write_durability(j), std::move(ticket), std::move(respond),
+                [](const std::vector<Log>& logs, const std::vector<InsertStatus>& statuses) {
+                    size_t inserted_count = std::count(statuses.begin(), statuses.end(), InsertStatus::Inserted);
+                    size_t expired_count = std::count(statuses.begin(), statuses.end(), InsertStatus::Expired);
+                    json response;
+                    response["success"] = true;
+                    if (inserted_count == logs.size()) {
+                        response["message"] = "Logs saved successfully";
+                    } else if (expired_count == 0) {
+                        response["message"] = "Logs saved, duplicate references skipped";
+                    } else {
+                        response["message"] = "Logs saved, duplicate references and expired logs skipped";
+                    }
+                    response["count"] = logs.size();
+                    response["inserted"] = inserted_count;
+                    response["duplicates"] = logs.size() - inserted_count - expired_count;
+                    response["expired"] = expired_count;
+                    response["results"] = json::array();
+                    for (size_t i = 0; i < logs.size(); ++i) {
+                        response["results"].push_back({
+                            {"reference", logs[i].reference()},
+                            {"status", insert_status_name(statuses[i])}
+                        });
+                    }
+                    LOG_DEBUG("Batch insert completed. Inserted: " << inserted_count);
+                    return response;
+                });
+        }
+        else if (action == "query_by_reference") {
+            std::string reference = j["reference"];
+            ReferenceCache::Record record;
+            LookupStatus status;
+            {
+                LatencyTimer timer(*metrics, Metrics::Stage::DbRead);
+                status = db->find_log_record(reference, record);
+            }
+            if (status == LookupStatus::NotFound) {
+                response["success"] = false;
+                response["message"] = "Log not found";
+            } else {
+                // The stored record is transcoded straight into the body,
+                // without building a Log or a json tree
+                std::string body = "{\"log\":";
+                Log::append_record_json(*record, body);
+                body += ",\"message\":\"Log found\",\"success\":true}";
+                http_response.body = std::move(body);
+                return http_response;
+            }
+        }
+        else if (action == "query" || action == "query_all") {
+            // Results can be paged with "limit" and the "next_cursor" of the
+            // previous page, or streamed as NDJSON with "stream": true. Streams
+            // and unlimited queries read the whole range, so they are scanned
+            // in parallel; streams may also give up ordering with
+            // "ordered": false to get logs as soon as any range has them.
+            char cursor_kind = action == "query" ? 't' : 'a';
+            std::string after_key = j.contains("cursor") ? decode_cursor(j["cursor"], cursor_kind) : "";
+            LogQuery query = action == "query" ? parse_query(j) : LogQuery();
+            bool stream = j.value("stream", false);
+            // 0 = the whole range; larger pages are cut to max_page_logs
+            int64_t requested_limit = j.value("limit", static_cast<int64_t>(0));
+            if (requested_limit < 0) {
+                throw std::runtime_error("'limit' must not be negative");
+            }
+            size_t limit = std::min(static_cast<size_t>(requested_limit), options.max_page_logs);
+            std::unique_ptr<LogScanner> scanner = stream || limit == 0
+                ? db->scan_query_parallel(query, after_key, !stream || j.value("ordered", true))
+                : db->scan_query(query, after_key);
+
+            if (stream) {
+                http_response.content_type = "application/x-ndjson";
+                http_response.stream = std::make_shared<NdjsonLogStream>(std::move(scanner), metrics, std::move(ticket));
+                return http_response;
+            }
+
+            std::vector<Log> logs;
+            bool more = false;
+            {
+                LatencyTimer timer(*metrics, Metrics::Stage::DbRead);
+                if (limit > 0) {
+                    more = scanner->next(logs, limit);
+                } else {
+                    while (scanner->next(logs, SCAN_BATCH_SIZE)) {
+                    }
+                }
+            }
+
+            // Logs are written into the body directly rather than through a
+            // json tree; keys in the same order json::dump() uses
+            std::string body = "{\"count\":" + std::to_string(logs.size()) + ",\"logs\":[";
+            for (size_t i = 0; i < logs.size(); ++i) {
+                if (i > 0) {
+                    body += ',';
+                }
+                logs[i].append_json(body);
+            }
+            body += "],\"message\":";
+            body += action == "query" ? "\"Query executed successfully\"" : "\"All logs retrieved successfully\"";
+            body += ",\"next_cursor\":";
+            body += more ? json(encode_cursor(scanner->position(), cursor_kind)).dump() : "null";
+            body += ",\"success\":true}";
+            http_response.body = std::move(body);
+            return http_response;
+        }
+        else if (action == "aggregate") {
+            // Only the aggregated numbers are returned, never the logs
+            AggregateQuery query = parse_aggregate_query(j);
+            AggregateResult result;
+            {
+                LatencyTimer timer(*metrics, Metrics::Stage::DbRead);
+                result = db->aggregate(query);
+            }
+            response["success"] = true;
+            response["count"] = result.count;
+            if (query.bucket_ms > 0) {
+                response["interval_ms"] = query.bucket_ms;
+                response["buckets"] = json::array();
+                for (const auto& bucket : result.counts) {
+                    json entry = {{"start", bucket.first}};
+                    entry["count"] = result.bucket_count(bucket.first);
+                    if (!query.group_by.empty()) {
+                        entry["groups"] = groups_to_json(bucket.second);
+                        entry["missing"] = result.missing_count(bucket.first);
+                    }
+                    response["buckets"].push_back(entry);
+                }
+            } else if (!query.group_by.empty()) {
+                response["groups"] = result.counts.empty() ? json::object() : groups_to_json(result.counts.begin()->second);
+                response["missing"] = result.missing_count(0);
+            }
+            response["message"] = "Aggregation executed successfully";
+        }
+        else if (action == "sketch") {
+            // Merged sketch of a configured "name" over the buckets that
+            // overlap the time range; "quantiles", "top" and "group" are
+            // optional
+            if (!j.contains("name") || !j["name"].is_string()) {
+                throw std::runtime_error("'name' must name a configured sketch");
+            }
+            SketchReadOptions read_options;
+            if (j.contains("quantiles")) {
+                read_options.quantiles = j["quantiles"].get<std::vector<double>>();
+                for (double q : read_options.quantiles) {
+                    if (!(q >= 0 && q <= 1)) {
+                        throw std::runtime_error("Quantiles must be between 0 and 1");
+                    }
+                }
+            }
+            read_options.top = j.value("top", read_options.top);
+            std::string group = j.value("group", "");
+            SketchQueryResult result;
+            {
+                LatencyTimer timer(*metrics, Metrics::Stage::DbRead);
+                result = db->query_sketch(j["name"].get<std::string>(), j.value("start_timestamp", INT64_MIN),
+                                          j.value("end_timestamp", INT64_MAX), group);
+            }
+            const SketchDefinition& definition = *result.definition;
+            response["success"] = true;
+            response["name"] = definition.name;
+            response["type"] = sketch_type_name(definition.type);
+            response["field"] = definition.field;
+            response["bucket_ms"] = definition.bucket_ms;
+            response["buckets"] = result.buckets.size();
+            if (!result.buckets.empty()) {
+                response["start_timestamp"] = *result.buckets.begin();
+                response["end_timestamp"] = *result.buckets.rbegin() + definition.bucket_ms - 1;
+            }
+            if (definition.group_by.empty()) {
+                auto it = result.groups.find("");
+                response["result"] = it != result.groups.end() ? it->second->to_json(read_options)
+                                                               : definition.create()->to_json(read_options);
+            } else {
+                response["group_by"] = definition.group_by;
+                json groups = json::object();
+                for (const auto& entry : result.groups) {
+                    groups[entry.first] = entry.second->to_json(read_options);
+                }
+                response["groups"] = groups;
+            }
+            response["message"] = "Sketch read successfully";
+        }
+        else if (action == "tail") {
+            // Streams logs as they are inserted, optionally narrowed down
+            // with "filters" as in "query"
+            std::map<std::string, std::string> filters = parse_query(j).filters;
+            std::unique_ptr<LogTail::Reader> reader = db->subscribe();
+            if (!reader) {
+                http_response.status_code = 503;
+                response["success"] = false;
+                response["message"] = "Too many tail subscribers, retry later";
+            } else {
+                http_response.content_type = "application/x-ndjson";
+                http_response.stream = std::make_shared<NdjsonTailStream>(db, std::move(reader), std::move(filters));
+                return http_response;
+            }
+        }
+        else if (action == "convert_records") {
+            auto held = std::make_shared<AdmissionController::Ticket>(std::move(ticket));
+            return run_maintenance([this, held]() {
+                json response;
+                response["success"] = true;
+                response["message"] = "Legacy records converted";
+                response["count"] = db->convert_legacy_records();
+                held->release();
+                return response;
+            }, std::move(respond));
+        }
+        else if (action == "bulk_load") {
+            // Admin action: "path" names an NDJSON file on the server's disk,
+            // so it is off unless the configuration allows it
+            if (!options.allow_bulk_load) {
+                http_response.status_code = 403;
+                http_response.body = "{\"success\":false,\"message\":\"bulk_load is disabled; "
+                                     "use the load command or set server.allow_bulk_load\"}";
+                return http_response;
+            }
+            if (!j.contains("path") || !j["path"].is_string()) {
+                throw std::runtime_error("'path' must be the path of an NDJSON file on the server");
+            }
+            std::string path = j["path"].get<std::string>();
+            size_t threads = j.value("threads", 0);
+            auto held = std::make_shared<AdmissionController::Ticket>(std::move(ticket));
+            return run_maintenance([this, held, path, threads]() {
+                DBWrapper::BulkLoadResult result;
+                {
+                    LatencyTimer timer(*metrics, Metrics::Stage::DbWrite);
+                    result = db->bulk_load(path, threads);
+                }
+                held->release();
+                json response;
+                response["success"] = true;
+                response["message"] = "Bulk load completed";
+                response["read"] = result.read;
+                response["loaded"] = result.loaded;
+                response["duplicates"] = result.duplicates;
+                response["expired"] = result.expired;
+                response["invalid"] = result.invalid;
+                return response;
+            }, std::move(respond));
+        }
+        else {
+            response["success"] = false;
+            response["message"] = "Unknown action";
+        }
+
+        LOG_DEBUG("Sending response: " << body_excerpt(response.dump()));
+
+        http_response.body = response.dump();
+    }
+    catch (const std::exception& e) {
+        http_response = error_response(e);
+    }
+    return http_response;
+}
+
+HttpResponse RequestHandler::error_response(const std::exception& e) {
+    LOG_WARN("Exception in request handler: " << e.what());
+    metrics->count_error();
+    json error_response = {
+        {"success", false},
+        {"message", std::string("Error: ") + e.what()}
+    };
+    HttpResponse http_response;
+    http_response.status_code = 400;
+    http_response.body = error_response.dump();
+    return http_response;
+}
+
+HttpResponse RequestHandler::insert_deferred(std::vector<Log> logs, Durability durability,
+                                             AdmissionController::Ticket ticket, HttpResponder respond,
+                                             InsertReply reply) {
+    // Shared by the callback, which std::function needs to be able to copy
+    auto pending = std::make_shared<std::vector<Log>>(std::move(logs));
+    auto held = std::make_shared<AdmissionController::Ticket>(std::move(ticket));
+    auto start = std::chrono::steady_clock::now();
+    begin_deferred();
+    try {
+        db->batch_insert_logs_async(*pending, durability,
+            [this, pending, held, start, respond = std::move(respond), reply = std::move(reply)](
+                    std::vector<InsertStatus> statuses, const std::exception_ptr& error) {
+                metrics->record_latency(Metrics::Stage::DbWrite, std::chrono::steady_clock::now() - start);
+                held->release();
+                HttpResponse http_response;
+                try {
+                    if (error) {
+                        std::rethrow_exception(error);
+                    }
+                    json response = reply(*pending, statuses);
+                    LOG_DEBUG("Sending response: " << body_excerpt(response.dump()));
+                    http_response.body = response.dump();
+                } catch (const std::exception& e) {
+                    http_response = error_response(e);
+                }
+                respond(std::move(http_response));
+                end_deferred();
+            });
+    } catch (...) {
+        end_deferred();
+        throw;
+    }
+    HttpResponse http_response;
+    http_response.deferred = true;
+    return http_response;
+}
+
+HttpResponse RequestHandler::run_maintenance(std::function<json()> job, HttpResponder respond) {
+    std::lock_guard<std::mutex> lock(maintenance_mutex);
+    if (maintenance_running) {
+        HttpResponse http_response;
+        http_response.status_code = 409;
+        http_response.body = "{\"success\":false,\"message\":\"Another maintenance action is running\"}";
+        return http_response;
+    }
+    // The previous job is done with the lock; only its thread may be left
+    if (maintenance_thread.joinable()) {
+        maintenance_thread.join();
+    }
+    maintenance_running = true;
+    begin_deferred();
+    maintenance_thread = std::thread([this, job = std::move(job), respond = std::move(respond)]() {
+        HttpResponse http_response;
+        try {
+            json response = job();
+            LOG_DEBUG("Sending response: " << body_excerpt(response.dump()));
+            http_response.body = response.dump();
+        } catch (const std::exception& e) {
+            http_response = error_response(e);
+        }
+        {
+            std::lock_guard<std::mutex> lock(maintenance_mutex);
+            maintenance_running = false;
+        }
+        respond(std::move(http_response));
+        end_deferred();
+    });
+    HttpResponse http_response;
+    http_response.deferred = true;
+    return http_response;
+}
+
+void RequestHandler::begin_deferred() {
+    std::lock_guard<std::mutex> lock(deferred_mutex);
+    ++deferred_count;
+}
+
+void RequestHandler::end_deferred() {
+    {
+        std::lock_guard<std::mutex> lock(deferred_mutex);
+        --deferred_count;
+    }
+    deferred_done.notify_all();
+}
+
+void RequestHandler::wait_for_deferred() {
+    std::unique_lock<std::mutex> lock(deferred_mutex);
+    deferred_done.wait(lock, [this]() { return deferred_count == 0; });
+}
@@ -0,0 +1,73 @@
+#ifndef REQUEST_HANDLER_H
+#define REQUEST_HANDLER_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "admission.h"
+#include "config_reader.h"
+#include "db_wrapper.h"
+#include "http.h"
+#include "metrics.h"
+
+struct RequestHandlerOptions {
+    bool allow_bulk_load = false;  // the "bulk_load" action, which reads files on the server
+    size_t max_page_logs = 100000;  // largest "limit" a query page may ask for
+
+    static RequestHandlerOptions from_config(const ConfigReader& config);
+};
+
+// Hands over a response that was deferred. May be called from any thread.
+using HttpResponder = std::function<void(HttpResponse response)>;
+
+// Dispatches the JSON actions ("insert", "batch_insert", "query", ...) to the
+// database and serves GET /metrics. Inserts and queries are subject to
+// admission control. Safe to call from several server threads at once.
+class RequestHandler {
+public:
+    RequestHandler(std::shared_ptr<DBWrapper> db, std::shared_ptr<Metrics> metrics,
+                   std::shared_ptr<AdmissionController> admission, const RequestHandlerOptions& options);
+    ~RequestHandler();
+
+    // Actions that wait on storage (synchronous inserts, until their group
+    // is committed, and maintenance actions) return a response marked
+    // deferred and pass the real one to respond once done
+    HttpResponse handle(const HttpRequest& request, HttpResponder respond);
+
+    // Blocks until every deferred response has been handed over, so that
+    // none is handed to a server that is gone
+    void wait_for_deferred();
+
+private:
+    using InsertReply = std::function<nlohmann::json(const std::vector<Log>& logs, const std::vector<InsertStatus>& statuses)>;
+
+    HttpResponse handle_get(const HttpRequest& request);
+    HttpResponse error_response(const std::exception& e);
+    HttpResponse insert_deferred(std::vector<Log> logs, Durability durability, AdmissionController::Ticket ticket,
+                                 HttpResponder respond, InsertReply reply);
+    // Runs a long action (convert_records, bulk_load) on a thread of its
+    // own, one at a time; a second one is answered 409 while the first runs
+    HttpResponse run_maintenance(std::function<nlohmann::json()> job, HttpResponder respond);
+    void begin_deferred();
+    void end_deferred();
+
+    std::shared_ptr<DBWrapper> db;
+    std::shared_ptr<Metrics> metrics;
+    std::shared_ptr<AdmissionController> admission;
+    RequestHandlerOptions options;
+
+    std::mutex deferred_mutex;
+    std::condition_variable deferred_done;
+    size_t deferred_count = 0;
+
+    std::mutex maintenance_mutex;
+    bool maintenance_running = false;
+    std::thread maintenance_thread;
+};
+
+#endif // REQUEST_HANDLER_H
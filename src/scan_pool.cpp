@@ -0,0 +1,44 @@
+#include "scan_pool.h"
+
+ScanPool::ScanPool(size_t threads) : stopping(false) {
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([this]() { run(); });
+    }
+}
+
+ScanPool::~ScanPool() {
+    std::deque<std::function<void()>> discarded;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+        discarded.swap(queue);
+    }
+    queue_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ScanPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(std::move(task));
+    }
+    queue_cv.notify_one();
+}
+
+void ScanPool::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef SCAN_POOL_H
+#define SCAN_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads shared by the parallel scans and aggregations, so
+// that concurrent queries compete for the same cores instead of each
+// starting threads of its own. Tasks must never block waiting on another
+// task or on a consumer, and must not throw; long jobs return and get
+// resubmitted instead.
+class ScanPool {
+public:
+    explicit ScanPool(size_t threads);
+    // Tasks still queued are discarded; running ones are waited for
+    ~ScanPool();
+
+    void submit(std::function<void()> task);
+
+    size_t size() const { return workers.size(); }
+
+private:
+    void run();
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<std::function<void()>> queue;
+    bool stopping;
+    std::vector<std::thread> workers;
+};
+
+#endif // SCAN_POOL_H
@@ -0,0 +1,369 @@
+#include "server.h"
+#include <thread>
+#include <vector>
+#include "logger.h"
+#include "utils.h"
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+const size_t READ_BUFFER_SIZE = 16 * 1024;
+const size_t MAX_HEADER_BYTES = 64 * 1024;
+
+const std::string CONTINUE_RESPONSE = "HTTP/1.1 100 Continue\r\n\r\n";
+const std::string SERVICE_UNAVAILABLE_BODY = "{\"success\":false,\"message\":\"Too many connections\"}";
+
+// Connection state machine: read, parse every complete request in the
+// buffer, handle them in order, write all responses at once, then either
+// read again (keep-alive) or close. A deferred response is waited for
+// without holding the thread, with the requests behind it left in the
+// buffer. Headers and bodies go out as separate
+// pieces of one gathered write, so response bodies are never copied.
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(tcp::socket socket, std::shared_ptr<RequestHandler> handler, Metrics& metrics,
+               const ServerOptions& options, std::atomic<size_t>& connection_count)
+        : socket(std::move(socket)),
+          timer(this->socket.get_executor()),
+          read_buffer(READ_BUFFER_SIZE),
+          parser(MAX_HEADER_BYTES, options.max_request_bytes),
+          handler(std::move(handler)),
+          metrics(metrics),
+          options(options),
+          connection_count(connection_count) {
+        ++connection_count;
+    }
+
+    ~Connection() {
+        --connection_count;
+    }
+
+    void start() {
+        do_read();
+    }
+
+    // Answers 503 and closes; used when the server is at max_connections
+    void reject() {
+        HttpResponse response;
+        response.status_code = 503;
+        response.body = SERVICE_UNAVAILABLE_BODY;
+        response.headers.emplace_back("Retry-After", "1");
+        write(response.to_string(false), AfterWrite::Close);
+    }
+
+private:
+    void do_read() {
+        // Idle keep-alive connections get a separate, usually longer, timeout
+        arm_timer(parser.in_progress() ? options.read_timeout : options.keep_alive_timeout);
+        auto self = shared_from_this();
+        socket.async_read_some(boost::asio::buffer(read_buffer),
+            [this, self](const boost::system::error_code& ec, size_t bytes_transferred) {
+                if (ec) {
+                    if (ec == boost::asio::error::operation_aborted) {
+                        if (parser.in_progress()) {
+                            LOG_WARN("Timeout reading request");
+                        }
+                    } else if (ec != boost::asio::error::eof) {
+                        LOG_WARN("Error reading request: " << ec.message());
+                    }
+                    close();
+                    return;
+                }
+                metrics.add_bytes_in(bytes_transferred);
+                read_offset = 0;
+                read_size = bytes_transferred;
+                process_input();
+            });
+    }
+
+    // What to do once a write has completed
+    enum class AfterWrite { ProcessInput, StreamNext, Close };
+
+    void process_input() {
+        while (after == AfterWrite::ProcessInput && read_offset < read_size) {
+            size_t consumed = 0;
+            HttpRequestParser::Result result = parser.parse(read_buffer.data() + read_offset, read_size - read_offset, consumed);
+            read_offset += consumed;
+
+            if (result == HttpRequestParser::Result::Error) {
+                HttpResponse response;
+                response.status_code = parser.error_status();
+                response.body = "{\"success\":false,\"message\":\"" + parser.error_message() + "\"}";
+                output.push_back(response.to_string(false));
+                after = AfterWrite::Close;
+                break;
+            }
+            if (result == HttpRequestParser::Result::Incomplete) {
+                break;
+            }
+
+            const HttpRequest& request = parser.request();
+            response_keep_alive = request.keep_alive();
+            response_chunked = request.version_minor >= 1;
+            auto self = shared_from_this();
+            HttpResponse response = handler->handle(request, [this, self](HttpResponse deferred) {
+                // Back onto the connection's strand
+                boost::asio::post(socket.get_executor(), [this, self, deferred = std::move(deferred)]() mutable {
+                    add_response(std::move(deferred));
+                    process_input();
+                });
+            });
+            parser.reset();
+            continue_sent = false;
+            if (response.deferred) {
+                // Nothing is read or written meanwhile, so nothing can time out
+                timer.cancel();
+                return;
+            }
+            add_response(std::move(response));
+        }
+
+        if (output.empty()) {
+            const std::string* expect = parser.request().header("expect");
+            if (parser.awaiting_body() && !continue_sent && expect && *expect == "100-continue") {
+                continue_sent = true;
+                write(CONTINUE_RESPONSE, AfterWrite::ProcessInput);
+                return;
+            }
+            do_read();
+            return;
+        }
+        std::vector<std::string> pieces = std::move(output);
+        output.clear();
+        AfterWrite then = after;
+        after = AfterWrite::ProcessInput;
+        write(std::move(pieces), then);
+    }
+
+    // Queues the response to the request just handled
+    void add_response(HttpResponse response) {
+        if (response.stream) {
+            // Requests pipelined behind a streamed response wait in the
+            // read buffer until the stream has finished
+            stream = std::move(response.stream);
+            stream_chunked = response_chunked;
+            stream_keep_alive = response_keep_alive && stream_chunked;
+            output.push_back(response.stream_header(stream_chunked, stream_keep_alive));
+            after = AfterWrite::StreamNext;
+        } else {
+            output.push_back(response.header(response_keep_alive));
+            output.push_back(std::move(response.body));
+            if (!response_keep_alive) {
+                after = AfterWrite::Close;
+            }
+        }
+    }
+
+    void stream_next() {
+        std::string chunk;
+        bool more = true;
+        try {
+            while (chunk.empty() && more) {
+                more = stream->next_chunk(chunk);
+                if (chunk.empty() && more && stream->poll_interval().count() > 0) {
+                    poll_stream();
+                    return;
+                }
+            }
+        } catch (const std::exception& e) {
+            // The status line is already sent; dropping the connection
+            // without the last chunk tells the client the body is incomplete
+            LOG_WARN("Error streaming response: " << e.what());
+            close();
+            return;
+        }
+
+        std::vector<std::string> data;
+        if (stream_chunked && !chunk.empty()) {
+            data.push_back(http_chunk_header(chunk.size()));
+            data.push_back(std::move(chunk));
+            data.push_back("\r\n");
+        } else {
+            data.push_back(std::move(chunk));
+        }
+        if (more) {
+            write(std::move(data), AfterWrite::StreamNext);
+            return;
+        }
+
+        stream.reset();
+        if (stream_chunked) {
+            data.push_back(HTTP_LAST_CHUNK);
+        }
+        write(std::move(data), stream_keep_alive ? AfterWrite::ProcessInput : AfterWrite::Close);
+    }
+
+    // Waits for a live stream to have data, without holding up the thread
+    void poll_stream() {
+        timer.expires_after(stream->poll_interval());
+        auto self = shared_from_this();
+        timer.async_wait([this, self](const boost::system::error_code& ec) {
+            if (!ec) {
+                stream_next();
+            }
+        });
+    }
+
+    void write(std::string data, AfterWrite after) {
+        std::vector<std::string> pieces;
+        pieces.push_back(std::move(data));
+        write(std::move(pieces), after);
+    }
+
+    void write(std::vector<std::string> pieces, AfterWrite after) {
+        write_pieces = std::move(pieces);
+        write_buffers.clear();
+        for (const auto& piece : write_pieces) {
+            if (!piece.empty()) {
+                write_buffers.push_back(boost::asio::buffer(piece));
+            }
+        }
+        arm_timer(options.write_timeout);
+        auto self = shared_from_this();
+        auto start = std::chrono::steady_clock::now();
+        boost::asio::async_write(socket, write_buffers,
+            [this, self, after, start](const boost::system::error_code& ec, size_t bytes_transferred) {
+                if (ec) {
+                    LOG_WARN("Error sending response: " << ec.message());
+                    close();
+                    return;
+                }
+                metrics.record_latency(Metrics::Stage::ResponseWrite, std::chrono::steady_clock::now() - start);
+                metrics.add_bytes_out(bytes_transferred);
+                switch (after) {
+                    case AfterWrite::ProcessInput:
+                        // Picks up input left in the buffer, then reads more
+                        process_input();
+                        break;
+                    case AfterWrite::StreamNext:
+                        stream_next();
+                        break;
+                    case AfterWrite::Close:
+                        close();
+                        break;
+                }
+            });
+    }
+
+    // Closing the socket aborts whatever operation is outstanding
+    void arm_timer(std::chrono::milliseconds timeout) {
+        timer.expires_after(timeout);
+        auto self = shared_from_this();
+        timer.async_wait([this, self](const boost::system::error_code& ec) {
+            if (!ec) {
+                boost::system::error_code ignored;
+                socket.close(ignored);
+            }
+        });
+    }
+
+    void close() {
+        boost::system::error_code ignored;
+        timer.cancel();
+        socket.shutdown(tcp::socket::shutdown_both, ignored);
+        socket.close(ignored);
+    }
+
+    tcp::socket socket;
+    boost::asio::steady_timer timer;
+    std::vector<char> read_buffer;
+    size_t read_offset = 0;
+    size_t read_size = 0;
+    std::vector<std::string> write_pieces;
+    std::vector<boost::asio::const_buffer> write_buffers;
+    HttpRequestParser parser;
+    bool continue_sent = false;
+    // Responses gathered for the next write, and what to do after it
+    std::vector<std::string> output;
+    AfterWrite after = AfterWrite::ProcessInput;
+    // Of the request whose response is awaited
+    bool response_keep_alive = false;
+    bool response_chunked = false;
+    std::shared_ptr<HttpBodyStream> stream;
+    bool stream_chunked = false;
+    bool stream_keep_alive = false;
+    std::shared_ptr<RequestHandler> handler;
+    Metrics& metrics;
+    const ServerOptions& options;
+    std::atomic<size_t>& connection_count;
+};
+
+}
+
+ServerOptions ServerOptions::from_config(const ConfigReader& config) {
+    ServerOptions options;
+    options.port = static_cast<unsigned short>(config.getInt("server", "port", options.port));
+    options.threads = config.getInt("server", "threads", 0);
+    if (options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    options.max_connections = config.getInt64("server", "max_connections", options.max_connections);
+    options.read_timeout = std::chrono::milliseconds(config.getInt64("server", "read_timeout_ms", options.read_timeout.count()));
+    options.write_timeout = std::chrono::milliseconds(config.getInt64("server", "write_timeout_ms", options.write_timeout.count()));
+    options.keep_alive_timeout = std::chrono::milliseconds(config.getInt64("server", "keep_alive_timeout_ms", options.keep_alive_timeout.count()));
+    options.max_request_bytes = config.getInt64("server", "max_request_bytes", options.max_request_bytes);
+    return options;
+}
+
+Server::Server(const ServerOptions& options, std::shared_ptr<RequestHandler> handler, std::shared_ptr<Metrics> metrics)
+    : options(options),
+      handler(std::move(handler)),
+      metrics(std::move(metrics)),
+      connection_count(0),
+      acceptor(io_context, tcp::endpoint(tcp::v4(), options.port)),
+      signals(io_context, SIGINT, SIGTERM) {
+    if (this->options.threads == 0) {
+        this->options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    signals.async_wait([this](const boost::system::error_code&, int) {
+        LOG_INFO("Shutting down at: " << get_current_time());
+        stop();
+    });
+    this->metrics->add_callback("stickylogs_active_connections", "gauge", "Open client connections.",
+        [this]() { return static_cast<double>(connection_count.load()); });
+}
+
+Server::~Server() {
+    handler->wait_for_deferred();
+}
+
+void Server::run() {
+    do_accept();
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < options.threads; ++i) {
+        workers.emplace_back([this]() { io_context.run(); });
+    }
+    io_context.run();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void Server::stop() {
+    io_context.stop();
+}
+
+size_t Server::active_connections() const {
+    return connection_count.load();
+}
+
+size_t Server::thread_count() const {
+    return options.threads;
+}
+
+void Server::do_accept() {
+    // Each connection gets its own strand so its handlers never run concurrently
+    acceptor.async_accept(boost::asio::make_strand(io_context),
+        [this](const boost::system::error_code& ec, tcp::socket socket) {
+            if (ec) {
+                LOG_ERROR("Accept error: " << ec.message());
+            } else if (connection_count.load() >= options.max_connections) {
+                std::make_shared<Connection>(std::move(socket), handler, *metrics, options, connection_count)->reject();
+            } else {
+                std::make_shared<Connection>(std::move(socket), handler, *metrics, options, connection_count)->start();
+            }
+            do_accept();
+        });
+}
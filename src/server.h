@@ -0,0 +1,55 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <boost/asio.hpp>
+#include "config_reader.h"
+#include "metrics.h"
+#include "request_handler.h"
+
+struct ServerOptions {
+    unsigned short port = 54321;
+    size_t threads = 0;  // 0 = one per core
+    size_t max_connections = 10000;
+    std::chrono::milliseconds read_timeout{5000};
+    std::chrono::milliseconds write_timeout{5000};
+    std::chrono::milliseconds keep_alive_timeout{30000};
+    size_t max_request_bytes = 64 * 1024 * 1024;
+
+    static ServerOptions from_config(const ConfigReader& config);
+};
+
+// Asynchronous HTTP server. A single acceptor hands sockets to connection
+// state machines that all run on a fixed pool of worker threads.
+class Server {
+public:
+    Server(const ServerOptions& options, std::shared_ptr<RequestHandler> handler, std::shared_ptr<Metrics> metrics);
+    // Waits for deferred responses still being prepared
+    ~Server();
+
+    // Runs the worker threads and blocks until stop() is called or the
+    // process receives SIGINT/SIGTERM.
+    void run();
+    void stop();
+
+    size_t active_connections() const;
+    size_t thread_count() const;
+    // For other listeners that share the worker threads
+    boost::asio::io_context& context() { return io_context; }
+
+private:
+    void do_accept();
+
+    ServerOptions options;
+    std::shared_ptr<RequestHandler> handler;
+    std::shared_ptr<Metrics> metrics;
+    // Declared before io_context so it outlives connections destroyed with it
+    std::atomic<size_t> connection_count;
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::acceptor acceptor;
+    boost::asio::signal_set signals;
+};
+
+#endif // SERVER_H
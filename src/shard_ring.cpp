@@ -0,0 +1,25 @@
+#include "shard_ring.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "hash.h"
+
+ShardRing::ShardRing(size_t shards) : shards(shards) {
+    if (shards == 0) {
+        throw std::runtime_error("A shard ring needs at least one shard");
+    }
+    points.reserve(shards * POINTS_PER_SHARD);
+    for (size_t shard = 0; shard < shards; ++shard) {
+        for (size_t i = 0; i < POINTS_PER_SHARD; ++i) {
+            points.emplace_back(hash_text("shard-" + std::to_string(shard) + "-" + std::to_string(i)), shard);
+        }
+    }
+    std::sort(points.begin(), points.end());
+}
+
+size_t ShardRing::shard_of(std::string_view reference) const {
+    uint64_t hash = hash_text(reference);
+    auto it = std::lower_bound(points.begin(), points.end(), std::make_pair(hash, size_t(0)));
+    // Past the last point the ring wraps around to the first
+    return it == points.end() ? points.front().second : it->second;
+}
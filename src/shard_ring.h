@@ -0,0 +1,28 @@
+#ifndef SHARD_RING_H
+#define SHARD_RING_H
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Consistent hash ring placing references on shards. Every shard owns
+// POINTS_PER_SHARD points of the 64-bit hash space, and a reference belongs
+// to the shard owning the first point at or after its hash; with that many
+// points the shards get close to equal shares, and a shard added later would
+// only take references over from the others, about 1/N of them.
+class ShardRing {
+public:
+    explicit ShardRing(size_t shards);
+
+    size_t shard_of(std::string_view reference) const;
+    size_t size() const { return shards; }
+
+    static const size_t POINTS_PER_SHARD = 256;
+
+private:
+    size_t shards;
+    std::vector<std::pair<uint64_t, size_t>> points;  // hash -> shard, sorted
+};
+
+#endif // SHARD_RING_H
@@ -0,0 +1,569 @@
+#include "sketch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "hash.h"
+#include "key_encoding.h"
+#include "varint.h"
+
+namespace {
+
+const int MIN_PRECISION = 4;
+const int MAX_PRECISION = 18;
+const uint8_t DENSE_FORM = 0;
+const uint8_t SPARSE_FORM = 1;
+
+// Values added to a quantile sketch are buffered up to this many times its
+// compression before the clusters are merged
+const size_t QUANTILE_BUFFER_FACTOR = 4;
+
+struct SketchTypeName {
+    const char* name;
+    SketchType type;
+};
+
+const SketchTypeName SKETCH_TYPE_NAMES[] = {
+    {"distinct", SketchType::Distinct},
+    {"quantiles", SketchType::Quantiles},
+    {"top_k", SketchType::TopK},
+};
+
+void put_double(std::string& out, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    put_fixed64_be(out, bits);
+}
+
+[[noreturn]] void malformed() {
+    throw std::runtime_error("Malformed sketch");
+}
+
+// Bounds-checked reads over a serialized sketch
+struct Reader {
+    const char* p;
+    const char* limit;
+
+    uint8_t byte() {
+        if (p >= limit) {
+            malformed();
+        }
+        return static_cast<uint8_t>(*p++);
+    }
+
+    uint64_t varint() {
+        uint64_t value;
+        if (!get_varint64(p, limit, value)) {
+            malformed();
+        }
+        return value;
+    }
+
+    double number() {
+        if (limit - p < 8) {
+            malformed();
+        }
+        uint64_t bits = decode_fixed64_be(p);
+        p += 8;
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    std::string text() {
+        uint64_t size = varint();
+        if (static_cast<uint64_t>(limit - p) < size) {
+            malformed();
+        }
+        std::string value(p, size);
+        p += size;
+        return value;
+    }
+
+    void finish() const {
+        if (p != limit) {
+            malformed();
+        }
+    }
+};
+
+}
+
+bool parse_sketch_type(const std::string& name, SketchType& type) {
+    for (const auto& entry : SKETCH_TYPE_NAMES) {
+        if (name == entry.name) {
+            type = entry.type;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string sketch_type_name(SketchType type) {
+    for (const auto& entry : SKETCH_TYPE_NAMES) {
+        if (type == entry.type) {
+            return entry.name;
+        }
+    }
+    return "type " + std::to_string(static_cast<int>(type));
+}
+
+std::unique_ptr<Sketch> Sketch::parse(std::string_view data) {
+    Reader in{data.data(), data.data() + data.size()};
+    switch (static_cast<SketchType>(in.byte())) {
+        case SketchType::Distinct: {
+            int precision = in.byte();
+            if (precision < MIN_PRECISION || precision > MAX_PRECISION) {
+                malformed();
+            }
+            std::unique_ptr<DistinctSketch> sketch(new DistinctSketch(precision));
+            uint8_t form = in.byte();
+            if (form == DENSE_FORM) {
+                if (static_cast<size_t>(in.limit - in.p) != sketch->registers.size()) {
+                    malformed();
+                }
+                std::memcpy(sketch->registers.data(), in.p, sketch->registers.size());
+                in.p = in.limit;
+            } else if (form == SPARSE_FORM) {
+                uint64_t n = in.varint();
+                uint64_t index = 0;
+                for (uint64_t i = 0; i < n; ++i) {
+                    index += in.varint();
+                    if (index >= sketch->registers.size()) {
+                        malformed();
+                    }
+                    sketch->registers[index] = in.byte();
+                }
+            } else {
+                malformed();
+            }
+            in.finish();
+            return sketch;
+        }
+        case SketchType::Quantiles: {
+            std::unique_ptr<QuantileSketch> sketch(new QuantileSketch(in.number()));
+            sketch->total_weight = in.number();
+            sketch->min_value = in.number();
+            sketch->max_value = in.number();
+            uint64_t n = in.varint();
+            if (n > static_cast<uint64_t>(in.limit - in.p) / 16) {
+                malformed();
+            }
+            sketch->centroids.reserve(n);
+            for (uint64_t i = 0; i < n; ++i) {
+                double mean = in.number();
+                double weight = in.number();
+                sketch->centroids.push_back({mean, weight});
+            }
+            in.finish();
+            return sketch;
+        }
+        case SketchType::TopK: {
+            uint32_t k = static_cast<uint32_t>(in.varint());
+            uint32_t width = static_cast<uint32_t>(in.varint());
+            uint32_t depth = static_cast<uint32_t>(in.varint());
+            if (k == 0 || width == 0 || depth == 0) {
+                malformed();
+            }
+            std::unique_ptr<TopKSketch> sketch(new TopKSketch(k, width, depth));
+            sketch->total = in.varint();
+            uint64_t n = in.varint();
+            for (uint64_t i = 0; i < n; ++i) {
+                std::string value = in.text();
+                sketch->counts[value] = in.varint();
+            }
+            if (in.p != in.limit) {
+                size_t cells = static_cast<size_t>(width) * depth;
+                sketch->counters.resize(cells);
+                for (size_t i = 0; i < cells; ++i) {
+                    sketch->counters[i] = static_cast<uint32_t>(in.varint());
+                }
+            }
+            in.finish();
+            return sketch;
+        }
+    }
+    malformed();
+}
+
+DistinctSketch::DistinctSketch(int precision)
+    : precision(std::min(std::max(precision, MIN_PRECISION), MAX_PRECISION)),
+      registers(size_t(1) << this->precision, 0) {}
+
+void DistinctSketch::add(const std::string& text) {
+    uint64_t hash = hash_text(text);
+    size_t index = hash >> (64 - precision);
+    // Position of the first set bit among the remaining ones
+    uint64_t rest = hash << precision;
+    uint8_t rank = 1;
+    while (rank <= 64 - precision && !(rest & (1ULL << 63))) {
+        rest <<= 1;
+        ++rank;
+    }
+    registers[index] = std::max(registers[index], rank);
+}
+
+bool DistinctSketch::merge(const Sketch& other) {
+    if (other.type() != SketchType::Distinct) {
+        return false;
+    }
+    const auto& sketch = static_cast<const DistinctSketch&>(other);
+    if (sketch.precision != precision) {
+        return false;
+    }
+    for (size_t i = 0; i < registers.size(); ++i) {
+        registers[i] = std::max(registers[i], sketch.registers[i]);
+    }
+    return true;
+}
+
+void DistinctSketch::serialize(std::string& out) const {
+    out += static_cast<char>(SketchType::Distinct);
+    out += static_cast<char>(precision);
+    size_t set = registers.size() - std::count(registers.begin(), registers.end(), 0);
+    // A sparse entry takes about three bytes
+    if (set * 3 >= registers.size()) {
+        out += static_cast<char>(DENSE_FORM);
+        out.append(reinterpret_cast<const char*>(registers.data()), registers.size());
+        return;
+    }
+    out += static_cast<char>(SPARSE_FORM);
+    put_varint64(out, set);
+    size_t previous = 0;
+    for (size_t i = 0; i < registers.size(); ++i) {
+        if (registers[i] != 0) {
+            put_varint64(out, i - previous);
+            out += static_cast<char>(registers[i]);
+            previous = i;
+        }
+    }
+}
+
+double DistinctSketch::estimate() const {
+    double m = static_cast<double>(registers.size());
+    double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1 + 1.079 / m);
+    double sum = 0;
+    size_t zeros = 0;
+    for (uint8_t value : registers) {
+        sum += std::ldexp(1.0, -value);
+        zeros += value == 0;
+    }
+    double estimate = alpha * m * m / sum;
+    // Linear counting is more accurate while many registers are still empty
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * std::log(m / zeros);
+    }
+    return estimate;
+}
+
+nlohmann::json DistinctSketch::to_json(const SketchReadOptions&) const {
+    return {{"distinct", std::llround(estimate())}};
+}
+
+QuantileSketch::QuantileSketch(double compression) : compression(std::max(compression, 10.0)) {}
+
+void QuantileSketch::add(const std::string& text) {
+    const char* begin = text.c_str();
+    char* end = nullptr;
+    double value = std::strtod(begin, &end);
+    if (end != begin && *end == '\0' && std::isfinite(value)) {
+        add_value(value);
+    }
+}
+
+void QuantileSketch::add_value(double value, double weight) {
+    if (total_weight == 0) {
+        min_value = max_value = value;
+    } else {
+        min_value = std::min(min_value, value);
+        max_value = std::max(max_value, value);
+    }
+    total_weight += weight;
+    centroids.push_back({value, weight});
+    if (++unmerged > QUANTILE_BUFFER_FACTOR * compression) {
+        compress();
+    }
+}
+
+void QuantileSketch::compress() const {
+    if (unmerged == 0) {
+        return;
+    }
+    unmerged = 0;
+    std::sort(centroids.begin(), centroids.end(), [](const Centroid& a, const Centroid& b) {
+        return a.mean < b.mean;
+    });
+    std::vector<Centroid> merged;
+    double before = 0;  // weight of the clusters before the last merged one
+    for (const auto& centroid : centroids) {
+        if (merged.empty()) {
+            merged.push_back(centroid);
+            continue;
+        }
+        Centroid& last = merged.back();
+        double weight = last.weight + centroid.weight;
+        double q = (before + weight / 2) / total_weight;
+        double limit = std::max(1.0, 4 * total_weight * q * (1 - q) / compression);
+        if (weight <= limit) {
+            last.mean += (centroid.mean - last.mean) * centroid.weight / weight;
+            last.weight = weight;
+        } else {
+            before += last.weight;
+            merged.push_back(centroid);
+        }
+    }
+    centroids.swap(merged);
+}
+
+bool QuantileSketch::merge(const Sketch& other) {
+    if (other.type() != SketchType::Quantiles) {
+        return false;
+    }
+    const auto& sketch = static_cast<const QuantileSketch&>(other);
+    if (sketch.compression != compression) {
+        return false;
+    }
+    if (sketch.total_weight == 0) {
+        return true;
+    }
+    if (total_weight == 0) {
+        min_value = sketch.min_value;
+        max_value = sketch.max_value;
+    } else {
+        min_value = std::min(min_value, sketch.min_value);
+        max_value = std::max(max_value, sketch.max_value);
+    }
+    total_weight += sketch.total_weight;
+    centroids.insert(centroids.end(), sketch.centroids.begin(), sketch.centroids.end());
+    unmerged += sketch.centroids.size();
+    compress();
+    return true;
+}
+
+double QuantileSketch::quantile(double q) const {
+    compress();
+    if (centroids.empty()) {
+        return NAN;
+    }
+    q = std::min(std::max(q, 0.0), 1.0);
+    double target = q * total_weight;
+
+    // Interpolates between the centres of neighbouring clusters, and between
+    // the extreme clusters and the exact minimum and maximum
+    double position = 0;
+    double previous_center = 0;
+    double previous_mean = min_value;
+    for (const auto& centroid : centroids) {
+        double center = position + centroid.weight / 2;
+        if (target < center) {
+            double span = center - previous_center;
+            double fraction = span > 0 ? (target - previous_center) / span : 1;
+            return previous_mean + (centroid.mean - previous_mean) * fraction;
+        }
+        position += centroid.weight;
+        previous_center = center;
+        previous_mean = centroid.mean;
+    }
+    double span = total_weight - previous_center;
+    double fraction = span > 0 ? (target - previous_center) / span : 1;
+    return previous_mean + (max_value - previous_mean) * fraction;
+}
+
+void QuantileSketch::serialize(std::string& out) const {
+    compress();
+    out += static_cast<char>(SketchType::Quantiles);
+    put_double(out, compression);
+    put_double(out, total_weight);
+    put_double(out, min_value);
+    put_double(out, max_value);
+    put_varint64(out, centroids.size());
+    for (const auto& centroid : centroids) {
+        put_double(out, centroid.mean);
+        put_double(out, centroid.weight);
+    }
+}
+
+nlohmann::json QuantileSketch::to_json(const SketchReadOptions& options) const {
+    nlohmann::json result;
+    result["count"] = std::llround(total_weight);
+    nlohmann::json quantiles = nlohmann::json::object();
+    if (total_weight == 0) {
+        result["min"] = nullptr;
+        result["max"] = nullptr;
+        for (double q : options.quantiles) {
+            quantiles[nlohmann::json(q).dump()] = nullptr;
+        }
+    } else {
+        result["min"] = min_value;
+        result["max"] = max_value;
+        for (double q : options.quantiles) {
+            quantiles[nlohmann::json(q).dump()] = quantile(q);
+        }
+    }
+    result["quantiles"] = quantiles;
+    return result;
+}
+
+TopKSketch::TopKSketch(uint32_t k, uint32_t width, uint32_t depth)
+    : k(std::max(k, 1u)), width(std::max(width, 1u)), depth(std::max(depth, 1u)) {}
+
+void TopKSketch::add(const std::string& text) {
+    add_count(text, 1);
+}
+
+void TopKSketch::add_count(const std::string& value, uint64_t count) {
+    total += count;
+    if (exact()) {
+        counts[value] += count;
+        if (counts.size() > capacity()) {
+            densify();
+        }
+        return;
+    }
+    count_in_sketch(value, count);
+    counts[value] = estimate(value);
+    trim();
+}
+
+uint64_t TopKSketch::estimate(const std::string& value) const {
+    uint64_t hash = hash_text(value);
+    uint32_t h1 = static_cast<uint32_t>(hash);
+    uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+    uint64_t estimate = UINT64_MAX;
+    for (uint32_t row = 0; row < depth; ++row) {
+        uint32_t column = (h1 + row * h2) % width;
+        estimate = std::min<uint64_t>(estimate, counters[static_cast<size_t>(row) * width + column]);
+    }
+    return estimate;
+}
+
+void TopKSketch::count_in_sketch(const std::string& value, uint64_t count) {
+    // Row hashes derived from two halves of one hash (Kirsch-Mitzenmacher)
+    uint64_t hash = hash_text(value);
+    uint32_t h1 = static_cast<uint32_t>(hash);
+    uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+    for (uint32_t row = 0; row < depth; ++row) {
+        uint32_t& counter = counters[static_cast<size_t>(row) * width + (h1 + row * h2) % width];
+        counter = static_cast<uint32_t>(std::min<uint64_t>(UINT32_MAX, counter + count));
+    }
+}
+
+void TopKSketch::densify() {
+    counters.assign(static_cast<size_t>(width) * depth, 0);
+    for (const auto& entry : counts) {
+        count_in_sketch(entry.first, entry.second);
+    }
+    for (auto& entry : counts) {
+        entry.second = estimate(entry.first);
+    }
+    trim();
+}
+
+void TopKSketch::trim() {
+    if (counts.size() <= capacity()) {
+        return;
+    }
+    std::vector<std::pair<uint64_t, std::string>> ranked;
+    ranked.reserve(counts.size());
+    for (auto& entry : counts) {
+        ranked.emplace_back(entry.second, entry.first);
+    }
+    std::nth_element(ranked.begin(), ranked.begin() + capacity(), ranked.end(),
+                     std::greater<std::pair<uint64_t, std::string>>());
+    ranked.resize(capacity());
+    counts.clear();
+    for (auto& entry : ranked) {
+        counts.emplace(std::move(entry.second), entry.first);
+    }
+}
+
+bool TopKSketch::merge(const Sketch& other) {
+    if (other.type() != SketchType::TopK) {
+        return false;
+    }
+    const auto& sketch = static_cast<const TopKSketch&>(other);
+    if (sketch.k != k || sketch.width != width || sketch.depth != depth) {
+        return false;
+    }
+    // Exact counts add up to the total
+    if (sketch.exact()) {
+        for (const auto& entry : sketch.counts) {
+            add_count(entry.first, entry.second);
+        }
+        return true;
+    }
+
+    if (exact()) {
+        densify();
+    }
+    total += sketch.total;
+    for (size_t i = 0; i < counters.size(); ++i) {
+        counters[i] = static_cast<uint32_t>(std::min<uint64_t>(UINT32_MAX, uint64_t(counters[i]) + sketch.counters[i]));
+    }
+    for (const auto& entry : sketch.counts) {
+        counts.emplace(entry.first, 0);
+    }
+    for (auto& entry : counts) {
+        entry.second = estimate(entry.first);
+    }
+    trim();
+    return true;
+}
+
+void TopKSketch::serialize(std::string& out) const {
+    out += static_cast<char>(SketchType::TopK);
+    put_varint64(out, k);
+    put_varint64(out, width);
+    put_varint64(out, depth);
+    put_varint64(out, total);
+    put_varint64(out, counts.size());
+    for (const auto& entry : counts) {
+        put_varint64(out, entry.first.size());
+        out += entry.first;
+        put_varint64(out, entry.second);
+    }
+    // Mostly small numbers, or zero
+    for (uint32_t counter : counters) {
+        put_varint64(out, counter);
+    }
+}
+
+nlohmann::json TopKSketch::to_json(const SketchReadOptions& options) const {
+    std::vector<std::pair<uint64_t, std::string>> ranked;
+    for (const auto& entry : counts) {
+        ranked.emplace_back(entry.second, entry.first);
+    }
+    size_t n = std::min<size_t>({options.top, k, ranked.size()});
+    std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(),
+                      [](const std::pair<uint64_t, std::string>& a, const std::pair<uint64_t, std::string>& b) {
+                          return a.first != b.first ? a.first > b.first : a.second < b.second;
+                      });
+    nlohmann::json top = nlohmann::json::array();
+    for (size_t i = 0; i < n; ++i) {
+        top.push_back({{"value", ranked[i].second}, {"count", ranked[i].first}});
+    }
+    return {{"total", total}, {"exact", exact()}, {"top", top}};
+}
+
+bool SketchMergeOperator::Merge(const rocksdb::Slice&, const rocksdb::Slice* existing_value,
+                                const rocksdb::Slice& value, std::string* new_value, rocksdb::Logger*) const {
+    new_value->clear();
+    if (!existing_value) {
+        new_value->assign(value.data(), value.size());
+        return true;
+    }
+    try {
+        std::unique_ptr<Sketch> merged = Sketch::parse(std::string_view(existing_value->data(), existing_value->size()));
+        std::unique_ptr<Sketch> operand = Sketch::parse(std::string_view(value.data(), value.size()));
+        if (!merged->merge(*operand)) {
+            new_value->assign(value.data(), value.size());
+            return true;
+        }
+        merged->serialize(*new_value);
+        return true;
+    } catch (const std::exception&) {
+        // A corrupt value fails the read or compaction that merges it
+        return false;
+    }
+}
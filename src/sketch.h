@@ -0,0 +1,155 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include <rocksdb/merge_operator.h>
+
+enum class SketchType : uint8_t { Distinct = 1, Quantiles = 2, TopK = 3 };
+
+// Names used in the config and in responses: distinct, quantiles, top_k.
+// Returns false for anything else.
+bool parse_sketch_type(const std::string& name, SketchType& type);
+std::string sketch_type_name(SketchType type);
+
+// What a query asks of a merged sketch
+struct SketchReadOptions {
+    std::vector<double> quantiles = {0.5, 0.9, 0.99};
+    size_t top = 10;
+};
+
+// A mergeable summary of the values one metadata field took. Sketches of
+// the same kind and parameters merge into the sketch of the union of their
+// inputs, which is what lets them be stored as RocksDB merge operands.
+//
+// Serialized as <u8 SketchType><kind-specific parameters and state>.
+class Sketch {
+public:
+    virtual ~Sketch() {}
+
+    virtual SketchType type() const = 0;
+    // A value of the field, in metadata_value_text() form. Quantile sketches
+    // ignore values that are not numbers.
+    virtual void add(const std::string& text) = 0;
+    // Returns false, leaving this sketch alone, when other is of another
+    // kind or was built with other parameters
+    virtual bool merge(const Sketch& other) = 0;
+    virtual void serialize(std::string& out) const = 0;
+    virtual nlohmann::json to_json(const SketchReadOptions& options) const = 0;
+
+    // Throws std::runtime_error on malformed input
+    static std::unique_ptr<Sketch> parse(std::string_view data);
+};
+
+// HyperLogLog distinct count with 2^precision one-byte registers; the
+// standard error is about 1.04 / sqrt(2^precision). Few registers set are
+// serialized sparsely, so the operand of a small commit stays small.
+class DistinctSketch : public Sketch {
+public:
+    explicit DistinctSketch(int precision);
+
+    SketchType type() const override { return SketchType::Distinct; }
+    void add(const std::string& text) override;
+    bool merge(const Sketch& other) override;
+    void serialize(std::string& out) const override;
+    nlohmann::json to_json(const SketchReadOptions& options) const override;
+
+    double estimate() const;
+
+private:
+    friend class Sketch;
+
+    int precision;
+    std::vector<uint8_t> registers;
+};
+
+// t-digest: clusters of nearby values whose size is bounded by how close to
+// the tails they are, so extreme quantiles stay accurate. Up to about
+// 2 * compression clusters are kept.
+class QuantileSketch : public Sketch {
+public:
+    explicit QuantileSketch(double compression);
+
+    SketchType type() const override { return SketchType::Quantiles; }
+    void add(const std::string& text) override;
+    bool merge(const Sketch& other) override;
+    void serialize(std::string& out) const override;
+    nlohmann::json to_json(const SketchReadOptions& options) const override;
+
+    void add_value(double value, double weight = 1);
+    double quantile(double q) const;
+    double count() const { return total_weight; }
+
+private:
+    friend class Sketch;
+
+    struct Centroid {
+        double mean;
+        double weight;
+    };
+
+    // Sorts the clusters and merges neighbours as far as the size bound allows
+    void compress() const;
+
+    double compression;
+    double total_weight = 0;
+    double min_value = 0;
+    double max_value = 0;
+    mutable std::vector<Centroid> centroids;
+    mutable size_t unmerged = 0;  // clusters appended since the last compress
+};
+
+// Most frequent values. Counted exactly while there are few distinct values;
+// past that, counts go to a count-min sketch of depth x width counters and
+// the k * CANDIDATES_PER_K values with the highest estimates are kept as
+// candidates. Estimates only ever overcount.
+class TopKSketch : public Sketch {
+public:
+    TopKSketch(uint32_t k, uint32_t width, uint32_t depth);
+
+    SketchType type() const override { return SketchType::TopK; }
+    void add(const std::string& text) override;
+    bool merge(const Sketch& other) override;
+    void serialize(std::string& out) const override;
+    nlohmann::json to_json(const SketchReadOptions& options) const override;
+
+    void add_count(const std::string& value, uint64_t count);
+
+    static const uint32_t CANDIDATES_PER_K = 4;
+
+private:
+    friend class Sketch;
+
+    bool exact() const { return counters.empty(); }
+    size_t capacity() const { return static_cast<size_t>(k) * CANDIDATES_PER_K; }
+    uint64_t estimate(const std::string& value) const;
+    void count_in_sketch(const std::string& value, uint64_t count);
+    // Switches from exact counts to the count-min sketch
+    void densify();
+    // Keeps the candidates with the highest estimates
+    void trim();
+
+    uint32_t k;
+    uint32_t width;
+    uint32_t depth;
+    uint64_t total = 0;
+    std::map<std::string, uint64_t> counts;  // exact counts, or candidate estimates
+    std::vector<uint32_t> counters;          // empty while counting exactly
+};
+
+// Merges sketch values and operands. Operands that cannot be merged into the
+// existing value (different kind or parameters, after a definition change)
+// replace it.
+class SketchMergeOperator : public rocksdb::AssociativeMergeOperator {
+public:
+    bool Merge(const rocksdb::Slice& key, const rocksdb::Slice* existing_value, const rocksdb::Slice& value,
+               std::string* new_value, rocksdb::Logger* logger) const override;
+    const char* Name() const override { return "StickyLogsSketchMerge"; }
+};
+
+#endif // SKETCH_H
@@ -0,0 +1,224 @@
+#include "sketch_store.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "key_encoding.h"
+
+namespace {
+
+const std::string NULL_GROUP = "null";
+const size_t BUCKET_KEY_BYTES = 8;
+
+const char* const DEFINITION_KEYS[] = {
+    "name", "type", "field", "group_by", "bucket_ms", "precision", "compression", "k", "width", "depth"
+};
+
+int64_t definition_number(const std::map<std::string, std::string>& entry, const std::string& name,
+                          const std::string& key, int64_t default_value, int64_t min, int64_t max) {
+    auto it = entry.find(key);
+    if (it == entry.end()) {
+        return default_value;
+    }
+    int64_t value;
+    try {
+        size_t used;
+        value = std::stoll(it->second, &used);
+        if (used != it->second.size()) {
+            throw std::invalid_argument(key);
+        }
+    } catch (const std::exception&) {
+        throw std::runtime_error("Sketch '" + name + "': '" + key + "' must be a whole number");
+    }
+    if (value < min || value > max) {
+        throw std::runtime_error("Sketch '" + name + "': '" + key + "' must be between " +
+                                 std::to_string(min) + " and " + std::to_string(max));
+    }
+    return value;
+}
+
+}
+
+std::unique_ptr<Sketch> SketchDefinition::create() const {
+    switch (type) {
+        case SketchType::Distinct:
+            return std::unique_ptr<Sketch>(new DistinctSketch(precision));
+        case SketchType::Quantiles:
+            return std::unique_ptr<Sketch>(new QuantileSketch(compression));
+        case SketchType::TopK:
+            return std::unique_ptr<Sketch>(new TopKSketch(k, width, depth));
+    }
+    throw std::runtime_error("Unknown sketch type");
+}
+
+std::string SketchDefinition::signature() const {
+    std::string signature = sketch_type_name(type) + " " + field + " by '" + group_by + "' every " +
+                            std::to_string(bucket_ms) + "ms";
+    switch (type) {
+        case SketchType::Distinct:
+            return signature + " precision " + std::to_string(precision);
+        case SketchType::Quantiles:
+            return signature + " compression " + std::to_string(static_cast<int64_t>(compression));
+        case SketchType::TopK:
+            return signature + " k " + std::to_string(k) + " width " + std::to_string(width) +
+                   " depth " + std::to_string(depth);
+    }
+    return signature;
+}
+
+std::vector<SketchDefinition> sketch_definitions_from_config(const ConfigReader& config) {
+    int64_t default_bucket_ms = config.getInt64("sketches", "bucket_ms", 3600000);
+    std::vector<SketchDefinition> definitions;
+    std::set<std::string> names;
+    for (const auto& entry : config.getMapList("sketches", "definitions")) {
+        SketchDefinition definition;
+        auto value = [&](const std::string& key) {
+            auto it = entry.find(key);
+            return it == entry.end() ? std::string() : it->second;
+        };
+        definition.name = value("name");
+        if (definition.name.empty() || definition.name.find('\0') != std::string::npos) {
+            throw std::runtime_error("Every sketch needs a name");
+        }
+        if (!names.insert(definition.name).second) {
+            throw std::runtime_error("Sketch '" + definition.name + "' is defined twice");
+        }
+        for (const auto& key : entry) {
+            if (std::find(std::begin(DEFINITION_KEYS), std::end(DEFINITION_KEYS), key.first) == std::end(DEFINITION_KEYS)) {
+                throw std::runtime_error("Sketch '" + definition.name + "': unknown key '" + key.first + "'");
+            }
+        }
+        if (!parse_sketch_type(value("type"), definition.type)) {
+            throw std::runtime_error("Sketch '" + definition.name + "': 'type' must be distinct, quantiles or top_k");
+        }
+        definition.field = value("field");
+        if (definition.field.empty()) {
+            throw std::runtime_error("Sketch '" + definition.name + "' needs a 'field'");
+        }
+        definition.group_by = value("group_by");
+        definition.bucket_ms = definition_number(entry, definition.name, "bucket_ms", default_bucket_ms,
+                                                 1, 366LL * 24 * 60 * 60 * 1000);
+        definition.precision = definition_number(entry, definition.name, "precision", definition.precision, 4, 18);
+        definition.compression = definition_number(entry, definition.name, "compression",
+                                                   static_cast<int64_t>(definition.compression), 10, 10000);
+        definition.k = definition_number(entry, definition.name, "k", definition.k, 1, 10000);
+        definition.width = definition_number(entry, definition.name, "width", definition.width, 16, 1 << 20);
+        definition.depth = definition_number(entry, definition.name, "depth", definition.depth, 1, 16);
+        definitions.push_back(definition);
+    }
+    return definitions;
+}
+
+std::string encode_sketch_prefix(const std::string& name) {
+    std::string prefix = name;
+    prefix += '\0';
+    return prefix;
+}
+
+int64_t sketch_bucket_start(int64_t timestamp, int64_t bucket_ms) {
+    int64_t bucket = timestamp / bucket_ms;
+    if (timestamp % bucket_ms < 0) {
+        --bucket;
+    }
+    return bucket * bucket_ms;
+}
+
+SketchUpdates::SketchUpdates(const std::vector<SketchDefinition>& definitions) : definitions(definitions) {}
+
+void SketchUpdates::add(int64_t timestamp, const std::vector<std::pair<std::string, std::string>>& field_values) {
+    auto find = [&](const std::string& field) -> const std::string* {
+        for (const auto& value : field_values) {
+            if (value.first == field) {
+                return &value.second;
+            }
+        }
+        return nullptr;
+    };
+    for (const auto& definition : definitions) {
+        const std::string* value = find(definition.field);
+        if (!value) {
+            continue;
+        }
+        std::string key = encode_sketch_prefix(definition.name);
+        put_timestamp(key, sketch_bucket_start(timestamp, definition.bucket_ms));
+        if (!definition.group_by.empty()) {
+            const std::string* group = find(definition.group_by);
+            key += group ? *group : NULL_GROUP;
+        }
+        std::unique_ptr<Sketch>& sketch = pending[key];
+        if (!sketch) {
+            sketch = definition.create();
+        }
+        sketch->add(*value);
+    }
+}
+
+void SketchUpdates::write(rocksdb::WriteBatch& batch, rocksdb::ColumnFamilyHandle* cf) {
+    std::string operand;
+    for (const auto& entry : pending) {
+        operand.clear();
+        entry.second->serialize(operand);
+        batch.Merge(cf, entry.first, operand);
+    }
+    pending.clear();
+}
+
+SketchQueryResult read_sketches(rocksdb::DB* db, rocksdb::ColumnFamilyHandle* cf, const SketchDefinition& definition,
+                                int64_t start_timestamp, int64_t end_timestamp, const std::string& group) {
+    const std::string prefix = encode_sketch_prefix(definition.name);
+    std::string seek_key = prefix;
+    // The bucket of an unbounded start cannot be computed without overflowing
+    if (start_timestamp > INT64_MIN + definition.bucket_ms) {
+        put_timestamp(seek_key, sketch_bucket_start(start_timestamp, definition.bucket_ms));
+    }
+    const std::string limit = prefix_successor(prefix);
+    rocksdb::Slice upper_bound(limit);
+    rocksdb::ReadOptions read_options;
+    read_options.iterate_upper_bound = &upper_bound;
+
+    SketchQueryResult result;
+    result.definition = &definition;
+    std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(read_options, cf));
+    for (it->Seek(seek_key); it->Valid(); it->Next()) {
+        rocksdb::Slice key = it->key();
+        if (key.size() < prefix.size() + BUCKET_KEY_BYTES) {
+            continue;
+        }
+        int64_t bucket = decode_timestamp(key.data() + prefix.size());
+        if (bucket > end_timestamp) {
+            break;
+        }
+        std::string value_group(key.data() + prefix.size() + BUCKET_KEY_BYTES,
+                                key.size() - prefix.size() - BUCKET_KEY_BYTES);
+        if (!group.empty() && value_group != group) {
+            continue;
+        }
+        std::unique_ptr<Sketch> sketch = Sketch::parse(std::string_view(it->value().data(), it->value().size()));
+        std::unique_ptr<Sketch>& merged = result.groups[value_group];
+        // A sketch left from before a definition change does not merge;
+        // they are dropped on the next open, so skipping is enough
+        if (!merged) {
+            merged = definition.create();
+        }
+        if (merged->merge(*sketch)) {
+            result.buckets.insert(bucket);
+        }
+    }
+    if (!it->status().ok()) {
+        throw std::runtime_error("Error reading sketches: " + it->status().ToString());
+    }
+    return result;
+}
+
+void SketchQueryResult::merge(const SketchQueryResult& other) {
+    if (!definition) {
+        definition = other.definition;
+    }
+    buckets.insert(other.buckets.begin(), other.buckets.end());
+    for (const auto& entry : other.groups) {
+        std::unique_ptr<Sketch>& merged = groups[entry.first];
+        if (!merged) {
+            merged = definition->create();
+        }
+        merged->merge(*entry.second);
+    }
+}
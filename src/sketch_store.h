@@ -0,0 +1,84 @@
+#ifndef SKETCH_STORE_H
+#define SKETCH_STORE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <rocksdb/db.h>
+#include <rocksdb/write_batch.h>
+#include "config_reader.h"
+#include "sketch.h"
+
+// One configured sketch: a summary of a metadata field per time bucket, and
+// per value of group_by if set
+struct SketchDefinition {
+    std::string name;
+    SketchType type = SketchType::Distinct;
+    std::string field;
+    std::string group_by;        // empty for one sketch per bucket
+    int64_t bucket_ms = 3600000;
+    int precision = 14;          // distinct
+    double compression = 100;    // quantiles
+    uint32_t k = 20;             // top_k
+    uint32_t width = 2048;       // top_k, once past exact counting
+    uint32_t depth = 4;
+
+    std::unique_ptr<Sketch> create() const;
+    // Everything that shapes the stored sketches; when it changes they are
+    // rebuilt
+    std::string signature() const;
+};
+
+// Reads the "sketches" section. Throws std::runtime_error on an invalid or
+// duplicate definition.
+std::vector<SketchDefinition> sketch_definitions_from_config(const ConfigReader& config);
+
+// Sketch key: <name><0x00><8-byte bucket start><group value>. The buckets of
+// one sketch are contiguous and ordered by time.
+std::string encode_sketch_prefix(const std::string& name);
+
+// Start of the bucket holding the timestamp
+int64_t sketch_bucket_start(int64_t timestamp, int64_t bucket_ms);
+
+// Partial sketches of a set of logs, one per key, applied to the sketch
+// column family as merge operands so that inserts never read them
+class SketchUpdates {
+public:
+    explicit SketchUpdates(const std::vector<SketchDefinition>& definitions);
+
+    // field_values: sketched field -> value text, for the fields the log has.
+    // Logs without a group_by field are grouped under "null".
+    void add(int64_t timestamp, const std::vector<std::pair<std::string, std::string>>& field_values);
+    size_t size() const { return pending.size(); }
+
+    // Adds one merge per key to the batch and starts over
+    void write(rocksdb::WriteBatch& batch, rocksdb::ColumnFamilyHandle* cf);
+
+private:
+    const std::vector<SketchDefinition>& definitions;
+    std::unordered_map<std::string, std::unique_ptr<Sketch>> pending;
+};
+
+// Sketches of one definition merged over the buckets that overlap a time
+// range, per group value ("" without group_by)
+struct SketchQueryResult {
+    const SketchDefinition* definition = nullptr;
+    std::set<int64_t> buckets;  // starts of the buckets that had sketches
+    std::map<std::string, std::unique_ptr<Sketch>> groups;
+
+    // Adds the sketches of the same definition read elsewhere, e.g. from
+    // another shard
+    void merge(const SketchQueryResult& other);
+};
+
+// Reads with the merge operator resolving pending operands. A non-empty
+// group restricts the result to that group value.
+SketchQueryResult read_sketches(rocksdb::DB* db, rocksdb::ColumnFamilyHandle* cf, const SketchDefinition& definition,
+                                int64_t start_timestamp, int64_t end_timestamp, const std::string& group = "");
+
+#endif // SKETCH_STORE_H
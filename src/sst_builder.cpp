@@ -0,0 +1,90 @@
+#include "sst_builder.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <rocksdb/env.h>
+#include <rocksdb/sst_file_writer.h>
+
+namespace {
+
+// Entries per SST file; sets larger than this are split
+const size_t MAX_FILE_ENTRIES = 4 * 1024 * 1024;
+
+// A contiguous run of one set's sorted entries, written as one file
+struct FileJob {
+    SstFileSet* set;
+    size_t begin;
+    size_t end;
+    std::string path;
+};
+
+// Runs job(i) for every i in [0, count) on up to `threads` threads and
+// rethrows the first failure
+template<typename Job>
+void run_parallel(size_t count, size_t threads, Job job) {
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                job(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < std::min(std::max<size_t>(threads, 1), count); ++t) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& w : workers) {
+        w.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}
+
+void write_sst_files(const rocksdb::Options& options, std::vector<SstFileSet>& sets,
+                     const std::string& dir, size_t threads) {
+    run_parallel(sets.size(), threads, [&](size_t i) {
+        auto& entries = sets[i].entries;
+        std::sort(entries.begin(), entries.end(),
+                  [](const auto& a, const auto& b) { return a.first < b.first; });
+    });
+
+    std::vector<FileJob> jobs;
+    for (auto& set : sets) {
+        set.files.clear();
+        for (size_t begin = 0; begin < set.entries.size(); begin += MAX_FILE_ENTRIES) {
+            std::string path = dir + "/" + std::to_string(jobs.size()) + ".sst";
+            jobs.push_back({&set, begin, std::min(begin + MAX_FILE_ENTRIES, set.entries.size()), path});
+            set.files.push_back(path);
+        }
+    }
+
+    run_parallel(jobs.size(), threads, [&](size_t i) {
+        const FileJob& job = jobs[i];
+        rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), options, job.set->cf);
+        rocksdb::Status status = writer.Open(job.path);
+        for (size_t e = job.begin; status.ok() && e < job.end; ++e) {
+            status = writer.Put(job.set->entries[e].first, job.set->entries[e].second);
+        }
+        if (status.ok()) {
+            status = writer.Finish();
+        }
+        if (!status.ok()) {
+            throw std::runtime_error("Failed to write " + job.path + ": " + status.ToString());
+        }
+    });
+}
@@ -0,0 +1,25 @@
+#ifndef SST_BUILDER_H
+#define SST_BUILDER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <rocksdb/db.h>
+#include <rocksdb/options.h>
+
+// Key/value pairs bound for one column family, in any order
+struct SstFileSet {
+    rocksdb::ColumnFamilyHandle* cf;
+    std::vector<std::pair<std::string, std::string>> entries;
+    // Filled in by write_sst_files
+    std::vector<std::string> files;
+};
+
+// Sorts the entries of every set and writes them out as SST files under
+// dir, on up to `threads` threads at once. Large sets are split into
+// several files that can be written in parallel. Keys must be unique
+// within a set. Throws on failure, leaving any files already written.
+void write_sst_files(const rocksdb::Options& options, std::vector<SstFileSet>& sets,
+                     const std::string& dir, size_t threads);
+
+#endif // SST_BUILDER_H
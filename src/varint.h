@@ -0,0 +1,42 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <string>
+#include <cstdint>
+
+// LEB128 variable-length integers, 7 bits per byte, least significant first
+inline void put_varint64(std::string& dst, uint64_t value) {
+    char buf[10];
+    size_t n = 0;
+    while (value >= 0x80) {
+        buf[n++] = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = static_cast<char>(value);
+    dst.append(buf, n);
+}
+
+// Advances p past the varint. Returns false if the input is truncated or the
+// value does not fit in 64 bits.
+inline bool get_varint64(const char*& p, const char* limit, uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; shift <= 63 && p < limit; shift += 7) {
+        uint64_t byte = static_cast<unsigned char>(*p++);
+        value |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Maps signed values to unsigned so small negative numbers stay short
+inline uint64_t zigzag_encode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+#endif // VARINT_H
@@ -0,0 +1,134 @@
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+#include <rocksdb/db.h>
+#include "db_wrapper.h"
+
+namespace {
+
+// A scratch directory holding a database and its configuration
+class TempDatabase {
+public:
+    explicit TempDatabase(const std::string& extra_config = "") {
+        dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("stickylogs-%%%%-%%%%");
+        boost::filesystem::create_directories(dir);
+        std::ofstream(config_path()) << "rocksdb:\n  statistics: false\n" << extra_config;
+    }
+    ~TempDatabase() {
+        boost::system::error_code ignored;
+        boost::filesystem::remove_all(dir, ignored);
+    }
+
+    std::string db_path() const { return (dir / "db").string(); }
+    std::string config_path() const { return (dir / "config.yaml").string(); }
+
+private:
+    boost::filesystem::path dir;
+};
+
+std::vector<Log> scan_all(std::unique_ptr<LogScanner> scanner) {
+    std::vector<Log> logs;
+    while (scanner->next(logs, 100)) {
+    }
+    return logs;
+}
+
+}
+
+TEST(DBWrapper, MigratesBaselineDatabaseOnOpen) {
+    TempDatabase temp;
+    // The first layout: only the default column family, mapping each
+    // reference to its log as JSON
+    const std::vector<Log> baseline = {
+        Log("before-1970", {{"event", "old"}}, -86400000),
+        Log("first", {{"event", "login"}}, 1700000000000),
+        Log("second", {{"event", "logout"}}, 1700000060000),
+    };
+    {
+        rocksdb::Options options;
+        options.create_if_missing = true;
+        rocksdb::DB* raw;
+        ASSERT_TRUE(rocksdb::DB::Open(options, temp.db_path(), &raw).ok());
+        std::unique_ptr<rocksdb::DB> db(raw);
+        for (const auto& log : baseline) {
+            nlohmann::json j = {{"reference", log.reference()}, {"metadata", log.metadata()},
+                                {"timestamp", log.timestamp()}};
+            ASSERT_TRUE(db->Put(rocksdb::WriteOptions(), log.reference(), j.dump()).ok());
+        }
+    }
+
+    for (int open = 0; open < 2; ++open) {
+        DBWrapper db(temp.db_path(), temp.config_path());
+        for (const auto& log : baseline) {
+            Log stored = db.get_log(log.reference());
+            EXPECT_EQ(log.timestamp(), stored.timestamp());
+            EXPECT_EQ(log.metadata(), stored.metadata());
+        }
+
+        std::vector<Log> range = scan_all(db.scan_time_range(1700000000000, 1700000000000 + 3600000));
+        ASSERT_EQ(2u, range.size());
+        EXPECT_EQ("first", range[0].reference());
+        EXPECT_EQ("second", range[1].reference());
+        EXPECT_EQ(3u, scan_all(db.scan_all()).size());
+        EXPECT_EQ(InsertStatus::Duplicate, db.insert_log(Log("first", nlohmann::json::object())));
+    }
+}
+
+TEST(DBWrapper, LastQueryPageEndsTheScan) {
+    TempDatabase temp("indexes:\n  fields: [event]\n");
+    DBWrapper db(temp.db_path(), temp.config_path());
+    // The last log of the range does not match, so only reading ahead tells
+    // that the matching ones are done
+    for (int i = 0; i < 5; ++i) {
+        db.insert_log(Log("log-" + std::to_string(i), {{"event", i < 4 ? "login" : "logout"}, {"n", i}},
+                          1700000000000 + i));
+    }
+
+    LogQuery residual;
+    residual.filters["n"] = "3";
+    LogQuery indexed;
+    indexed.filters["event"] = "login";
+    for (const LogQuery& query : {LogQuery(), residual, indexed}) {
+        size_t total = 0;
+        std::string cursor;
+        bool more = true;
+        int pages = 0;
+        while (more) {
+            std::vector<Log> logs;
+            std::unique_ptr<LogScanner> scanner = db.scan_query(query, cursor);
+            more = scanner->next(logs, 2);
+            ASSERT_FALSE(logs.empty()) << "page " << pages << " is empty";
+            total += logs.size();
+            cursor = scanner->position();
+            ++pages;
+        }
+        size_t expected = query.filters.empty() ? 5 : query.filters.count("n") ? 1 : 4;
+        EXPECT_EQ(expected, total);
+        EXPECT_EQ((expected + 1) / 2, static_cast<size_t>(pages));
+    }
+}
+
+TEST(DBWrapper, AggregateKeepsMissingFieldApartFromNullString) {
+    // Grouping on an indexed field walks the index; otherwise records are read
+    for (const std::string& config : {std::string(), std::string("indexes:\n  fields: [event]\n")}) {
+        TempDatabase temp(config);
+        DBWrapper db(temp.db_path(), temp.config_path());
+        db.insert_log(Log("a", {{"event", "null"}}, 1700000000000));
+        db.insert_log(Log("b", {{"event", "login"}}, 1700000000001));
+        db.insert_log(Log("c", {{"other", 1}}, 1700000000002));
+        db.insert_log(Log("d", {{"event", nullptr}}, 1700000000003));
+
+        AggregateQuery query;
+        query.group_by = "event";
+        AggregateResult result = db.aggregate(query);
+        EXPECT_EQ(4u, result.count);
+        EXPECT_EQ(4u, result.bucket_count(0));
+        EXPECT_EQ(2u, result.missing_count(0));
+        const std::map<std::string, uint64_t> expected = {{"login", 1}, {"null", 1}};
+        EXPECT_EQ(expected, result.counts[0]);
+    }
+}
@@ -0,0 +1,167 @@
+#include <string>
+#include <gtest/gtest.h>
+#include "http.h"
+
+namespace {
+
+const size_t MAX_HEADER_BYTES = 1024;
+const size_t MAX_BODY_BYTES = 64;
+
+// Feeds the whole input in one call
+HttpRequestParser::Result parse_all(HttpRequestParser& parser, const std::string& input, size_t& consumed) {
+    return parser.parse(input.data(), input.size(), consumed);
+}
+
+HttpRequestParser::Result parse_all(HttpRequestParser& parser, const std::string& input) {
+    size_t consumed;
+    return parse_all(parser, input, consumed);
+}
+
+// Feeds the input one byte at a time, stopping at the first result other
+// than Incomplete
+HttpRequestParser::Result parse_bytewise(HttpRequestParser& parser, const std::string& input) {
+    for (size_t i = 0; i < input.size(); ++i) {
+        size_t consumed;
+        HttpRequestParser::Result result = parser.parse(input.data() + i, 1, consumed);
+        if (result != HttpRequestParser::Result::Incomplete) {
+            EXPECT_EQ(i + 1, input.size()) << "finished before the end of the input";
+            return result;
+        }
+    }
+    return HttpRequestParser::Result::Incomplete;
+}
+
+void expect_error(const std::string& input, int status, size_t max_header_bytes = MAX_HEADER_BYTES) {
+    HttpRequestParser parser(max_header_bytes, MAX_BODY_BYTES);
+    EXPECT_EQ(HttpRequestParser::Result::Error, parse_all(parser, input)) << input;
+    EXPECT_EQ(status, parser.error_status()) << input;
+    EXPECT_FALSE(parser.error_message().empty());
+    // The parser stays failed until reset
+    size_t consumed;
+    EXPECT_EQ(HttpRequestParser::Result::Error, parser.parse("x", 1, consumed));
+}
+
+}
+
+TEST(HttpRequestParser, ParsesRequestWithContentLength) {
+    HttpRequestParser parser(MAX_HEADER_BYTES, MAX_BODY_BYTES);
+    std::string input = "POST /x HTTP/1.1\r\nHost: a\r\nContent-Length: 5\r\nX-Mixed-Case:  value \r\n\r\nhello";
+    size_t consumed;
+    ASSERT_EQ(HttpRequestParser::Result::Complete, parse_all(parser, input, consumed));
+    EXPECT_EQ(input.size(), consumed);
+    const HttpRequest& request = parser.request();
+    EXPECT_EQ("POST", request.method);
+    EXPECT_EQ("/x", request.target);
+    EXPECT_EQ(1, request.version_minor);
+    EXPECT_EQ("hello", request.body);
+    ASSERT_NE(nullptr, request.header("x-mixed-case"));
+    EXPECT_EQ("value", *request.header("X-MIXED-CASE"));
+    EXPECT_EQ(nullptr, request.header("missing"));
+}
+
+TEST(HttpRequestParser, ParsesChunkedBodyFedByteByByte) {
+    HttpRequestParser parser(MAX_HEADER_BYTES, MAX_BODY_BYTES);
+    std::string input = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 99\r\n\r\n"
+                        "5;ext=1\r\nhello\r\n"
+                        "A\r\n, chunked!\r\n"
+                        "0\r\nTrailer: ignored\r\n\r\n";
+    ASSERT_EQ(HttpRequestParser::Result::Complete, parse_bytewise(parser, input));
+    EXPECT_EQ("hello, chunked!", parser.request().body);
+}
+
+TEST(HttpRequestParser, StopsAfterEachPipelinedRequest) {
+    HttpRequestParser parser(MAX_HEADER_BYTES, MAX_BODY_BYTES);
+    std::string first = "POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc";
+    std::string second = "GET /b HTTP/1.1\r\n\r\n";
+    std::string third = "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nhi\r\n0\r\n\r\n";
+    // Stray CRLFs between requests are skipped
+    std::string input = first + second + "\r\n" + third;
+
+    size_t offset = 0;
+    size_t consumed;
+    ASSERT_EQ(HttpRequestParser::Result::Complete, parser.parse(input.data(), input.size(), consumed));
+    EXPECT_EQ(first.size(), consumed);
+    EXPECT_EQ("/a", parser.request().target);
+    EXPECT_EQ("abc", parser.request().body);
+    offset += consumed;
+
+    parser.reset();
+    ASSERT_EQ(HttpRequestParser::Result::Complete, parser.parse(input.data() + offset, input.size() - offset, consumed));
+    EXPECT_EQ(second.size(), consumed);
+    EXPECT_EQ("/b", parser.request().target);
+    EXPECT_TRUE(parser.request().body.empty());
+    offset += consumed;
+
+    parser.reset();
+    ASSERT_EQ(HttpRequestParser::Result::Complete, parser.parse(input.data() + offset, input.size() - offset, consumed));
+    EXPECT_EQ(input.size(), offset + consumed);
+    EXPECT_EQ("/c", parser.request().target);
+    EXPECT_EQ("hi", parser.request().body);
+}
+
+TEST(HttpRequestParser, ReportsProgress) {
+    HttpRequestParser parser(MAX_HEADER_BYTES, MAX_BODY_BYTES);
+    EXPECT_FALSE(parser.in_progress());
+    EXPECT_EQ(HttpRequestParser::Result::Incomplete, parse_all(parser, "POST / HTTP/1.1\r\n"));
+    EXPECT_TRUE(parser.in_progress());
+    EXPECT_FALSE(parser.awaiting_body());
+    EXPECT_EQ(HttpRequestParser::Result::Incomplete, parse_all(parser, "Content-Length: 4\r\n\r\nab"));
+    EXPECT_TRUE(parser.awaiting_body());
+    EXPECT_EQ(HttpRequestParser::Result::Complete, parse_all(parser, "cd"));
+    EXPECT_EQ("abcd", parser.request().body);
+    parser.reset();
+    EXPECT_FALSE(parser.in_progress());
+}
+
+TEST(HttpRequestParser, RejectsMalformedRequestLines) {
+    expect_error("GET\r\n\r\n", 400);
+    expect_error("GET /\r\n\r\n", 400);
+    expect_error(" / HTTP/1.1\r\n\r\n", 400);
+    expect_error("GET  HTTP/1.1\r\n\r\n", 400);
+    expect_error("GET / HTTP/2.0\r\n\r\n", 505);
+    expect_error("GET / http/1.1\r\n\r\n", 505);
+}
+
+TEST(HttpRequestParser, RejectsMalformedHeaders) {
+    expect_error("GET / HTTP/1.1\r\nNo-Colon\r\n\r\n", 400);
+    expect_error("GET / HTTP/1.1\r\n: empty-name\r\n\r\n", 400);
+    expect_error("GET / HTTP/1.1\r\nBad Name: x\r\n\r\n", 400);
+    expect_error("GET / HTTP/1.1\r\nA: b\r\n folded\r\n\r\n", 400);
+    expect_error("GET / HTTP/1.1\r\nX-Long: " + std::string(2000, 'a') + "\r\n\r\n", 431);
+    // The limit holds even without a newline in sight
+    expect_error("GET / HTTP/1.1\r\nX-Long: " + std::string(2000, 'a'), 431);
+}
+
+TEST(HttpRequestParser, RejectsBadContentLength) {
+    expect_error("POST / HTTP/1.1\r\nContent-Length: abc\r\n\r\n", 400);
+    expect_error("POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", 400);
+    expect_error("POST / HTTP/1.1\r\nContent-Length: \r\n\r\n", 400);
+    expect_error("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n", 400);
+    expect_error("POST / HTTP/1.1\r\nContent-Length: 65\r\n\r\n", 413);
+}
+
+TEST(HttpRequestParser, RejectsBadChunkedBodies) {
+    const std::string chunked = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    expect_error("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", 501);
+    expect_error(chunked + "zz\r\n", 400);
+    expect_error(chunked + "\r\n", 400);
+    expect_error(chunked + "-5\r\n", 400);
+    expect_error(chunked + "1234567890abcdef\r\n", 400);
+    expect_error(chunked + "3\r\nabcX\r\n", 400);
+    // The limit applies to the body as a whole, not to each chunk
+    expect_error(chunked + "20\r\n" + std::string(32, 'a') + "\r\n21\r\n", 413);
+}
+
+TEST(HttpRequest, KeepAliveDependsOnVersionAndConnectionHeader) {
+    HttpRequest request;
+    request.version_minor = 1;
+    EXPECT_TRUE(request.keep_alive());
+    request.headers.emplace_back("connection", "Upgrade, Close");
+    EXPECT_FALSE(request.keep_alive());
+
+    request = HttpRequest();
+    request.version_minor = 0;
+    EXPECT_FALSE(request.keep_alive());
+    request.headers.emplace_back("connection", "keep-alive");
+    EXPECT_TRUE(request.keep_alive());
+}
@@ -0,0 +1,81 @@
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <gtest/gtest.h>
+#include "partition_set.h"
+
+namespace {
+
+const int64_t DAY_MS = PartitionSet::DAY_MS;
+
+// Checks that the day's name parses back to the same day
+void expect_round_trip(int64_t day, const std::string& name) {
+    EXPECT_EQ(name, PartitionSet::name_of(day));
+    int64_t parsed = 0;
+    ASSERT_TRUE(PartitionSet::parse_name(name, parsed)) << name;
+    EXPECT_EQ(day, parsed) << name;
+}
+
+}
+
+TEST(PartitionSet, DayOfFloorsNegativeTimestamps) {
+    EXPECT_EQ(0, PartitionSet::day_of(0));
+    EXPECT_EQ(0, PartitionSet::day_of(DAY_MS - 1));
+    EXPECT_EQ(1, PartitionSet::day_of(DAY_MS));
+    EXPECT_EQ(-1, PartitionSet::day_of(-1));
+    EXPECT_EQ(-1, PartitionSet::day_of(-DAY_MS));
+    EXPECT_EQ(-2, PartitionSet::day_of(-DAY_MS - 1));
+}
+
+TEST(PartitionSet, NamesRoundTripAcrossBoundaries) {
+    expect_round_trip(0, "logs_19700101");
+    expect_round_trip(-1, "logs_19691231");
+    expect_round_trip(PartitionSet::day_of(1700000000000), "logs_20231114");
+    // Year change and leap day
+    expect_round_trip(19722, "logs_20231231");
+    expect_round_trip(19723, "logs_20240101");
+    expect_round_trip(19782, "logs_20240229");
+    expect_round_trip(19783, "logs_20240301");
+    // Years 1 BC and 10000 have no four digit name
+    expect_round_trip(PartitionSet::MIN_DAY, "logs_00000101");
+    expect_round_trip(PartitionSet::MAX_DAY, "logs_99991231");
+    EXPECT_EQ(PartitionSet::MIN_DAY, PartitionSet::day_of(PartitionSet::MIN_TIMESTAMP));
+    EXPECT_EQ(PartitionSet::MAX_DAY, PartitionSet::day_of(PartitionSet::MAX_TIMESTAMP));
+}
+
+TEST(PartitionSet, RejectsTimestampsOutsideFourDigitYears) {
+    EXPECT_TRUE(PartitionSet::in_range(0));
+    EXPECT_TRUE(PartitionSet::in_range(PartitionSet::MIN_TIMESTAMP));
+    EXPECT_TRUE(PartitionSet::in_range(PartitionSet::MAX_TIMESTAMP));
+    EXPECT_FALSE(PartitionSet::in_range(PartitionSet::MIN_TIMESTAMP - 1));
+    EXPECT_FALSE(PartitionSet::in_range(PartitionSet::MAX_TIMESTAMP + 1));
+    EXPECT_FALSE(PartitionSet::in_range(std::numeric_limits<int64_t>::min()));
+    EXPECT_FALSE(PartitionSet::in_range(std::numeric_limits<int64_t>::max()));
+
+    // A microsecond timestamp and one from before year 0
+    const int64_t microseconds = 1700000000000000;
+    const int64_t negative = -69120000000000;
+    EXPECT_FALSE(PartitionSet::in_range(microseconds));
+    EXPECT_FALSE(PartitionSet::in_range(negative));
+    EXPECT_THROW(PartitionSet::name_of(PartitionSet::day_of(microseconds)), std::runtime_error);
+    EXPECT_THROW(PartitionSet::name_of(PartitionSet::day_of(negative)), std::runtime_error);
+    EXPECT_THROW(PartitionSet::name_of(PartitionSet::MIN_DAY - 1), std::runtime_error);
+    EXPECT_THROW(PartitionSet::name_of(PartitionSet::MAX_DAY + 1), std::runtime_error);
+}
+
+TEST(PartitionSet, RejectsNamesThatAreNotPartitions) {
+    int64_t day = 42;
+    EXPECT_FALSE(PartitionSet::parse_name("logs_558401108", day));
+    EXPECT_FALSE(PartitionSet::parse_name("logs_-2210904", day));
+    EXPECT_FALSE(PartitionSet::parse_name("logs_2023111", day));
+    EXPECT_FALSE(PartitionSet::parse_name("logs_2023111x", day));
+    EXPECT_FALSE(PartitionSet::parse_name("data_20231114", day));
+    EXPECT_FALSE(PartitionSet::parse_name("logs_20231314", day));
+    EXPECT_FALSE(PartitionSet::parse_name("logs_20231100", day));
+    // Dates that don't exist
+    EXPECT_FALSE(PartitionSet::parse_name("logs_20230231", day));
+    EXPECT_FALSE(PartitionSet::parse_name("logs_20230229", day));
+    EXPECT_FALSE(PartitionSet::parse_name("logs_20230431", day));
+    EXPECT_EQ(42, day);
+}